@@ -6,6 +6,7 @@
 #endif
 #include <deque>
 
+#include <algorithm>
 #include <cstdint>
 #include <climits>
 #include <cstring>
@@ -13,6 +14,7 @@
 #include <cstddef>
 #include <vector>
 #include <array>
+#include <memory>
 #include <tuple>
 #include <iostream>
 #include <string>
@@ -24,11 +26,364 @@
 namespace ambition {
 	using byte_t = unsigned char;
 
-	// now kinda like an output stream
+	// non-owning view of contiguous bytes that live somewhere else (a recv buffer, a mapped file, a byte_buffer).
+	// the memory must outlive the view. read it with byte_buffer::reader.
+	class byte_view {
+	private:
+		const byte_t *m_data = nullptr;
+		size_t m_size = 0;
+
+	public:
+		static const size_t npos = size_t(-1);
+
+		inline byte_view() { }
+
+		inline byte_view(const byte_t *data_, size_t sz) : m_data(data_), m_size(sz) { }
+
+		inline size_t size() const {
+			return m_size;
+		}
+
+		inline bool empty() const {
+			return m_size == 0;
+		}
+
+		inline const byte_t * data() const {
+			return m_data;
+		}
+
+		inline const byte_t * begin() const {
+			return m_data;
+		}
+
+		inline const byte_t * end() const {
+			return m_data + m_size;
+		}
+
+		inline byte_t operator[](size_t i) const {
+			return m_data[i];
+		}
+
+		// sz bytes (or as many as there are) starting at pos, without copying
+		inline byte_view slice(size_t pos, size_t sz = npos) const {
+			if (pos > m_size) throw std::range_error("byte_view slice out of range");
+			return byte_view(m_data + pos, std::min(sz, m_size - pos));
+		}
+	};
+
+	// bytes in ref-counted storage. copies and slices share the storage rather than copying it,
+	// and the storage is freed when the last one goes away.
+	class byte_slice {
+	private:
+		// keeps whatever owns the bytes alive; typically an aliasing shared_ptr
+		std::shared_ptr<const byte_t> m_owner;
+		byte_view m_view;
+
+	public:
+		inline byte_slice() { }
+
+		// view must lie within memory kept alive by owner
+		inline byte_slice(std::shared_ptr<const byte_t> owner_, byte_view view_) : m_owner(std::move(owner_)), m_view(view_) { }
+
+		// copy bytes into new storage of their own
+		static inline byte_slice copy(byte_view v) {
+			auto storage = std::make_shared<std::vector<byte_t>>(v.begin(), v.end());
+			return byte_slice(std::shared_ptr<const byte_t>(storage, storage->data()), byte_view(storage->data(), storage->size()));
+		}
+
+		inline size_t size() const {
+			return m_view.size();
+		}
+
+		inline bool empty() const {
+			return m_view.empty();
+		}
+
+		inline const byte_t * data() const {
+			return m_view.data();
+		}
+
+		inline const byte_view & view() const {
+			return m_view;
+		}
+
+		// false if nothing keeps the bytes alive, i.e. this only borrows them
+		inline bool owned() const {
+			return bool(m_owner);
+		}
+
+		inline operator byte_view() const {
+			return m_view;
+		}
+
+		// sz bytes (or as many as there are) starting at pos, sharing this storage
+		inline byte_slice slice(size_t pos, size_t sz = byte_view::npos) const {
+			return byte_slice(m_owner, m_view.slice(pos, sz));
+		}
+	};
+
+	// hands out byte_slices carved from large shared blocks, so data can be received straight into
+	// ref-counted storage. write into space(), then commit() however much was written.
+	// a block is freed once the slab and every slice of it are done with it.
+	class byte_slab {
+	private:
+		std::shared_ptr<byte_t> m_block;
+		size_t m_block_size;
+		size_t m_min_space;
+		size_t m_used = 0;
+
+	public:
+		// space() always has room for at least min_space bytes
+		inline explicit byte_slab(size_t block_size_ = 65536, size_t min_space_ = 2048) :
+			m_block_size(std::max(block_size_, min_space_)), m_min_space(min_space_) { }
+
+		// where to write next; there is room for capacity() bytes
+		inline byte_t * space() {
+			if (!m_block || m_block_size - m_used < m_min_space) {
+				m_block = std::shared_ptr<byte_t>(new byte_t[m_block_size], std::default_delete<byte_t[]>());
+				m_used = 0;
+			}
+			return m_block.get() + m_used;
+		}
+
+		inline size_t capacity() {
+			space();
+			return m_block_size - m_used;
+		}
+
+		// the next sz bytes written to space() as a slice
+		inline byte_slice commit(size_t sz) {
+			assert(m_block && sz <= m_block_size - m_used);
+			byte_slice ret(m_block, byte_view(m_block.get() + m_used, sz));
+			m_used += sz;
+			return ret;
+		}
+	};
+
+	// true for types with a wire() member returning std::tie() of the fields to send, in order, e.g.
+	//   std::tuple<uint32_t &, float &> wire() { return std::tie(id, x); }
+	//   std::tuple<const uint32_t &, const float &> wire() const { return std::tie(id, x); }
+	// such types can be added to and read from a byte_buffer like a tuple of those fields.
+	template <typename T>
+	struct has_wire {
+	private:
+		template <typename U>
+		static auto test(int) -> decltype(std::declval<const U &>().wire(), std::true_type());
+
+		template <typename U>
+		static std::false_type test(...);
+
+	public:
+		static const bool value = decltype(test<T>(0))::value;
+	};
+
+	// size on the wire of types whose encoding is always the same size: arithmetic types, and
+	// std::arrays, std::tuples and has_wire types made only of those. fixed is false for anything else.
+	template <typename T, typename Enable = void>
+	struct wire_size {
+		static const bool fixed = false;
+		static const size_t value = 0;
+	};
+
+	template <typename T>
+	struct wire_size<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+		static const bool fixed = true;
+		static const size_t value = sizeof(T);
+	};
+
+	template <typename T, size_t Size>
+	struct wire_size<std::array<T, Size>> {
+		static const bool fixed = wire_size<T>::fixed;
+		static const size_t value = fixed ? Size * wire_size<T>::value : 0;
+	};
+
+	template <>
+	struct wire_size<std::tuple<>> {
+		static const bool fixed = true;
+		static const size_t value = 0;
+	};
+
+	template <typename T, typename... TR>
+	struct wire_size<std::tuple<T, TR...>> {
+		using head_t = wire_size<typename std::decay<T>::type>;
+		using tail_t = wire_size<std::tuple<TR...>>;
+		static const bool fixed = head_t::fixed && tail_t::fixed;
+		static const size_t value = fixed ? head_t::value + tail_t::value : 0;
+	};
+
+	template <typename T>
+	struct wire_size<T, typename std::enable_if<has_wire<T>::value>::type> :
+		wire_size<typename std::decay<decltype(std::declval<const T &>().wire())>::type> { };
+
+	// per-thread cache of heap blocks for byte_buffer, in power-of-two size classes.
+	// a buffer that is freed hands its block back to the cache of whichever thread frees it,
+	// so a thread that keeps building and dropping similar buffers stops allocating.
+	class byte_pool {
+	public:
+		// blocks are at least this big; anything smaller lives inline in the byte_buffer
+		static const size_t min_block = 128;
+		static const unsigned class_count = 10;
+		// blocks bigger than this (64KB) always come from and go back to the heap
+		static const size_t max_block = min_block << (class_count - 1);
+		// blocks kept per size class per thread
+		static const size_t max_cached = 64;
+
+		// counts for the current thread
+		struct counters {
+			unsigned long long heap_allocs = 0;
+			unsigned long long heap_frees = 0;
+			unsigned long long pool_hits = 0;
+		};
+
+	private:
+		struct cache_t {
+			bool enabled = true;
+			counters stats;
+			std::vector<byte_t *> blocks[class_count];
+
+			inline ~cache_t() {
+				for (auto &v : blocks) {
+					for (byte_t *p : v) delete[] p;
+				}
+			}
+		};
+
+		static inline cache_t & local() {
+			static thread_local cache_t cache;
+			return cache;
+		}
+
+		static inline unsigned sizeClass(size_t sz) {
+			unsigned c = 0;
+			while ((min_block << c) < sz) c++;
+			return c;
+		}
+
+	public:
+		// get a block of at least cap bytes; cap is rounded up to the size actually provided
+		static inline byte_t * allocate(size_t &cap) {
+			cache_t &cache = local();
+			if (cap > max_block) {
+				cache.stats.heap_allocs++;
+				return new byte_t[cap];
+			}
+			unsigned c = sizeClass(cap);
+			cap = min_block << c;
+			if (!cache.blocks[c].empty()) {
+				byte_t *p = cache.blocks[c].back();
+				cache.blocks[c].pop_back();
+				cache.stats.pool_hits++;
+				return p;
+			}
+			cache.stats.heap_allocs++;
+			return new byte_t[cap];
+		}
+
+		// give back a block from allocate(), with the capacity it returned
+		static inline void deallocate(byte_t *p, size_t cap) {
+			cache_t &cache = local();
+			if (cache.enabled && cap <= max_block) {
+				std::vector<byte_t *> &v = cache.blocks[sizeClass(cap)];
+				if (v.size() < max_cached) {
+					// so keeping the cache doesn't allocate either
+					if (v.capacity() == 0) v.reserve(max_cached);
+					v.push_back(p);
+					return;
+				}
+			}
+			cache.stats.heap_frees++;
+			delete[] p;
+		}
+
+		static inline const counters & stats() {
+			return local().stats;
+		}
+
+		// turn caching on or off for the current thread; turning it off frees what is cached
+		static inline void enable(bool b) {
+			local().enabled = b;
+			if (!b) trim();
+		}
+
+		// free every block cached by the current thread
+		static inline void trim() {
+			cache_t &cache = local();
+			for (auto &v : cache.blocks) {
+				for (byte_t *p : v) {
+					cache.stats.heap_frees++;
+					delete[] p;
+				}
+				v.clear();
+			}
+		}
+	};
+
+	// now kinda like an output stream.
+	// small contents are stored inline; bigger ones in a block from byte_pool.
 	class byte_buffer {
 		static_assert(CHAR_BIT == 8, "damn");
+	public:
+		static const size_t inline_capacity = 64;
+
 	private:
-		std::vector<byte_t> m_data;
+		byte_t *m_data;
+		size_t m_size = 0;
+		size_t m_capacity = inline_capacity;
+		byte_t m_inline[inline_capacity];
+
+		inline bool isInline() const {
+			return m_data == m_inline;
+		}
+
+		inline void freeBlock() {
+			if (!isInline()) byte_pool::deallocate(m_data, m_capacity);
+			m_data = m_inline;
+			m_capacity = inline_capacity;
+		}
+
+		inline void grow(size_t cap) {
+			cap = std::max(cap, m_capacity * 2);
+			byte_t *p = byte_pool::allocate(cap);
+			std::memcpy(p, m_data, m_size);
+			freeBlock();
+			m_data = p;
+			m_capacity = cap;
+		}
+
+		inline void append(const byte_t *d, size_t sz) {
+			if (m_size + sz > m_capacity) grow(m_size + sz);
+			// d may be null when sz is 0
+			if (sz) std::memcpy(m_data + m_size, d, sz);
+			m_size += sz;
+		}
+
+		inline void push_back(byte_t b) {
+			if (m_size == m_capacity) grow(m_size + 1);
+			m_data[m_size++] = b;
+		}
+
+		// grow by sz bytes, left uninitialised; returns where they start
+		inline byte_t * extend(size_t sz) {
+			if (m_size + sz > m_capacity) grow(m_size + sz);
+			byte_t *p = m_data + m_size;
+			m_size += sz;
+			return p;
+		}
+
+		inline void moveFrom(byte_buffer &other) {
+			if (other.isInline()) {
+				m_data = m_inline;
+				m_capacity = inline_capacity;
+				std::memcpy(m_inline, other.m_inline, other.m_size);
+			} else {
+				m_data = other.m_data;
+				m_capacity = other.m_capacity;
+				other.m_data = other.m_inline;
+				other.m_capacity = inline_capacity;
+			}
+			m_size = other.m_size;
+			other.m_size = 0;
+		}
 
 		// test if fpu endianness matches cpu endianness, assuming iee754 representation or similar
 		// http://stackoverflow.com/questions/2945174/floating-point-endianness
@@ -43,39 +398,185 @@ namespace ambition {
 			return mt;
 		}
 
+		// test_fpu_endianness(), worked out once
+		static inline bool fpu_endianness_ok() {
+			static const bool ok = test_fpu_endianness();
+			return ok;
+		}
+
+		static inline bool host_little_endian() {
+			static const bool little = [] {
+				uint16_t x = 1;
+				return *reinterpret_cast<const byte_t *>(&x) == 1;
+			}();
+			return little;
+		}
+
+		template <size_t Size>
+		struct uint_of_size { };
+
+		// writes and reads fixed-layout types (see wire_size) straight to and from memory
+		template <typename T, typename Enable = void>
+		struct fixed_impl { };
+
+		static inline uint8_t byte_swap(uint8_t x) {
+			return x;
+		}
+
+		static inline uint16_t byte_swap(uint16_t x) {
+			return uint16_t((x << 8) | (x >> 8));
+		}
+
+		static inline uint32_t byte_swap(uint32_t x) {
+#ifdef __GNUC__
+			return __builtin_bswap32(x);
+#else
+			return (x << 24) | ((x << 8) & 0x00FF0000u) | ((x >> 8) & 0x0000FF00u) | (x >> 24);
+#endif
+		}
+
+		static inline uint64_t byte_swap(uint64_t x) {
+#ifdef __GNUC__
+			return __builtin_bswap64(x);
+#else
+			return (uint64_t(byte_swap(uint32_t(x))) << 32) | byte_swap(uint32_t(x >> 32));
+#endif
+		}
+
+		// copy count values of Size bytes each, swapping between host and network (big-endian) order.
+		// the loop is simple enough for the compiler to vectorise.
+		template <size_t Size>
+		static inline void copy_swapped(byte_t *dst, const byte_t *src, size_t count) {
+			if (!host_little_endian()) {
+				std::memcpy(dst, src, count * Size);
+				return;
+			}
+			using uint_t = typename uint_of_size<Size>::type;
+			for (size_t i = 0; i < count; i++) {
+				uint_t v;
+				std::memcpy(&v, src + i * Size, Size);
+				v = byte_swap(v);
+				std::memcpy(dst + i * Size, &v, Size);
+			}
+		}
+
+		// arithmetic types that can be converted a whole array at a time (single bytes are just copied)
+		template <typename T>
+		struct is_bulk : std::integral_constant<bool,
+			std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && (sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8)
+		> { };
+
+		template <typename T>
+		static inline bool bulk_ok() {
+			return std::is_integral<T>::value || fpu_endianness_ok();
+		}
+
+		template <typename T>
+		inline void add_array_bulk(const T *t, size_t sz, std::true_type) {
+			if (!bulk_ok<T>()) {
+				add_array_bulk(t, sz, std::false_type());
+				return;
+			}
+			copy_swapped<sizeof(T)>(extend(sz * sizeof(T)), reinterpret_cast<const byte_t *>(t), sz);
+		}
+
+		template <typename T>
+		inline void add_array_bulk(const T *t, size_t sz, std::false_type) {
+			for (size_t i = 0; i < sz; i++) {
+				add(t[i]);
+			}
+		}
+
 	public:
-		inline byte_buffer() { }
+		inline byte_buffer() : m_data(m_inline) { }
+
+		inline byte_buffer(const byte_t *data_, size_t sz) : m_data(m_inline) {
+			append(data_, sz);
+		}
 
-		inline byte_buffer(const byte_t *data_, size_t sz) : m_data(data_, data_ + sz) { }
+		inline explicit byte_buffer(byte_view v) : m_data(m_inline) {
+			append(v.data(), v.size());
+		}
 
-		byte_buffer(const byte_buffer &) = default;
-		byte_buffer & operator=(const byte_buffer &) = default;
+		inline byte_buffer(const byte_buffer &other) : m_data(m_inline) {
+			append(other.m_data, other.m_size);
+		}
 
-		byte_buffer(byte_buffer &&other) : m_data(std::move(other.m_data)) { }
+		inline byte_buffer & operator=(const byte_buffer &other) {
+			if (this != &other) {
+				m_size = 0;
+				append(other.m_data, other.m_size);
+			}
+			return *this;
+		}
+
+		inline byte_buffer(byte_buffer &&other) {
+			moveFrom(other);
+		}
 
-		byte_buffer & operator=(byte_buffer &&other) {
-			m_data = std::move(other.m_data);
+		inline byte_buffer & operator=(byte_buffer &&other) {
+			if (this != &other) {
+				freeBlock();
+				moveFrom(other);
+			}
 			return *this;
 		}
 
+		inline ~byte_buffer() {
+			freeBlock();
+		}
+
 		inline size_t size() const {
-			return m_data.size();
+			return m_size;
+		}
+
+		inline size_t capacity() const {
+			return m_capacity;
+		}
+
+		inline void reserve(size_t cap) {
+			if (cap > m_capacity) grow(cap);
+		}
+
+		// empty the buffer, keeping its storage
+		inline void clear() {
+			m_size = 0;
 		}
 
 		inline const byte_t * data() const {
-			return &m_data[0];
+			return m_data;
+		}
+
+		inline byte_view view() const {
+			return byte_view(m_data, m_size);
+		}
+
+		// move the contents into shared storage, without copying unless they are stored inline.
+		// this buffer is left empty.
+		inline byte_slice release() {
+			if (isInline()) {
+				byte_slice ret = byte_slice::copy(view());
+				m_size = 0;
+				return ret;
+			}
+			byte_t *p = m_data;
+			size_t cap = m_capacity;
+			byte_view v(p, m_size);
+			m_data = m_inline;
+			m_capacity = inline_capacity;
+			m_size = 0;
+			std::shared_ptr<const byte_t> owner(p, [cap](const byte_t *q) { byte_pool::deallocate(const_cast<byte_t *>(q), cap); });
+			return byte_slice(std::move(owner), v);
 		}
 
 		inline const byte_t * dump(byte_t *out) const {
-			std::memcpy(out, &m_data[0], m_data.size());
+			std::memcpy(out, m_data, m_size);
 			return out;
 		}
 		
 		template <typename T>
 		inline void add_array(const T *t, size_t sz) {
-			for (size_t i = 0; i < sz; i++) {
-				add(t[i]);
-			}
+			add_array_bulk(t, sz, typename is_bulk<T>::type());
 		}
 		
 		template <typename T, typename Enable = void>
@@ -92,7 +593,7 @@ namespace ambition {
 				for (unsigned i = 0; i < sizeof(IntT); i++) {
 					uintmax_t md = mask & uintmax_t(d);
 					md >>= (8 * (sizeof(IntT) - i - 1));
-					this_.m_data.push_back(byte_t(md));
+					this_.push_back(byte_t(md));
 					mask >>= 8;
 				}
 			}
@@ -103,7 +604,7 @@ namespace ambition {
 			static const bool enable = true;
 			
 			inline static void go(byte_buffer &this_, float f) {
-				if (test_fpu_endianness()) {
+				if (fpu_endianness_ok()) {
 					this_.add<uint32_t>(reinterpret_cast<uint32_t &>(f));
 				} else {
 					assert(false && "unimplemented");
@@ -116,7 +617,7 @@ namespace ambition {
 			static const bool enable = true;
 			
 			inline static void go(byte_buffer &this_, double f) {
-				if (test_fpu_endianness()) {
+				if (fpu_endianness_ok()) {
 					this_.add<uint64_t>(reinterpret_cast<uint64_t &>(f));
 				} else {
 					assert(false && "unimplemented");
@@ -151,6 +652,14 @@ namespace ambition {
 			static const bool enable = true;
 
 			inline static void go(byte_buffer &this_, const std::array<T, Size> &a) {
+				go(this_, a, std::integral_constant<bool, wire_size<std::array<T, Size>>::fixed>());
+			}
+
+			inline static void go(byte_buffer &this_, const std::array<T, Size> &a, std::true_type) {
+				fixed_impl<std::array<T, Size>>::store(this_.extend(wire_size<std::array<T, Size>>::value), a);
+			}
+
+			inline static void go(byte_buffer &this_, const std::array<T, Size> &a, std::false_type) {
 				this_.add_array<T>(&a[0], Size);
 			}
 		};
@@ -175,6 +684,15 @@ namespace ambition {
 			};
 
 			inline static void go(byte_buffer &this_, const std::tuple<TR...> &t) {
+				go(this_, t, std::integral_constant<bool, wire_size<std::tuple<TR...>>::fixed>());
+			}
+
+			// fixed layout: make room once, then write every field in place
+			inline static void go(byte_buffer &this_, const std::tuple<TR...> &t, std::true_type) {
+				fixed_impl<std::tuple<TR...>>::store(this_.extend(wire_size<std::tuple<TR...>>::value), t);
+			}
+
+			inline static void go(byte_buffer &this_, const std::tuple<TR...> &t, std::false_type) {
 				using tuple_t = std::tuple<TR...>;
 				impl<std::tuple_size<tuple_t>::value, 0, tuple_t>::go(this_, t);
 			}
@@ -202,21 +720,25 @@ namespace ambition {
 			return *this;
 		}
 		
-		// something like an input stream (slightly iterator-ish)
+		// something like an input stream (slightly iterator-ish).
+		// reads any contiguous memory; the bytes must not change or move while being read.
 		class reader {
 		private:
-			const byte_buffer *m_buf;
+			const byte_t *m_data;
+			size_t m_size;
 			size_t m_i;
 
 		public:
-			inline explicit reader(const byte_buffer &buf_) : m_buf(&buf_), m_i(0) { }
+			inline explicit reader(const byte_buffer &buf_) : m_data(buf_.data()), m_size(buf_.size()), m_i(0) { }
+
+			inline explicit reader(byte_view v) : m_data(v.data()), m_size(v.size()), m_i(0) { }
 
 			inline size_t size() const {
-				return m_buf->size();
+				return m_size;
 			}
 
 			inline std::ptrdiff_t remaining(size_t i) const {
-				return std::ptrdiff_t(m_buf->size()) - std::ptrdiff_t(i);
+				return std::ptrdiff_t(m_size) - std::ptrdiff_t(i);
 			}
 
 			inline std::ptrdiff_t remaining() const {
@@ -242,14 +764,27 @@ namespace ambition {
 			}
 
 			template <typename T>
-			inline size_t peek_array(T *t, size_t sz, size_t i) const {
+			inline size_t peek_array_bulk(T *t, size_t sz, size_t i, std::true_type) const {
+				if (!bulk_ok<T>()) return peek_array_bulk(t, sz, i, std::false_type());
+				if (remaining(i) < std::ptrdiff_t(sz * sizeof(T))) throw std::range_error("byte_buffer index out of range");
+				copy_swapped<sizeof(T)>(reinterpret_cast<byte_t *>(t), m_data + i, sz);
+				return sz * sizeof(T);
+			}
+
+			template <typename T>
+			inline size_t peek_array_bulk(T *t, size_t sz, size_t i, std::false_type) const {
 				size_t c = 0;
-				for (int j = 0; j < sz; j++) {
+				for (size_t j = 0; j < sz; j++) {
 					c += peek_impl<T>::go(*this, i + c, *t++);
 				}
 				return c;
 			}
 
+			template <typename T>
+			inline size_t peek_array(T *t, size_t sz, size_t i) const {
+				return peek_array_bulk(t, sz, i, typename is_bulk<T>::type());
+			}
+
 			template <typename T>
 			inline size_t peek_array(T *t, size_t sz) const {
 				return peek_array<T>(t, sz, m_i);
@@ -260,6 +795,36 @@ namespace ambition {
 				size_t c = peek_array<T>(t, sz);
 				seek(m_i + c);
 			}
+
+			// sz bytes at i as a view into the memory being read, without copying
+			inline byte_view peek_view(size_t sz, size_t i) const {
+				if (remaining(i) < std::ptrdiff_t(sz)) throw std::range_error("byte_buffer index out of range");
+				return byte_view(m_data + i, sz);
+			}
+
+			inline byte_view peek_view(size_t sz) const {
+				return peek_view(sz, m_i);
+			}
+
+			inline byte_view get_view(size_t sz) {
+				byte_view v = peek_view(sz);
+				seek(m_i + sz);
+				return v;
+			}
+
+			// a fixed-layout value (see wire_size) at i: one bounds check, then straight out of memory
+			template <typename T>
+			inline size_t peek_fixed(size_t i, T &t) const {
+				const size_t sz = wire_size<T>::value;
+				if (remaining(i) < std::ptrdiff_t(sz)) throw std::range_error("byte_buffer index out of range");
+				fixed_impl<T>::load(m_data + i, t);
+				return sz;
+			}
+
+			// everything not yet read
+			inline byte_view rest() const {
+				return peek_view(size_t(std::max(std::ptrdiff_t(0), remaining())));
+			}
 			
 			template <typename T, typename Enable = void>
 			struct peek_impl {
@@ -274,7 +839,7 @@ namespace ambition {
 					if (this_.remaining(i) < std::ptrdiff_t(sizeof(IntT))) throw std::range_error("byte_buffer index out of range");
 					uintmax_t ret = 0;
 					for (unsigned j = 0; j < sizeof(IntT); j++) {
-						uintmax_t b = this_.m_buf->m_data[i + j];
+						uintmax_t b = this_.m_data[i + j];
 						b <<= (8 * (sizeof(IntT) - j - 1));
 						ret |= b;
 					}
@@ -290,7 +855,7 @@ namespace ambition {
 				inline static size_t go(const reader &this_, size_t i, float &f) {
 					if (this_.remaining(i) < std::ptrdiff_t(sizeof(float))) throw std::range_error("byte_buffer index out of range");
 					uint32_t d = this_.peek<uint32_t>(i);
-					if (test_fpu_endianness()) {
+					if (fpu_endianness_ok()) {
 						f = reinterpret_cast<float &>(d);
 					} else {
 						assert(false && "not implemented");
@@ -307,7 +872,7 @@ namespace ambition {
 				inline static size_t go(const reader &this_, size_t i, double &f) {
 					if (this_.remaining(i) < std::ptrdiff_t(sizeof(double))) throw std::range_error("byte_buffer index out of range");
 					uint64_t d = this_.peek<uint64_t>(i);
-					if (test_fpu_endianness()) {
+					if (fpu_endianness_ok()) {
 						f = reinterpret_cast<double &>(d);
 					} else {
 						assert(false && "not implemented");
@@ -325,7 +890,7 @@ namespace ambition {
 					uint16_t len;
 					size_t c = peek_impl<uint16_t>::go(this_, i, len);
 					if (this_.remaining(i + c) < std::ptrdiff_t(len)) throw std::range_error("byte_buffer string length out of range");
-					str = std::string(reinterpret_cast<const char *>(&this_.m_buf->m_data[i + c]), len);
+					str = std::string(reinterpret_cast<const char *>(this_.m_data + i + c), len);
 					c += size_t(len);
 					return c;
 				}
@@ -349,6 +914,14 @@ namespace ambition {
 				static const bool enable = true;
 
 				inline static size_t go(const reader &this_, size_t i, std::array<T, Size> &a) {
+					return go(this_, i, a, std::integral_constant<bool, wire_size<std::array<T, Size>>::fixed>());
+				}
+
+				inline static size_t go(const reader &this_, size_t i, std::array<T, Size> &a, std::true_type) {
+					return this_.peek_fixed(i, a);
+				}
+
+				inline static size_t go(const reader &this_, size_t i, std::array<T, Size> &a, std::false_type) {
 					return this_.peek_array<T>(&a[0], Size, i);
 				}
 			};
@@ -360,7 +933,8 @@ namespace ambition {
 				template <size_t Size, size_t I, typename TupleT>
 				struct impl {
 					inline static size_t go(const reader &this_, size_t i, TupleT &t) {
-						size_t c = peek_impl<typename std::tuple_element<I, TupleT>::type>::go(this_, i, std::get<I>(t));
+						using elem_t = typename std::decay<typename std::tuple_element<I, TupleT>::type>::type;
+						size_t c = peek_impl<elem_t>::go(this_, i, std::get<I>(t));
 						c += impl<Size, I + 1, TupleT>::go(this_, i + c, t);
 						return c;
 					}
@@ -375,6 +949,14 @@ namespace ambition {
 				};
 
 				inline static size_t go(const reader &this_, size_t i, std::tuple<TR...> &t) {
+					return go(this_, i, t, std::integral_constant<bool, wire_size<std::tuple<TR...>>::fixed>());
+				}
+
+				inline static size_t go(const reader &this_, size_t i, std::tuple<TR...> &t, std::true_type) {
+					return this_.peek_fixed(i, t);
+				}
+
+				inline static size_t go(const reader &this_, size_t i, std::tuple<TR...> &t, std::false_type) {
 					using tuple_t = std::tuple<TR...>;
 					return impl<std::tuple_size<tuple_t>::value, 0, tuple_t>::go(this_, i, t);
 				}
@@ -414,42 +996,681 @@ namespace ambition {
 
 	};
 	
+	template <>
+	struct byte_buffer::uint_of_size<1> {
+		using type = uint8_t;
+	};
+
+	template <>
+	struct byte_buffer::uint_of_size<2> {
+		using type = uint16_t;
+	};
+
+	template <>
+	struct byte_buffer::uint_of_size<4> {
+		using type = uint32_t;
+	};
+
+	template <>
+	struct byte_buffer::uint_of_size<8> {
+		using type = uint64_t;
+	};
+
 	template <>
 	inline void byte_buffer::add_array<unsigned char>(const unsigned char *d, size_t sz) {
-		m_data.insert<const byte_t *>(m_data.end(), reinterpret_cast<const byte_t *>(d), reinterpret_cast<const byte_t *>(d) + sz);
+		append(reinterpret_cast<const byte_t *>(d), sz);
 	}
 
 	template <>
 	inline void byte_buffer::add_array<signed char>(const signed char *d, size_t sz) {
-		m_data.insert<const byte_t *>(m_data.end(), reinterpret_cast<const byte_t *>(d), reinterpret_cast<const byte_t *>(d) + sz);
+		append(reinterpret_cast<const byte_t *>(d), sz);
 	}
 
 	template <>
 	inline void byte_buffer::add_array<char>(const char *d, size_t sz) {
-		m_data.insert<const byte_t *>(m_data.end(), reinterpret_cast<const byte_t *>(d), reinterpret_cast<const byte_t *>(d) + sz);
+		append(reinterpret_cast<const byte_t *>(d), sz);
 	}
 	
 	template <>
 	inline size_t byte_buffer::reader::peek_array<unsigned char>(unsigned char *d, size_t sz, size_t i) const {
 		if (remaining(i) < std::ptrdiff_t(sz)) throw std::range_error("byte_buffer index out of range");
-		std::memcpy(d, &m_buf->m_data[i], sz);
+		std::memcpy(d, m_data + i, sz);
 		return sz;
 	}
 
 	template <>
 	inline size_t byte_buffer::reader::peek_array<signed char>(signed char *d, size_t sz, size_t i) const {
 		if (remaining(i) < std::ptrdiff_t(sz)) throw std::range_error("byte_buffer index out of range");
-		std::memcpy(d, &m_buf->m_data[i], sz);
+		std::memcpy(d, m_data + i, sz);
 		return sz;
 	}
 
 	template <>
 	inline size_t byte_buffer::reader::peek_array<char>(char *d, size_t sz, size_t i) const {
 		if (remaining(i) < std::ptrdiff_t(sz)) throw std::range_error("byte_buffer index out of range");
-		std::memcpy(d, &m_buf->m_data[i], sz);
+		std::memcpy(d, m_data + i, sz);
 		return sz;
 	}
 
+
+	template <typename T>
+	struct byte_buffer::fixed_impl<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+		using uint_t = typename uint_of_size<sizeof(T)>::type;
+
+		static inline void store(byte_t *p, T t) {
+			assert((std::is_integral<T>::value || fpu_endianness_ok()) && "unimplemented");
+			uint_t v;
+			if (std::is_integral<T>::value) {
+				v = uint_t(t);
+			} else {
+				std::memcpy(&v, &t, sizeof(T));
+			}
+			copy_swapped<sizeof(T)>(p, reinterpret_cast<const byte_t *>(&v), 1);
+		}
+
+		static inline void load(const byte_t *p, T &t) {
+			assert((std::is_integral<T>::value || fpu_endianness_ok()) && "not implemented");
+			uint_t v;
+			copy_swapped<sizeof(T)>(reinterpret_cast<byte_t *>(&v), p, 1);
+			if (std::is_integral<T>::value) {
+				t = T(v);
+			} else {
+				std::memcpy(&t, &v, sizeof(T));
+			}
+		}
+	};
+
+	template <typename T, size_t Size>
+	struct byte_buffer::fixed_impl<std::array<T, Size>> {
+		static const size_t elem_size = wire_size<T>::value;
+
+		static inline void store(byte_t *p, const std::array<T, Size> &a) {
+			store(p, a, typename is_bulk<T>::type());
+		}
+
+		static inline void store(byte_t *p, const std::array<T, Size> &a, std::true_type) {
+			assert(bulk_ok<T>() && "unimplemented");
+			copy_swapped<sizeof(T)>(p, reinterpret_cast<const byte_t *>(a.data()), Size);
+		}
+
+		static inline void store(byte_t *p, const std::array<T, Size> &a, std::false_type) {
+			for (size_t i = 0; i < Size; i++) {
+				fixed_impl<T>::store(p + i * elem_size, a[i]);
+			}
+		}
+
+		static inline void load(const byte_t *p, std::array<T, Size> &a) {
+			load(p, a, typename is_bulk<T>::type());
+		}
+
+		static inline void load(const byte_t *p, std::array<T, Size> &a, std::true_type) {
+			assert(bulk_ok<T>() && "not implemented");
+			copy_swapped<sizeof(T)>(reinterpret_cast<byte_t *>(a.data()), p, Size);
+		}
+
+		static inline void load(const byte_t *p, std::array<T, Size> &a, std::false_type) {
+			for (size_t i = 0; i < Size; i++) {
+				fixed_impl<T>::load(p + i * elem_size, a[i]);
+			}
+		}
+	};
+
+	// also handles tuples of references, as returned by wire()
+	template <typename... TR>
+	struct byte_buffer::fixed_impl<std::tuple<TR...>> {
+		using tuple_t = std::tuple<TR...>;
+
+		// field offsets are worked out at compile time
+		template <size_t I, size_t Offset, typename Dummy = void>
+		struct impl {
+			using elem_t = typename std::decay<typename std::tuple_element<I, tuple_t>::type>::type;
+			using next_t = impl<I + 1, Offset + wire_size<elem_t>::value>;
+
+			static inline void store(byte_t *p, const tuple_t &t) {
+				fixed_impl<elem_t>::store(p + Offset, std::get<I>(t));
+				next_t::store(p, t);
+			}
+
+			static inline void load(const byte_t *p, tuple_t &t) {
+				fixed_impl<elem_t>::load(p + Offset, std::get<I>(t));
+				next_t::load(p, t);
+			}
+		};
+
+		template <size_t Offset, typename Dummy>
+		struct impl<sizeof...(TR), Offset, Dummy> {
+			static inline void store(byte_t *, const tuple_t &) { }
+			static inline void load(const byte_t *, tuple_t &) { }
+		};
+
+		static inline void store(byte_t *p, const tuple_t &t) {
+			impl<0, 0>::store(p, t);
+		}
+
+		static inline void load(const byte_t *p, tuple_t &t) {
+			impl<0, 0>::load(p, t);
+		}
+	};
+
+	template <typename T>
+	struct byte_buffer::fixed_impl<T, typename std::enable_if<has_wire<T>::value>::type> {
+		static inline void store(byte_t *p, const T &t) {
+			auto w = t.wire();
+			fixed_impl<decltype(w)>::store(p, w);
+		}
+
+		static inline void load(const byte_t *p, T &t) {
+			auto w = t.wire();
+			fixed_impl<decltype(w)>::load(p, w);
+		}
+	};
+
+	// has_wire types go on the wire as the tuple of their fields
+	template <typename T>
+	struct byte_buffer::add_impl<T, typename std::enable_if<has_wire<T>::value>::type> {
+		static const bool enable = true;
+
+		inline static void go(byte_buffer &this_, const T &t) {
+			this_.add(t.wire());
+		}
+	};
+
+	template <typename T>
+	struct byte_buffer::reader::peek_impl<T, typename std::enable_if<has_wire<T>::value>::type> {
+		static const bool enable = true;
+
+		inline static size_t go(const reader &this_, size_t i, T &t) {
+			auto w = t.wire();
+			return peek_impl<decltype(w)>::go(this_, i, w);
+		}
+	};
+
+	// compact encodings.
+	// wrap a value in one of these to change how it goes on the wire; each converts to and from
+	// the value it holds, so r.get<varint<uint32_t>>() can be assigned straight to a uint32_t.
+
+	// unsigned LEB128: 7 bits per byte, high bit set on all but the last
+	template <typename UIntT>
+	struct varint {
+		static_assert(std::is_integral<UIntT>::value && std::is_unsigned<UIntT>::value, "varint needs an unsigned type");
+		UIntT value;
+		inline varint(UIntT v = 0) : value(v) { }
+		inline operator UIntT() const { return value; }
+	};
+
+	// signed integer mapped so small magnitudes are small (0, -1, 1, -2 -> 0, 1, 2, 3), then sent as a varint
+	template <typename IntT>
+	struct zigzag {
+		static_assert(std::is_integral<IntT>::value && std::is_signed<IntT>::value, "zigzag needs a signed type");
+		using uint_t = typename std::make_unsigned<IntT>::type;
+		IntT value;
+		inline zigzag(IntT v = 0) : value(v) { }
+		inline operator IntT() const { return value; }
+
+		static inline uint_t encode(IntT v) {
+			return (uint_t(v) << 1) ^ uint_t(v < 0 ? -1 : 0);
+		}
+
+		static inline IntT decode(uint_t u) {
+			return IntT((u >> 1) ^ (uint_t(0) - (u & 1)));
+		}
+	};
+
+	// float clamped to [Min, Max] and sent as a Bits-bit fixed point number.
+	// precision is (Max - Min) / (2^Bits - 1). on its own it takes whole bytes; inside packed<> exactly Bits bits.
+	template <int Min, int Max, unsigned Bits>
+	struct quantized {
+		static_assert(Min < Max, "empty range");
+		static_assert(Bits > 0 && Bits <= 32, "1 to 32 bits");
+		using uint_t = typename std::conditional<(Bits <= 8), uint8_t, typename std::conditional<(Bits <= 16), uint16_t, uint32_t>::type>::type;
+		float value;
+		inline quantized(float v = 0) : value(v) { }
+		inline operator float() const { return value; }
+
+		static inline uint32_t encode(float v) {
+			const double steps = double((uint64_t(1) << Bits) - 1);
+			double t = (double(v) - Min) / (double(Max) - Min);
+			t = t < 0 ? 0 : t > 1 ? 1 : t;
+			return uint32_t(t * steps + 0.5);
+		}
+
+		static inline float decode(uint32_t q) {
+			const double steps = double((uint64_t(1) << Bits) - 1);
+			return float(Min + (double(Max) - Min) * (q / steps));
+		}
+	};
+
+	// unsigned value in exactly N bits; only meaningful inside packed<>
+	template <unsigned N, typename UIntT = uint32_t>
+	struct bits {
+		static_assert(N > 0 && N <= sizeof(UIntT) * 8, "too many bits for the type");
+		UIntT value;
+		inline bits(UIntT v = 0) : value(v) { }
+		inline operator UIntT() const { return value; }
+	};
+
+	// string or vector with a varint length instead of a uint16_t one
+	template <typename T>
+	struct varsize {
+		T value;
+		inline varsize() { }
+		inline varsize(const T &v) : value(v) { }
+		inline operator const T &() const { return value; }
+	};
+
+	// writes values bit by bit (most significant first) to the end of a byte_buffer.
+	// the last byte is padded with zeros by flush(), which the destructor also calls.
+	class bit_writer {
+	private:
+		byte_buffer *m_buf;
+		uint64_t m_acc = 0;
+		unsigned m_count = 0;
+
+	public:
+		inline explicit bit_writer(byte_buffer &buf_) : m_buf(&buf_) { }
+
+		bit_writer(const bit_writer &) = delete;
+		bit_writer & operator=(const bit_writer &) = delete;
+
+		inline ~bit_writer() {
+			flush();
+		}
+
+		inline void write(uint64_t v, unsigned n) {
+			assert(n <= 64);
+			if (n > 32) {
+				write(v >> 32, n - 32);
+				write(v, 32);
+				return;
+			}
+			// m_count < 8 here, so this fits
+			m_acc = (m_acc << n) | (v & ((uint64_t(1) << n) - 1));
+			m_count += n;
+			while (m_count >= 8) {
+				m_count -= 8;
+				m_buf->add<uint8_t>(uint8_t(m_acc >> m_count));
+			}
+			m_acc &= (uint64_t(1) << m_count) - 1;
+		}
+
+		inline void write_bool(bool b) {
+			write(b, 1);
+		}
+
+		inline void write_varint(uint64_t v) {
+			while (v >= 0x80) {
+				write((v & 0x7F) | 0x80, 8);
+				v >>= 7;
+			}
+			write(v, 8);
+		}
+
+		// pad to a byte boundary
+		inline void flush() {
+			if (m_count) {
+				m_buf->add<uint8_t>(uint8_t(m_acc << (8 - m_count)));
+				m_acc = 0;
+				m_count = 0;
+			}
+		}
+	};
+
+	// reads what a bit_writer wrote, starting at a byte position of a reader
+	class bit_reader {
+	private:
+		const byte_buffer::reader *m_r;
+		size_t m_i;
+		uint64_t m_acc = 0;
+		unsigned m_count = 0;
+
+	public:
+		inline bit_reader(const byte_buffer::reader &r_, size_t i_) : m_r(&r_), m_i(i_) { }
+
+		inline explicit bit_reader(const byte_buffer::reader &r_) : m_r(&r_), m_i(r_.position()) { }
+
+		inline uint64_t read(unsigned n) {
+			assert(n <= 64);
+			if (n > 32) {
+				uint64_t hi = read(n - 32);
+				return (hi << 32) | read(32);
+			}
+			while (m_count < n) {
+				m_acc = (m_acc << 8) | m_r->peek<uint8_t>(m_i++);
+				m_count += 8;
+			}
+			m_count -= n;
+			uint64_t v = (m_acc >> m_count) & ((uint64_t(1) << n) - 1);
+			m_acc &= (uint64_t(1) << m_count) - 1;
+			return v;
+		}
+
+		inline bool read_bool() {
+			return read(1);
+		}
+
+		inline uint64_t read_varint() {
+			uint64_t v = 0;
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				uint64_t b = read(8);
+				if (shift == 63 && (b & 0x7E)) throw std::range_error("byte_buffer varint out of range");
+				v |= (b & 0x7F) << shift;
+				if (!(b & 0x80)) return v;
+			}
+			throw std::range_error("byte_buffer varint too long");
+		}
+
+		// drop the padding to the next byte boundary
+		inline void align() {
+			m_acc = 0;
+			m_count = 0;
+		}
+
+		// byte position after everything read so far (including any partly read byte)
+		inline size_t position() const {
+			return m_i;
+		}
+	};
+
+	// how each kind of field goes in and out of a bit stream
+	template <typename T, typename Enable = void>
+	struct bit_field { };
+
+	template <typename IntT>
+	struct bit_field<IntT, typename std::enable_if<std::is_integral<IntT>::value && !std::is_same<IntT, bool>::value>::type> {
+		static inline void write(bit_writer &w, IntT v) { w.write(uint64_t(v), sizeof(IntT) * 8); }
+		static inline void read(bit_reader &r, IntT &v) { v = IntT(r.read(sizeof(IntT) * 8)); }
+	};
+
+	template <>
+	struct bit_field<bool> {
+		static inline void write(bit_writer &w, bool v) { w.write_bool(v); }
+		static inline void read(bit_reader &r, bool &v) { v = r.read_bool(); }
+	};
+
+	template <unsigned N, typename UIntT>
+	struct bit_field<bits<N, UIntT>> {
+		static inline void write(bit_writer &w, const bits<N, UIntT> &v) { w.write(v.value, N); }
+		static inline void read(bit_reader &r, bits<N, UIntT> &v) { v.value = UIntT(r.read(N)); }
+	};
+
+	template <int Min, int Max, unsigned Bits>
+	struct bit_field<quantized<Min, Max, Bits>> {
+		using q_t = quantized<Min, Max, Bits>;
+		static inline void write(bit_writer &w, const q_t &v) { w.write(q_t::encode(v.value), Bits); }
+		static inline void read(bit_reader &r, q_t &v) { v.value = q_t::decode(uint32_t(r.read(Bits))); }
+	};
+
+	template <typename UIntT>
+	struct bit_field<varint<UIntT>> {
+		static inline void write(bit_writer &w, const varint<UIntT> &v) { w.write_varint(v.value); }
+		static inline void read(bit_reader &r, varint<UIntT> &v) { v.value = UIntT(r.read_varint()); }
+	};
+
+	template <typename IntT>
+	struct bit_field<zigzag<IntT>> {
+		static inline void write(bit_writer &w, const zigzag<IntT> &v) { w.write_varint(zigzag<IntT>::encode(v.value)); }
+		static inline void read(bit_reader &r, zigzag<IntT> &v) { v.value = zigzag<IntT>::decode(typename zigzag<IntT>::uint_t(r.read_varint())); }
+	};
+
+	// a tuple whose fields are packed together at bit granularity and padded to a whole byte at the end,
+	// e.g. packed<bits<12>, quantized<-512, 512, 16>, bool> for an entity id, a coordinate and a flag in 4 bytes.
+	template <typename... TR>
+	struct packed {
+		std::tuple<TR...> fields;
+		inline packed() { }
+		inline packed(const TR &...tr) : fields(tr...) { }
+	};
+
+	template <typename... TR>
+	inline packed<TR...> make_packed(const TR &...tr) {
+		return packed<TR...>(tr...);
+	}
+
+	template <typename... TR>
+	struct byte_buffer::add_impl<packed<TR...>, void> {
+		static const bool enable = true;
+
+		template <size_t I, typename Dummy = void>
+		struct impl {
+			inline static void go(bit_writer &w, const std::tuple<TR...> &t) {
+				bit_field<typename std::tuple_element<I, std::tuple<TR...>>::type>::write(w, std::get<I>(t));
+				impl<I + 1>::go(w, t);
+			}
+		};
+
+		template <typename Dummy>
+		struct impl<sizeof...(TR), Dummy> {
+			inline static void go(bit_writer &, const std::tuple<TR...> &) { }
+		};
+
+		inline static void go(byte_buffer &this_, const packed<TR...> &p) {
+			bit_writer w(this_);
+			impl<0>::go(w, p.fields);
+		}
+	};
+
+	template <typename... TR>
+	struct byte_buffer::reader::peek_impl<packed<TR...>, void> {
+		static const bool enable = true;
+
+		template <size_t I, typename Dummy = void>
+		struct impl {
+			inline static void go(bit_reader &r, std::tuple<TR...> &t) {
+				bit_field<typename std::tuple_element<I, std::tuple<TR...>>::type>::read(r, std::get<I>(t));
+				impl<I + 1>::go(r, t);
+			}
+		};
+
+		template <typename Dummy>
+		struct impl<sizeof...(TR), Dummy> {
+			inline static void go(bit_reader &, std::tuple<TR...> &) { }
+		};
+
+		inline static size_t go(const reader &this_, size_t i, packed<TR...> &p) {
+			bit_reader r(this_, i);
+			impl<0>::go(r, p.fields);
+			return r.position() - i;
+		}
+	};
+
+	template <typename UIntT>
+	struct byte_buffer::add_impl<varint<UIntT>, void> {
+		static const bool enable = true;
+
+		inline static void go(byte_buffer &this_, const varint<UIntT> &v) {
+			uint64_t x = v.value;
+			while (x >= 0x80) {
+				this_.push_back(byte_t((x & 0x7F) | 0x80));
+				x >>= 7;
+			}
+			this_.push_back(byte_t(x));
+		}
+	};
+
+	template <typename UIntT>
+	struct byte_buffer::reader::peek_impl<varint<UIntT>, void> {
+		static const bool enable = true;
+
+		inline static size_t go(const reader &this_, size_t i, varint<UIntT> &v) {
+			const size_t bits = sizeof(UIntT) * 8;
+			uint64_t x = 0;
+			for (size_t c = 0; c * 7 < bits; c++) {
+				if (this_.remaining(i + c) < 1) throw std::range_error("byte_buffer index out of range");
+				uint64_t b = this_.m_data[i + c];
+				// the last byte that fits may only partly fit; anything above UIntT is malformed
+				if (c * 7 + 7 > bits && (b & 0x7F) >> (bits - c * 7)) {
+					throw std::range_error("byte_buffer varint out of range");
+				}
+				x |= (b & 0x7F) << (7 * c);
+				if (!(b & 0x80)) {
+					v.value = UIntT(x);
+					return c + 1;
+				}
+			}
+			throw std::range_error("byte_buffer varint too long");
+		}
+	};
+
+	template <typename IntT>
+	struct byte_buffer::add_impl<zigzag<IntT>, void> {
+		static const bool enable = true;
+
+		inline static void go(byte_buffer &this_, const zigzag<IntT> &v) {
+			this_.add(varint<typename zigzag<IntT>::uint_t>(zigzag<IntT>::encode(v.value)));
+		}
+	};
+
+	template <typename IntT>
+	struct byte_buffer::reader::peek_impl<zigzag<IntT>, void> {
+		static const bool enable = true;
+
+		inline static size_t go(const reader &this_, size_t i, zigzag<IntT> &v) {
+			varint<typename zigzag<IntT>::uint_t> u;
+			size_t c = peek_impl<varint<typename zigzag<IntT>::uint_t>>::go(this_, i, u);
+			v.value = zigzag<IntT>::decode(u.value);
+			return c;
+		}
+	};
+
+	template <int Min, int Max, unsigned Bits>
+	struct byte_buffer::add_impl<quantized<Min, Max, Bits>, void> {
+		static const bool enable = true;
+
+		inline static void go(byte_buffer &this_, const quantized<Min, Max, Bits> &q) {
+			using q_t = quantized<Min, Max, Bits>;
+			this_.add(typename q_t::uint_t(q_t::encode(q.value)));
+		}
+	};
+
+	template <int Min, int Max, unsigned Bits>
+	struct byte_buffer::reader::peek_impl<quantized<Min, Max, Bits>, void> {
+		static const bool enable = true;
+
+		inline static size_t go(const reader &this_, size_t i, quantized<Min, Max, Bits> &q) {
+			using q_t = quantized<Min, Max, Bits>;
+			typename q_t::uint_t u;
+			size_t c = peek_impl<typename q_t::uint_t>::go(this_, i, u);
+			q.value = q_t::decode(u);
+			return c;
+		}
+	};
+
+	template <typename T>
+	struct byte_buffer::add_impl<varsize<T>, void> {
+		static const bool enable = true;
+
+		inline static void go(byte_buffer &this_, const varsize<T> &v) {
+			this_.add(varint<uint64_t>(v.value.size()));
+			this_.add_array(v.value.data(), v.value.size());
+		}
+	};
+
+	template <typename T>
+	struct byte_buffer::reader::peek_impl<varsize<T>, void> {
+		static const bool enable = true;
+
+		inline static size_t go(const reader &this_, size_t i, varsize<T> &v) {
+			varint<uint64_t> len;
+			size_t c = peek_impl<varint<uint64_t>>::go(this_, i, len);
+			// don't trust the length before checking there could be that many elements there. unsigned,
+			// since a length of 2^63 or more would turn negative as a ptrdiff_t
+			const uint64_t room = uint64_t(std::max<std::ptrdiff_t>(0, this_.remaining(i + c))) / sizeof(typename T::value_type);
+			if (len.value > room) throw std::range_error("byte_buffer length out of range");
+			v.value.resize(size_t(len.value));
+			if (len.value) c += this_.peek_array(&v.value[0], size_t(len.value), i + c);
+			return c;
+		}
+	};
+
+	// a message made of separate byte_slices, e.g. a small header followed by a large body, that is
+	// sent as it is rather than joined into one buffer first. appending shares a segment's storage.
+	class byte_chain {
+	private:
+		std::deque<byte_slice> m_segments;
+		size_t m_size = 0;
+
+	public:
+		using const_iterator = std::deque<byte_slice>::const_iterator;
+
+		inline byte_chain() { }
+
+		inline explicit byte_chain(byte_slice s) {
+			append(std::move(s));
+		}
+
+		inline explicit byte_chain(byte_buffer bb) {
+			append(std::move(bb));
+		}
+
+		inline void append(byte_slice s) {
+			if (s.empty()) return;
+			m_size += s.size();
+			m_segments.push_back(std::move(s));
+		}
+
+		// pass an rvalue to hand the buffer's storage over rather than copying it
+		inline void append(byte_buffer bb) {
+			append(bb.release());
+		}
+
+		template <typename T>
+		inline byte_chain & operator<<(T &&t) {
+			append(std::forward<T>(t));
+			return *this;
+		}
+
+		// total bytes over all segments
+		inline size_t size() const {
+			return m_size;
+		}
+
+		inline bool empty() const {
+			return m_size == 0;
+		}
+
+		inline size_t segment_count() const {
+			return m_segments.size();
+		}
+
+		inline const_iterator begin() const {
+			return m_segments.begin();
+		}
+
+		inline const_iterator end() const {
+			return m_segments.end();
+		}
+
+		// drop n bytes from the front, e.g. after a partial send
+		inline void consume(size_t n) {
+			n = std::min(n, m_size);
+			m_size -= n;
+			while (n > 0) {
+				byte_slice &front = m_segments.front();
+				if (n < front.size()) {
+					front = front.slice(n);
+					return;
+				}
+				n -= front.size();
+				m_segments.pop_front();
+			}
+		}
+
+		inline void clear() {
+			m_segments.clear();
+			m_size = 0;
+		}
+
+		// copy everything into one contiguous buffer, for when that can't be avoided
+		inline byte_buffer flatten() const {
+			byte_buffer bb;
+			bb.reserve(m_size);
+			for (const byte_slice &s : m_segments) {
+				bb.add_array(s.data(), s.size());
+			}
+			return bb;
+		}
+	};
+
 }
 
 #endif 
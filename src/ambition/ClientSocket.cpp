@@ -1,7 +1,13 @@
-#include <thread>
+#include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
 
 #include "ClientSocket.hpp"
+#include "Reactor.hpp"
+#include "Log.hpp"
 
 #ifndef _WIN32
 	using SOCKET = int;
@@ -10,60 +16,115 @@
 	#include <unistd.h>
 	#include <sys/types.h>
 	#include <sys/socket.h>
+	#include <sys/uio.h>
 	#include <errno.h>
 	#include <netinet/in.h>
 	#include <fcntl.h>
 	#include <netdb.h>
-	#define FD_CLR_F FD_CLR
-	#define FD_SET_F FD_SET
+	#define closesocket(s) close(s)
 
 #else
 	#include <winsock2.h>
 	#include <ws2tcpip.h>
-	#define FD_CLR_F(fd, set) u_int __i; \
-	for (__i = 0; __i < ((fd_set FAR *)(set))->fd_count; __i++) { \
-	if (((fd_set FAR *)(set))->fd_array[__i] == fd) { \
-		while (__i < ((fd_set FAR *)(set))->fd_count - 1) {	\
-			((fd_set FAR *)(set))->fd_array[__i] = \
-			((fd_set FAR *)(set))->fd_array[__i + 1]; \
-			__i++; \
-		} \
-		((fd_set FAR *)(set))->fd_count--; \
-		break; \
-	} \
-	}
-
-	#define FD_SET_F(fd, set) if (((fd_set FAR *)(set))->fd_count < FD_SETSIZE) \
-		((fd_set FAR *)(set))->fd_array[((fd_set FAR *)(set))->fd_count++] = (fd);
-
-	
 	typedef int socklen_t;
+	#define SHUT_RDWR SD_BOTH
 #endif
 
-#define FD_ZERO_F FD_ZERO
-#define FD_ISSET_F FD_ISSET
-
 namespace ambition {
 
+	// a peer that has gone away shouldn't take the process down with SIGPIPE
+	#ifdef MSG_NOSIGNAL
+	static const int send_flags = MSG_NOSIGNAL;
+	#else
+	static const int send_flags = 0;
+	#endif
+
+	// gathers up to max_gather segments from the front of the chain into one send call.
+	// returns bytes sent, or INVALID_SOCKET on error
+	static int send_gather(SOCKET s, const byte_chain &bc) {
+		static const size_t max_gather = 64;
+		size_t n = 0;
+	#ifndef _WIN32
+		iovec iov[max_gather];
+		for (const byte_slice &seg : bc) {
+			if (n == max_gather) break;
+			iov[n].iov_base = const_cast<byte_t *>(seg.data());
+			iov[n].iov_len = seg.size();
+			n++;
+		}
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		return int(sendmsg(s, &msg, send_flags));
+	#else
+		WSABUF bufs[max_gather];
+		for (const byte_slice &seg : bc) {
+			if (n == max_gather) break;
+			bufs[n].buf = reinterpret_cast<char *>(const_cast<byte_t *>(seg.data()));
+			bufs[n].len = ULONG(seg.size());
+			n++;
+		}
+		DWORD sent = 0;
+		if (WSASend(s, bufs, DWORD(n), &sent, 0, NULL, NULL) == SOCKET_ERROR) return INVALID_SOCKET;
+		return int(sent);
+	#endif
+	}
+
 	class ClientSocket::ClientSocketImpl {
-		fd_set wfdset;
-		fd_set rfdset;
 		SOCKET client_socket;
-		timeval tv;
-		std::thread* worker;
 		ClientSocket* outer;
-		bool connected = false;
-		std::vector<char> to_send;
+		// the reactor watching this socket: a pool reactor once begin_connect() has been called,
+		// or whatever was given to watched_by()
+		Reactor* reactor = nullptr;
+		// whether we added the socket to the reactor, and so have to take it off again
+		bool registered = false;
+		// sockets passed in from outside (e.g. accepted by ListenSocket) belong to whoever made them
+		bool owns_socket;
+		std::atomic<bool> connected { false };
+		std::atomic<bool> connecting { false };
+
+		// everything below is guarded by send_mutex
+		mutable std::mutex send_mutex;
+		// what the socket wouldn't take yet, in order
+		byte_chain send_queue;
+		// write events are only asked for while something is queued
+		bool write_armed = false;
+		// an io_uring send owns the front of the queue until it completes
+		bool send_in_flight = false;
+		bool over_high = false;
+		bool send_failed = false;
+		size_t low_watermark = 64 * 1024;
+		size_t high_watermark = 1024 * 1024;
+		SendStats stats = SendStats();
+
+		size_t drain(byte_chain &bc);
+		bool queue(byte_chain &rest);
+		bool batching() const;
+		void submit();
+		bool below_low();
+		void progress(size_t written, bool drained);
 	public:
+		std::unique_ptr<frame_reader> framer;
 		ClientSocketImpl(ClientSocket*);
 		ClientSocketImpl(ClientSocket*, int);
-		static void work_thread(ClientSocketImpl* target);
+		~ClientSocketImpl();
+		void finish_connect(int so_error);
+		void received(const byte_slice &data, int error);
+		void hang_up(bool clean);
+		void flush();
+		void sent(int result);
 		bool connected_();
 		void begin_connect(std::string, uint16_t, int);
-		void begin_send(const byte_buffer &);
+		bool begin_send(const byte_buffer &);
+		bool begin_send(const byte_chain &);
+		void set_watermarks(size_t, size_t);
+		SendStats send_stats() const;
+		bool send_failed_() const;
+		void watched_by(Reactor *r);
 	};
 
-	ClientSocket::ClientSocketImpl::ClientSocketImpl(ClientSocket *o) : outer(o) { 
+	ClientSocket::ClientSocketImpl::ClientSocketImpl(ClientSocket *o) : outer(o), owns_socket(true) { 
 		#ifdef _WIN32
 			WSAData data;
 			WSAStartup(MAKEWORD(1, 1), &data);
@@ -77,110 +138,77 @@ namespace ambition {
 			throw ne;
 		}
 
-		#ifdef _WIN32
-		u_long iMode=1;
-		ioctlsocket(client_socket, FIONBIO, &iMode);
-		#else
-		fcntl(client_socket, F_SETFL, O_NONBLOCK);
-		#endif
-
-		if(client_socket == INVALID_SOCKET) {
-			network_error ne(error::neterr_socket_set_blocking_failure, "Unable to set socket blocking mode");
-			ne.error_no = errno;
-			ne.error_message = strerror(errno);
-			throw ne;
-		}
-
-		FD_ZERO_F(&rfdset);
-		FD_ZERO_F(&wfdset);
-		FD_SET_F(client_socket, &wfdset);
+		Reactor::set_nonblocking(client_socket);
 	}
 
-	ClientSocket::ClientSocketImpl::ClientSocketImpl(ClientSocket *o, int ext) : client_socket(ext), outer(o) {
+	ClientSocket::ClientSocketImpl::ClientSocketImpl(ClientSocket *o, int ext) : client_socket(ext), outer(o), owns_socket(false) {
 		connected = true;
 	}
 
-	void ClientSocket::ClientSocketImpl::work_thread(ClientSocketImpl* target) {
-		timeval tv;
-		tv.tv_sec = 5;
-		int rv;
-		byte_t buffer[2048];
-		while(true) {
-			rv = select(target->client_socket+1, &(target->rfdset), &(target->wfdset), NULL, NULL);
-
-			if(rv == INVALID_SOCKET) {
-				network_error ne(error::neterr_select_failure, "General select() error");
-				ne.error_no = errno;
-				ne.error_message = strerror(errno);
-				throw ne;
-			}
-
-			if (rv >= 1 && !target->connected) {
-				char so_error;
-				socklen_t slen = sizeof(so_error);
-				getsockopt(target->client_socket, SOL_SOCKET, SO_ERROR, &so_error, &slen);
-
-				SocketResult sr;
-				sr.success = (so_error == 0);
-
-				if(sr.success) {
-					target->connected = sr.success;
+	ClientSocket::ClientSocketImpl::~ClientSocketImpl() {
+		// waits for a handler running on the reactor thread to finish
+		if(registered) reactor->remove(client_socket);
+		if(owns_socket) closesocket(client_socket);
+	}
 
-					FD_CLR_F(target->client_socket, &target->wfdset);
-					FD_SET_F(target->client_socket, &target->rfdset);
+	// runs on the reactor thread, once, when the connect has gone one way or the other
+	void ClientSocket::ClientSocketImpl::finish_connect(int so_error) {
+		SocketResult sr;
+		sr.success = (so_error == 0);
+		sr.n_bytes = 0;
+		sr.client = outer;
+
+		connecting = false;
+		if(sr.success) {
+			// write events were only wanted to see the connect finish. this has to happen before
+			// anyone can send, or it could undo the write events the send queue asks for
+			reactor->modify(client_socket, Reactor::ev_read);
+			connected = true;
+		} else {
+			reactor->remove(client_socket);
+		}
+		outer->on_connected.notify(sr);
+	}
 
-					
-				}
-				target->outer->on_connected.notify(sr);				
-				if(!sr.success) return;
-			} else if(rv >= 1 && target->connected) {
-				if(FD_ISSET_F(target->client_socket, &(target->rfdset))) {
-					FD_CLR_F(target->client_socket, &(target->rfdset));
-					int rx = recv(target->client_socket, reinterpret_cast<char *>(buffer), 2048, 0);
-					FD_SET_F(target->client_socket, &(target->rfdset));
-					
-					if(rx == 0) {
-						// remote gone away
-						target->connected = false;
-						throw network_error(error::neterr_lost_connection, "The remote host has gone away");
-					}
-
-					if(rx == INVALID_SOCKET) {
-						std::cout << "OHSHIT" << std::endl;
-					}
-
-					SocketResult sr;
-					sr.success = true;
-					sr.n_bytes = rx;
-
-					memset(buffer, 0, 2048);
-
-					sr.data = byte_buffer(buffer, rx);
-					target->outer->on_recieved.notify(sr);
-					
-					
-				}
-				if(FD_ISSET_F(target->client_socket, &(target->wfdset))) {
-					FD_CLR_F(target->client_socket, &target->wfdset);
-					int rv = send(target->client_socket, &(target->to_send[0]), target->to_send.size(), 0);
-					if(rv == INVALID_SOCKET) {
-						network_error ne(error::neterr_send_failure, "Unable to send");
-						ne.error_no = errno;
-						ne.error_message = strerror(errno);
-						throw ne;
-					}
-				}
+	// runs on the reactor thread
+	void ClientSocket::ClientSocketImpl::received(const byte_slice &data, int error) {
+		// a failed connect can show up as a read error before the socket is reported writable,
+		// and data only arrives on a connection that has been made
+		if(connecting) {
+			finish_connect(data.size() ? 0 : error);
+			if(!connected) return;
+		}
+		if(data.size()) {
+			SocketResult sr;
+			sr.success = true;
+			sr.client = outer;
+			sr.n_bytes = int(data.size());
+			sr.data = data;
+			if(!outer->deliver(sr)) {
+				shutdown(client_socket, SHUT_RDWR);
+				hang_up(false);
 			}
+		} else {
+			// remote gone away. a failed send may have taken the reset, leaving the read side to
+			// see an ordinary close
+			hang_up(error == 0 && !send_failed_());
 		}
 	}
 
-	
+	void ClientSocket::ClientSocketImpl::hang_up(bool clean) {
+		connected = false;
+		reactor->remove(client_socket);
+		SocketResult sr;
+		sr.success = clean;
+		sr.n_bytes = 0;
+		sr.client = outer;
+		outer->on_closed.notify(sr);
+	}
+
 	bool ClientSocket::ClientSocketImpl::connected_() { return connected; }
 
-	void ClientSocket::ClientSocketImpl::begin_connect(std::string hostname, uint16_t pt, int us_timeout) {
-		// let's a get a new thread, to deal with the socket polling
-		if(connected) throw network_error(error::neterr_already_connected, "Socket already in connected state");
-	    tv.tv_usec = us_timeout;
+	void ClientSocket::ClientSocketImpl::begin_connect(std::string hostname, uint16_t pt, int) {
+		if(connected || connecting) throw network_error(error::neterr_already_connected, "Socket already in connected state");
 
 		int rv;
 
@@ -191,14 +219,7 @@ namespace ambition {
 		hints.ai_family = AF_INET;
 		hints.ai_socktype = SOCK_STREAM;
 
-		
-		int n_zeros =0 ;
-		int pt_clone = pt;
-		while(pt_clone > 10) { pt_clone /= 10; n_zeros++; }
-		char* pt_str = new char[n_zeros];
-		sprintf(pt_str,"%d", pt);
-
-		rv = getaddrinfo(hostname.c_str(), pt_str, &hints, &rp);
+		rv = getaddrinfo(hostname.c_str(), std::to_string(pt).c_str(), &hints, &rp);
 		if(rv != 0) {
 			network_error ne(error::neterr_resolve_failure, "Failed to get address for hostname");
 			ne.error_no = errno;
@@ -207,34 +228,232 @@ namespace ambition {
 		}
 
 		rv = connect(client_socket, rp->ai_addr, rp->ai_addrlen);
-		if(rv != INVALID_SOCKET) {
+		freeaddrinfo(rp);
+		// non-blocking, so the connect normally completes later
+		if(rv == INVALID_SOCKET && !Reactor::would_block() && errno != EINPROGRESS) {
 			network_error ne(error::neterr_connect_failure, "Unable to begin connect request");
 			ne.error_no = errno;
 			ne.error_message = strerror(errno);
 			throw ne;
 		}
 
-		worker = new std::thread(work_thread, this);
+		// the socket becomes writable once the connect has finished either way. the reactor
+		// reads it from the start, so nothing has to be re-registered once it is connected
+		connecting = true;
+		reactor = &ReactorPool::next();
+		registered = true;
+		reactor->add_receiver(client_socket, Reactor::ev_write, [this](unsigned events) {
+			if(connecting) {
+				int so_error = 0;
+				socklen_t slen = sizeof(so_error);
+				getsockopt(client_socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&so_error), &slen);
+				finish_connect(so_error);
+			} else if(events & Reactor::ev_write) {
+				flush();
+			}
+		}, [this](const byte_slice &data, int error) {
+			received(data, error);
+		});
+	}
+
+	// sends as much of bc as the socket will take, consuming what was sent. on a real error the
+	// rest is dropped and send_failed set; the read side will see the connection go
+	size_t ClientSocket::ClientSocketImpl::drain(byte_chain &bc) {
+		size_t total = 0;
+		while(!bc.empty()) {
+			stats.send_calls++;
+			int tx = send_gather(client_socket, bc);
+			if(tx == INVALID_SOCKET) {
+				if(!Reactor::would_block()) {
+					send_failed = true;
+					bc.clear();
+				}
+				break;
+			}
+			bc.consume(tx);
+			total += tx;
+		}
+		stats.bytes_sent += total;
+		return total;
+	}
+
+	// queues what drain() left; returns false if over the high watermark. once a send has failed
+	// nothing more is queued: this may be running on the reactor thread (replying from
+	// on_recieved), and the reactor's hang-up raises on_closed when it sees the connection go
+	bool ClientSocket::ClientSocketImpl::queue(byte_chain &rest) {
+		if(send_failed) return false;
+		if(rest.empty()) return !over_high;
+		if(send_queue.empty()) stats.stalls++;
+		for(const byte_slice &seg : rest) {
+			// the caller's storage has to be copied, since it won't outlive this call
+			send_queue.append(seg.owned() ? seg : byte_slice::copy(seg.view()));
+		}
+		stats.peak_queued_bytes = std::max(stats.peak_queued_bytes, send_queue.size());
+		if(send_queue.size() > high_watermark) over_high = true;
+		if(send_in_flight) {
+			// goes out once the send in flight completes
+		} else if(batching()) {
+			submit();
+		} else if(!write_armed && reactor) {
+			write_armed = true;
+			reactor->modify(client_socket, Reactor::ev_read | Reactor::ev_write);
+		}
+		return !over_high;
+	}
+
+	// on an io_uring reactor's own thread (e.g. replying from on_recieved) sends are handed to the
+	// reactor, which submits them all with its next wait instead of making a call for each
+	bool ClientSocket::ClientSocketImpl::batching() const {
+		return reactor && reactor->batches_sends() && reactor->on_poller_thread();
+	}
+
+	void ClientSocket::ClientSocketImpl::submit() {
+		send_in_flight = true;
+		reactor->send(client_socket, send_queue, [this](int result) {
+			sent(result);
+		});
+	}
+
+	// runs on the reactor thread once a batched send has completed
+	void ClientSocket::ClientSocketImpl::sent(int result) {
+		size_t written = 0;
+		bool drained;
+		{
+			std::lock_guard<std::mutex> lock(send_mutex);
+			send_in_flight = false;
+			if(result > 0) {
+				send_queue.consume(result);
+				stats.bytes_sent += result;
+				written = size_t(result);
+			} else if(result != -EAGAIN) {
+				send_failed = true;
+				send_queue.clear();
+			}
+			if(!send_queue.empty()) {
+				if(result > 0) {
+					submit();
+				} else if(!write_armed) {
+					// wait until there's room, then write directly
+					write_armed = true;
+					reactor->modify(client_socket, Reactor::ev_read | Reactor::ev_write);
+				}
+			}
+			drained = below_low();
+		}
+		progress(written, drained);
+	}
+
+	// true once, when the queue has gone over the high watermark and back down to the low one
+	bool ClientSocket::ClientSocketImpl::below_low() {
+		if(over_high && send_queue.size() <= low_watermark) {
+			over_high = false;
+			return true;
+		}
+		return false;
 	}
 
-	void ClientSocket::ClientSocketImpl::begin_send(const byte_buffer &bb) {
+	void ClientSocket::ClientSocketImpl::progress(size_t written, bool drained) {
+		SocketResult sr;
+		sr.success = true;
+		sr.client = outer;
+		if(written) {
+			sr.n_bytes = int(written);
+			outer->on_sent.notify(sr);
+		}
+		if(drained) {
+			sr.n_bytes = 0;
+			outer->on_writable.notify(sr);
+		}
+	}
+
+	bool ClientSocket::ClientSocketImpl::begin_send(const byte_buffer &bb) {
 		if(!connected) {
 			throw network_error(error::neterr_not_connected, "Socket not in connected state");
 		}
 
-		byte_buffer::reader reader = bb.read();
-		byte_t* msg = new byte_t[bb.size()];
-		reader.get_array(msg, bb.size());
-		int to_send = bb.size();
-		int already_sent = 0;
+		// refers to the caller's buffer; only what can't be sent now gets copied
+		byte_chain rest(byte_slice(nullptr, bb.view()));
+		std::lock_guard<std::mutex> lock(send_mutex);
+		// anything already queued has to go first
+		if(send_queue.empty() && !batching()) stats.bytes_sent_direct += drain(rest);
+		return queue(rest);
+	}
 
-		while(already_sent < to_send) {
-			int tx = send(client_socket, reinterpret_cast<char *>(msg + already_sent), to_send-already_sent, 0);
-			if(tx == INVALID_SOCKET) break;
-			already_sent += tx;
+	bool ClientSocket::ClientSocketImpl::begin_send(const byte_chain &bc) {
+		if(!connected) {
+			throw network_error(error::neterr_not_connected, "Socket not in connected state");
 		}
-		delete msg;
 
+		// copying the chain only copies segment references; it keeps track of what is left to send
+		byte_chain rest(bc);
+		std::lock_guard<std::mutex> lock(send_mutex);
+		if(send_queue.empty() && !batching()) stats.bytes_sent_direct += drain(rest);
+		return queue(rest);
+	}
+
+	// runs on the reactor thread when the socket is writable
+	void ClientSocket::ClientSocketImpl::flush() {
+		size_t written;
+		bool drained;
+		{
+			std::lock_guard<std::mutex> lock(send_mutex);
+			// the kernel is still reading from the front of the queue
+			if(send_in_flight) return;
+			written = drain(send_queue);
+			if(send_queue.empty() && write_armed) {
+				write_armed = false;
+				reactor->modify(client_socket, Reactor::ev_read);
+			}
+			drained = below_low();
+		}
+		progress(written, drained);
+	}
+
+	void ClientSocket::ClientSocketImpl::set_watermarks(size_t low, size_t high) {
+		std::lock_guard<std::mutex> lock(send_mutex);
+		low_watermark = low;
+		high_watermark = std::max(low, high);
+	}
+
+	SendStats ClientSocket::ClientSocketImpl::send_stats() const {
+		std::lock_guard<std::mutex> lock(send_mutex);
+		SendStats ret = stats;
+		ret.queued_bytes = send_queue.size();
+		return ret;
+	}
+
+	bool ClientSocket::ClientSocketImpl::send_failed_() const {
+		std::lock_guard<std::mutex> lock(send_mutex);
+		return send_failed;
+	}
+
+	void ClientSocket::ClientSocketImpl::watched_by(Reactor *r) {
+		std::lock_guard<std::mutex> lock(send_mutex);
+		reactor = r;
+	}
+
+	void ClientSocket::set_framing(frame_prefix prefix, size_t max_frame_size) {
+		cs_->framer.reset(new frame_reader(prefix, max_frame_size));
+	}
+
+	bool ClientSocket::deliver(const SocketResult &sr) {
+		on_recieved.notify(sr);
+		if (!cs_->framer) return true;
+		try {
+			cs_->framer->feed(sr.data, [&](const byte_slice &frame) {
+				SocketResult fsr = sr;
+				fsr.n_bytes = int(frame.size());
+				fsr.data = frame;
+				on_frame.notify(fsr);
+			});
+		} catch (const network_error &ne) {
+			// the rest of the stream can't be made sense of, and the peer shouldn't get to
+			// make us buffer whatever it claims to be sending
+			if (ne.type != error::neterr_bad_frame) throw;
+			log("Socket") % 0 << "dropping connection: " << ne.what();
+			return false;
+		}
+		return true;
 	}
 
 	bool ClientSocket::connected() { return cs_->connected_(); }
@@ -243,8 +462,32 @@ namespace ambition {
 		cs_->begin_connect(host, port, usec);
 	}
 
-	void ClientSocket::begin_send(const byte_buffer &bb) {
-		cs_->begin_send(bb);
+	bool ClientSocket::begin_send(const byte_buffer &bb) {
+		return cs_->begin_send(bb);
+	}
+
+	bool ClientSocket::begin_send(const byte_chain &bc) {
+		return cs_->begin_send(bc);
+	}
+
+	void ClientSocket::set_watermarks(size_t low, size_t high) {
+		cs_->set_watermarks(low, high);
+	}
+
+	SendStats ClientSocket::send_stats() const {
+		return cs_->send_stats();
+	}
+
+	bool ClientSocket::send_failed() const {
+		return cs_->send_failed_();
+	}
+
+	void ClientSocket::watched_by(Reactor *r) {
+		cs_->watched_by(r);
+	}
+
+	void ClientSocket::writable() {
+		cs_->flush();
 	}
 
 	ClientSocket::ClientSocket() {
@@ -4,20 +4,33 @@
 #include <ambition/Concurrent.hpp>
 #include <ambition/ByteBuffer.hpp>
 #include <ambition/Packet.hpp>
-
-// KNOWN ISSUES:
-// Thread may try to grab FDSET whilst it's being set by calling thread, needs mutex
-// Dtor should call close()
+#include <ambition/Framing.hpp>
 
 namespace ambition {
 	class ClientSocket;
+	class Reactor;
+
 	struct SocketResult {
 		bool success;
 		int n_bytes;
-		byte_buffer data;
+		// shares the socket's receive storage; keep it (or slices of it) as long as needed
+		byte_slice data;
 		ClientSocket* client;
 	};
 
+	struct SendStats {
+		// waiting in the send queue right now, and the most there has been
+		size_t queued_bytes;
+		size_t peak_queued_bytes;
+		uint64_t bytes_sent;
+		// sent straight away from begin_send, without queueing
+		uint64_t bytes_sent_direct;
+		// times the socket was full and the rest had to wait
+		uint64_t stalls;
+		// send calls made directly; sends batched by an io_uring reactor aren't counted
+		uint64_t send_calls;
+	};
+
 	class ClientSocket {	
 		class ClientSocketImpl;
 		ClientSocketImpl* cs_;
@@ -27,13 +40,43 @@ namespace ambition {
 		~ClientSocket();
 
 		Event<SocketResult> on_connected;
+		// queued data was written; n_bytes says how much. raised on the reactor thread
 		Event<SocketResult> on_sent;
+		// the send queue went over the high watermark and has since drained to the low one
+		Event<SocketResult> on_writable;
 		Event<SocketResult> on_recieved;
 		Event<SocketResult> on_closed;
+		// one notification per complete frame, once set_framing() has been called
+		Event<SocketResult> on_frame;
 
 		bool connected();
 		void begin_connect(std::string host, uint16_t port, int usec);
-		void begin_send(const byte_buffer &);
+		// sends what the socket will take now and queues the rest, to be written by the reactor once
+		// the socket is writable; never blocks. returns false once more than the high watermark is
+		// queued, in which case hold off until on_writable. also false, with the data dropped, once
+		// the connection has failed; on_closed follows
+		bool begin_send(const byte_buffer &);
+		// sends every segment straight from its own storage, without joining them
+		bool begin_send(const byte_chain &);
+
+		// queued bytes at which begin_send starts returning false, and at which on_writable is raised
+		void set_watermarks(size_t low, size_t high);
+		SendStats send_stats() const;
+		// true once a send has failed; the connection is as good as gone, whatever the read side says
+		bool send_failed() const;
+
+		// split received data into length-prefixed frames (see Framing.hpp) and raise on_frame for each
+		void set_framing(frame_prefix prefix, size_t max_frame_size = 1 << 24);
+
+		// raises on_recieved, then on_frame for any frames completed; called by whichever thread reads the socket.
+		// returns false if the data broke the framing (a malformed or oversized length), in which case
+		// the caller has to drop the connection
+		bool deliver(const SocketResult &sr);
+
+		// for sockets watched by someone else's reactor (e.g. ListenSocket's): the send queue arms
+		// write events on it, and the owner calls writable() when they occur
+		void watched_by(Reactor *r);
+		void writable();
 	};
 
 }
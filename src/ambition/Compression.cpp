@@ -0,0 +1,196 @@
+#include <algorithm>
+
+#include <CryptoPP/zdeflate.h>
+#include <CryptoPP/zinflate.h>
+
+#include "Compression.hpp"
+#include "Error.hpp"
+
+namespace ambition {
+
+	namespace {
+		// deflate can only refer back this far, so that is all of a dictionary that matters
+		const size_t window_size = size_t(1) << CryptoPP::Deflator::MAX_LOG2_WINDOW_SIZE;
+
+		// appends whatever it is given to a byte_buffer, or drops it if there isn't one
+		class buffer_sink : public CryptoPP::Bufferless<CryptoPP::Sink> {
+		public:
+			byte_buffer *target = nullptr;
+
+			size_t Put2(const byte_t *in, size_t length, int, bool) override {
+				if (target && length) target->add_array(in, length);
+				return 0;
+			}
+		};
+
+		byte_view usable_dictionary(byte_view dictionary) {
+			if (dictionary.size() <= window_size) return dictionary;
+			return dictionary.slice(dictionary.size() - window_size);
+		}
+
+		// run the dictionary through a compressor and throw the output away, leaving it in the window
+		void prime(CryptoPP::Deflator &deflator, buffer_sink &sink, byte_view dictionary) {
+			if (dictionary.empty()) return;
+			byte_buffer *target = sink.target;
+			sink.target = nullptr;
+			deflator.Put(dictionary.data(), dictionary.size());
+			deflator.Flush(true);
+			sink.target = target;
+		}
+
+		// the decompressor needs the same window contents; storing the dictionary uncompressed is
+		// the cheapest valid deflate data that puts it there
+		void prime(CryptoPP::Inflator &inflator, buffer_sink &sink, byte_view dictionary) {
+			if (dictionary.empty()) return;
+			byte_buffer stored;
+			buffer_sink stored_sink;
+			stored_sink.target = &stored;
+			CryptoPP::Deflator deflator(new CryptoPP::Redirector(stored_sink), compression::level_none);
+			deflator.Put(dictionary.data(), dictionary.size());
+			deflator.Flush(true);
+			byte_buffer *target = sink.target;
+			sink.target = nullptr;
+			inflator.Put(stored.data(), stored.size());
+			inflator.Flush(true);
+			sink.target = target;
+		}
+
+		int clamp_level(int level) {
+			return std::max<int>(compression::level_none, std::min<int>(compression::level_best, level));
+		}
+
+		network_error bad_data(const std::string &what) {
+			return network_error(error::neterr_decompress_failure, "Corrupt compressed data: " + what);
+		}
+	}
+
+	uint32_t compression::dictionary_id(byte_view dictionary) {
+		// FNV-1a
+		uint32_t h = 2166136261u;
+		for (byte_t b : dictionary) {
+			h = (h ^ b) * 16777619u;
+		}
+		return h ? h : 1;
+	}
+
+	compression_settings negotiate(const compression_offer &local, const compression_offer &remote) {
+		compression_settings s;
+		s.level = clamp_level(std::min(local.max_level, remote.max_level));
+		if (s.enabled() && local.dictionary_id == remote.dictionary_id) {
+			s.dictionary_id = local.dictionary_id;
+		}
+		return s;
+	}
+
+	byte_buffer compress(byte_view in, int level, byte_view dictionary) {
+		byte_buffer out;
+		// most data we send shrinks a good deal; out grows if this guess is short
+		out.reserve(in.size() / 2 + 16);
+		out << varint<uint64_t>(in.size());
+		buffer_sink sink;
+		sink.target = &out;
+		CryptoPP::Deflator deflator(new CryptoPP::Redirector(sink), clamp_level(level));
+		prime(deflator, sink, usable_dictionary(dictionary));
+		deflator.Put(in.data(), in.size());
+		deflator.MessageEnd();
+		return out;
+	}
+
+	byte_buffer decompress(byte_view in, byte_view dictionary) {
+		byte_buffer::reader r(in);
+		uint64_t size = r.get<varint<uint64_t>>().value;
+		byte_view body = r.rest();
+		// deflate can't shrink anything by more than about 1000:1, so a bigger claim is corrupt
+		if (size / 1032 > body.size() + 1) throw bad_data("size out of range");
+		byte_buffer out;
+		// the claim isn't checked until the data has been inflated, so don't let it decide
+		// how much gets allocated up front; out grows as needed
+		out.reserve(size_t(std::min<uint64_t>(size, uint64_t(body.size()) * 4 + 64)));
+		buffer_sink sink;
+		sink.target = &out;
+		try {
+			CryptoPP::Inflator inflator(new CryptoPP::Redirector(sink));
+			prime(inflator, sink, usable_dictionary(dictionary));
+			inflator.Put(body.data(), body.size());
+			inflator.MessageEnd();
+		} catch (CryptoPP::Exception &e) {
+			throw bad_data(e.what());
+		}
+		if (out.size() != size) throw bad_data("size mismatch");
+		return out;
+	}
+
+	class deflate_stream::impl {
+	public:
+		buffer_sink sink;
+		CryptoPP::Deflator deflator;
+		uint64_t bytes_in = 0;
+		uint64_t bytes_out = 0;
+
+		impl(int level) : deflator(new CryptoPP::Redirector(sink), clamp_level(level)) { }
+	};
+
+	deflate_stream::deflate_stream(int level, byte_view dictionary) : m_impl(new impl(level)) {
+		prime(m_impl->deflator, m_impl->sink, usable_dictionary(dictionary));
+	}
+
+	deflate_stream::~deflate_stream() { }
+
+	void deflate_stream::compress(byte_view in, byte_buffer &out) {
+		size_t size0 = out.size();
+		m_impl->sink.target = &out;
+		m_impl->deflator.Put(in.data(), in.size());
+		// a sync flush: everything so far can be decoded, and the window is kept for what follows
+		m_impl->deflator.Flush(true);
+		m_impl->sink.target = nullptr;
+		m_impl->bytes_in += in.size();
+		m_impl->bytes_out += out.size() - size0;
+	}
+
+	byte_buffer deflate_stream::compress(byte_view in) {
+		byte_buffer out;
+		compress(in, out);
+		return out;
+	}
+
+	uint64_t deflate_stream::bytes_in() const {
+		return m_impl->bytes_in;
+	}
+
+	uint64_t deflate_stream::bytes_out() const {
+		return m_impl->bytes_out;
+	}
+
+	class inflate_stream::impl {
+	public:
+		buffer_sink sink;
+		CryptoPP::Inflator inflator;
+
+		impl() : inflator(new CryptoPP::Redirector(sink)) { }
+	};
+
+	inflate_stream::inflate_stream(byte_view dictionary) : m_impl(new impl()) {
+		prime(m_impl->inflator, m_impl->sink, usable_dictionary(dictionary));
+	}
+
+	inflate_stream::~inflate_stream() { }
+
+	void inflate_stream::decompress(byte_view in, byte_buffer &out) {
+		m_impl->sink.target = &out;
+		try {
+			m_impl->inflator.Put(in.data(), in.size());
+			m_impl->inflator.Flush(true);
+		} catch (CryptoPP::Exception &e) {
+			m_impl->sink.target = nullptr;
+			throw bad_data(e.what());
+		}
+		m_impl->sink.target = nullptr;
+	}
+
+	byte_buffer inflate_stream::decompress(byte_view in) {
+		byte_buffer out;
+		decompress(in, out);
+		return out;
+	}
+
+}
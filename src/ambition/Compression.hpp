@@ -0,0 +1,111 @@
+/*
+ * Deflate compression for byte_buffers, using the bundled Crypto++ Deflator / Inflator.
+ *
+ * compress() / decompress() handle one self-contained message (or an on-disk cache entry).
+ * deflate_stream / inflate_stream handle one direction of a connection: the window carries over
+ * between messages, so later messages can refer back to earlier ones.
+ *
+ * Crypto++ has no zlib-style preset dictionary, so a dictionary is loaded by running it through the
+ * stream first and throwing that output away; both ends must use the same dictionary bytes.
+ */
+
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstdint>
+#include <memory>
+#include <tuple>
+
+#include <ambition/ByteBuffer.hpp>
+
+namespace ambition {
+
+	namespace compression {
+		// 0 stores without compressing; 1 to 9 trade speed for size, as in zlib
+		enum levels {
+			level_none = 0,
+			level_fastest = 1,
+			level_default = 6,
+			level_best = 9
+		};
+
+		// identifies a dictionary for negotiation; never 0, which means no dictionary
+		uint32_t dictionary_id(byte_view dictionary);
+	}
+
+	// what one end of a connection is willing to do. each end sends its offer when the connection
+	// is set up and both then use negotiate() to agree on the same settings.
+	struct compression_offer {
+		uint8_t max_level = compression::level_none;
+		uint32_t dictionary_id = 0;
+
+		std::tuple<uint8_t &, uint32_t &> wire() {
+			return std::tie(max_level, dictionary_id);
+		}
+
+		std::tuple<const uint8_t &, const uint32_t &> wire() const {
+			return std::tie(max_level, dictionary_id);
+		}
+	};
+
+	struct compression_settings {
+		int level = compression::level_none;
+		// 0 if the ends don't share a dictionary
+		uint32_t dictionary_id = 0;
+
+		inline bool enabled() const {
+			return level != compression::level_none;
+		}
+	};
+
+	// the highest level both ends accept, and the dictionary only if both have the same one
+	compression_settings negotiate(const compression_offer &local, const compression_offer &remote);
+
+	// compress one message: the uncompressed size as a varint, then raw deflate data
+	byte_buffer compress(byte_view in, int level = compression::level_default, byte_view dictionary = byte_view());
+
+	// throws network_error (neterr_decompress_failure) on corrupt data or a size mismatch
+	byte_buffer decompress(byte_view in, byte_view dictionary = byte_view());
+
+	// compressing end of a connection
+	class deflate_stream {
+	private:
+		class impl;
+		std::unique_ptr<impl> m_impl;
+
+	public:
+		explicit deflate_stream(int level = compression::level_default, byte_view dictionary = byte_view());
+		deflate_stream(const deflate_stream &) = delete;
+		deflate_stream & operator=(const deflate_stream &) = delete;
+		~deflate_stream();
+
+		// appends the compressed message to out, flushed so the peer can decode all of it at once
+		void compress(byte_view in, byte_buffer &out);
+		byte_buffer compress(byte_view in);
+
+		// total bytes in and out since construction, not counting the dictionary
+		uint64_t bytes_in() const;
+		uint64_t bytes_out() const;
+	};
+
+	// decompressing end of a connection
+	class inflate_stream {
+	private:
+		class impl;
+		std::unique_ptr<impl> m_impl;
+
+	public:
+		explicit inflate_stream(byte_view dictionary = byte_view());
+		inflate_stream(const inflate_stream &) = delete;
+		inflate_stream & operator=(const inflate_stream &) = delete;
+		~inflate_stream();
+
+		// appends the decoded message to out; in must be exactly one output of deflate_stream::compress,
+		// in order. throws network_error (neterr_decompress_failure) on corrupt data
+		void decompress(byte_view in, byte_buffer &out);
+		byte_buffer decompress(byte_view in);
+	};
+
+}
+
+#endif
@@ -1,4 +1,8 @@
 
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
 #include <vector>
 
 #include "Concurrent.hpp"
@@ -9,96 +13,119 @@ using namespace std;
 namespace ambition {
 
 	mutex InterruptManager::m_mutex;
-	map<thread::id, InterruptManager::thread_data_t> InterruptManager::m_thread_data;
+	InterruptManager::thread_state_t *InterruptManager::m_threads = nullptr;
+	thread_local InterruptManager::thread_handle_t InterruptManager::m_this_thread;
+
+	InterruptManager::thread_handle_t::~thread_handle_t() {
+		if (state) {
+			lock_guard<mutex> lock(m_mutex);
+			unlink(state);
+		}
+	}
+
+	InterruptManager::thread_state_t * InterruptManager::find(const thread::id &id) {
+		for (thread_state_t *ts = m_threads; ts; ts = ts->next) {
+			if (ts->id == id) return ts;
+		}
+		return nullptr;
+	}
+
+	InterruptManager::thread_state_t * InterruptManager::link(const thread::id &id) {
+		thread_state_t *ts = new thread_state_t();
+		ts->id = id;
+		ts->next = m_threads;
+		if (m_threads) m_threads->prev = ts;
+		m_threads = ts;
+		return ts;
+	}
+
+	void InterruptManager::unlink(thread_state_t *ts) {
+		if (ts->prev) ts->prev->next = ts->next;
+		if (ts->next) ts->next->prev = ts->prev;
+		if (m_threads == ts) m_threads = ts->next;
+		delete ts;
+	}
+
+	InterruptManager::thread_state_t * InterruptManager::thisThread() {
+		thread_state_t *ts = m_this_thread.state;
+		if (!ts) {
+			// first wait on this thread; pick up any interrupt scheduled before now
+			lock_guard<mutex> lock(m_mutex);
+			auto id = this_thread::get_id();
+			ts = find(id);
+			if (!ts) ts = link(id);
+			m_this_thread.state = ts;
+		}
+		return ts;
+	}
+
+	bool InterruptManager::waitingOn(thread_state_t *ts, wait_t &w) {
+		ts->readers++;
+		wait_t *pw = ts->waiting.load();
+		if (pw) w = *pw;
+		ts->readers--;
+		return pw;
+	}
 
 	// wait on a condition variable.
 	// lock should already be locked.
 	void InterruptManager::wait(condition_variable &cond, unique_lock<mutex> &lock) {
 		// caller should have locked mutex
 		assert(lock.owns_lock());
-		auto id = this_thread::get_id();
-		// setup interruption mechanism
-		{
-			lock_guard<mutex> lock1(m_mutex);
-			auto it = m_thread_data.find(id);
-			if (it != m_thread_data.end()) {
-				// thread data already present
-				thread_data_t td = it->second;
-				// remove the thread data
-				m_thread_data.erase(it);
-				assert(td.condition == nullptr);
-				assert(td.mutex == nullptr);
-				if (td.interrupt) {
-					// interrupt scheduled, dont bother to wait
-					throw interruption();
-				}
-			}
-			// register cond/mutex with thread
-			thread_data_t td;
-			td.condition = &cond;
-			td.mutex = lock.mutex();
-			td.interrupt = false;
-			m_thread_data[id] = td;
-		}
-		// actually wait
-		cond.wait(lock);
-		// check for interrupt and teardown
-		{
-			lock_guard<mutex> lock1(m_mutex);
-			auto it = m_thread_data.find(id);
-			// no other thread should have removed the thread data
-			assert(it != m_thread_data.end());
-			thread_data_t td = it->second;
-			// remove the thread data
-			m_thread_data.erase(it);
-			if (td.interrupt) {
-				// thread was interrupted
-				throw interruption();
-			}
+		thread_state_t *ts = thisThread();
+		wait_t w { &cond, lock.mutex() };
+		// publish what we're waiting on before checking for interrupts;
+		// interrupt() sets the flag before looking at this, so one of us will see the other
+		ts->waiting.store(&w);
+		// if an interrupt is already scheduled, dont bother to wait
+		if (!ts->interrupt.load()) {
+			// actually wait
+			cond.wait(lock);
+		}
+		// w is about to go out of scope, so wait for any interrupter still copying it
+		ts->waiting.store(nullptr);
+		while (ts->readers.load()) {
+			this_thread::yield();
+		}
+		if (ts->interrupt.exchange(false)) {
+			// thread was interrupted
+			throw interruption();
 		}
 	}
 
 	// interrupt a thread waiting on a condition variable.
 	// if thread is not waiting, it will be interrupted when next it does.
 	void InterruptManager::interrupt(const std::thread::id &id) {
-		thread_data_t td;
+		wait_t w;
 		{
-			// first determine what condition var to notify, if any
 			lock_guard<mutex> lock(m_mutex);
-			auto it = m_thread_data.find(id);
-			if (it == m_thread_data.end()) {
-				// thread not waiting, schedule interrupt and return
-				td.condition = nullptr;
-				td.mutex = nullptr;
-				td.interrupt = true;
-				m_thread_data[id] = td;
-				return;
-			}
-			// we found the cond/mutex of the thread to be interrupted, set interrupt status
-			it->second.interrupt = true;
-			td = it->second;
+			thread_state_t *ts = find(id);
+			// if the thread hasn't waited yet, register it now so the interrupt is waiting for it
+			if (!ts) ts = link(id);
+			ts->interrupt.store(true);
+			// thread not waiting, it will see the interrupt next time it does
+			if (!waitingOn(ts, w)) return;
 		}
 		{
 			// locking the mutex used for the condition wait ensures any other threads
 			// are either completely outside the wait sequence or are actually waiting
-			lock_guard<mutex> lock(*td.mutex);
+			lock_guard<mutex> lock(*w.mutex);
 		}
 		// wake the interrupted thread - this may (will) cause spurious wakeup of other threads
-		td.condition->notify_all();
+		w.condition->notify_all();
 	}
 
 	// interrupt all threads waiting on a condition variable.
 	// the mutex this condition variable is waiting with is assumed to be locked already.
 	void InterruptManager::interrupt(condition_variable &cond) {
-		vector<thread_data_t> tdv;
 		{
 			// find waiting threads
 			lock_guard<mutex> lock(m_mutex);
-			for (auto it = m_thread_data.begin(); it != m_thread_data.end(); it++) {
-				if (it->second.condition == &cond) {
+			for (thread_state_t *ts = m_threads; ts; ts = ts->next) {
+				wait_t w;
+				if (waitingOn(ts, w) && w.condition == &cond) {
 					// set interrupt
-					it->second.interrupt = true;
-					tdv.push_back(it->second);
+					ts->interrupt.store(true);
 				}
 			}
 		}
@@ -106,13 +133,494 @@ namespace ambition {
 		cond.notify_all();
 	}
 
+	timer_wheel::timer_wheel(chrono::steady_clock::time_point epoch) : m_epoch(epoch) {
+		for (unsigned level = 0; level < level_count; level++) {
+			for (unsigned slot = 0; slot < slot_count; slot++) {
+				m_slots[level][slot] = nullptr;
+			}
+			m_occupied[level] = 0;
+		}
+	}
+
+	timer_wheel::~timer_wheel() {
+		clear();
+	}
+
+	timer_wheel::tick_t timer_wheel::toTick(chrono::steady_clock::time_point t) const {
+		if (t <= m_epoch) return 0;
+		auto ns = chrono::duration_cast<chrono::nanoseconds>(t - m_epoch).count();
+		return tick_t((ns + 999999) / 1000000);
+	}
+
+	chrono::steady_clock::time_point timer_wheel::toTime(tick_t tick) const {
+		return m_epoch + chrono::duration_cast<chrono::steady_clock::duration>(chrono::milliseconds(tick));
+	}
+
+	void timer_wheel::link(entry_t *e) {
+		if (e->due <= m_now) e->due = m_now + 1;
+		tick_t delta = e->due - m_now;
+		unsigned level = 0;
+		while (level + 1 < level_count && delta >= tick_t(1) << (slot_bits * (level + 1))) level++;
+		// park anything out of range at the furthest tick we can represent
+		tick_t due = min(e->due, m_now + (tick_t(1) << (slot_bits * level_count)) - 1);
+		unsigned slot = (due >> (slot_bits * level)) % slot_count;
+		e->level = level;
+		e->slot = slot;
+		e->prev = nullptr;
+		e->next = m_slots[level][slot];
+		if (e->next) e->next->prev = e;
+		m_slots[level][slot] = e;
+		m_occupied[level] |= 1ull << slot;
+	}
+
+	void timer_wheel::unlink(entry_t *e) {
+		if (e->prev) {
+			e->prev->next = e->next;
+		} else {
+			m_slots[e->level][e->slot] = e->next;
+		}
+		if (e->next) e->next->prev = e->prev;
+		if (!m_slots[e->level][e->slot]) m_occupied[e->level] &= ~(1ull << e->slot);
+	}
+
+	timer_wheel::entry_t * timer_wheel::take(unsigned level, unsigned slot) {
+		entry_t *e = m_slots[level][slot];
+		m_slots[level][slot] = nullptr;
+		m_occupied[level] &= ~(1ull << slot);
+		return e;
+	}
+
+	void timer_wheel::expire(entry_t *e, vector<handle_t> &fired) {
+		fired.push_back(e->self);
+		if (e->period) {
+			e->due += e->period;
+			if (e->due <= m_horizon) e->due += (m_horizon - e->due) / e->period * e->period + e->period;
+			link(e);
+		} else {
+			// fired holds a reference now, so this can't delete it
+			e->self.reset();
+			m_size--;
+		}
+	}
+
+	void timer_wheel::step(vector<handle_t> &fired) {
+		m_now++;
+		// each level wraps into the one above it; when it does, move that level's next slot down
+		for (unsigned level = 1; level < level_count; level++) {
+			if (m_now & ((tick_t(1) << (slot_bits * level)) - 1)) break;
+			entry_t *e = take(level, (m_now >> (slot_bits * level)) % slot_count);
+			while (e) {
+				entry_t *next = e->next;
+				if (e->due <= m_now) {
+					expire(e, fired);
+				} else {
+					link(e);
+				}
+				e = next;
+			}
+		}
+		entry_t *e = take(0, m_now % slot_count);
+		while (e) {
+			entry_t *next = e->next;
+			assert(e->due == m_now);
+			expire(e, fired);
+			e = next;
+		}
+	}
+
+	timer_wheel::handle_t timer_wheel::add(chrono::steady_clock::time_point when, chrono::steady_clock::duration period, const task_t &task) {
+		handle_t h = make_shared<entry_t>();
+		h->task = task;
+		h->due = toTick(when);
+		if (period.count() > 0) {
+			h->period = max<tick_t>(1, tick_t(chrono::duration_cast<chrono::milliseconds>(period).count()));
+		}
+		h->self = h;
+		link(h.get());
+		m_size++;
+		return h;
+	}
+
+	bool timer_wheel::cancel(const handle_t &h) {
+		if (!h) return false;
+		h->cancelled = true;
+		if (!h->self) return false;
+		unlink(h.get());
+		h->self.reset();
+		m_size--;
+		return true;
+	}
+
+	void timer_wheel::clear() {
+		for (unsigned level = 0; level < level_count; level++) {
+			for (unsigned slot = 0; slot < slot_count; slot++) {
+				entry_t *e = take(level, slot);
+				while (e) {
+					entry_t *next = e->next;
+					e->cancelled = true;
+					// may delete e
+					e->self.reset();
+					e = next;
+				}
+			}
+		}
+		m_size = 0;
+	}
+
+	void timer_wheel::advance(chrono::steady_clock::time_point now, vector<handle_t> &fired) {
+		tick_t target = now <= m_epoch ? 0 : tick_t(chrono::duration_cast<chrono::milliseconds>(now - m_epoch).count());
+		m_horizon = max(m_now, target);
+		while (m_now < target) {
+			chrono::steady_clock::time_point next;
+			if (!nextEvent(next) || toTick(next) > target) {
+				// nothing happens in between
+				m_now = target;
+				break;
+			}
+			m_now = toTick(next) - 1;
+			step(fired);
+		}
+	}
+
+	bool timer_wheel::nextEvent(chrono::steady_clock::time_point &when) const {
+		if (m_size == 0) return false;
+		tick_t best = ~tick_t(0);
+		for (unsigned level = 0; level < level_count; level++) {
+			if (!m_occupied[level]) continue;
+			unsigned shift = slot_bits * level;
+			// the tick at which the next occupied slot fires (level 0) or moves down (above that)
+			tick_t tick = ((m_now >> shift) + slotDistance(m_occupied[level], (m_now >> shift) % slot_count)) << shift;
+			best = min(best, tick);
+		}
+		when = toTime(best);
+		return true;
+	}
+
 	bool AsyncExecutor::m_started(false);
-	blocking_queue<AsyncExecutor::task_t> AsyncExecutor::m_fast_queue;
-	blocking_queue<AsyncExecutor::task_t> AsyncExecutor::m_slow_queue;
-	thread AsyncExecutor::m_fast_thread;
-	thread AsyncExecutor::m_slow_thread;
+	vector<AsyncExecutor::worker_t *> AsyncExecutor::m_workers;
+	map<thread::id, unsigned> AsyncExecutor::m_worker_index;
+	atomic<unsigned> AsyncExecutor::m_next_worker(0);
+	atomic<int> AsyncExecutor::m_pending(0);
+	atomic<int> AsyncExecutor::m_pending_slow(0);
+	atomic<unsigned> AsyncExecutor::m_slow_running(0);
+	mutex AsyncExecutor::m_pool_mutex;
+	condition_variable AsyncExecutor::m_pool_cond;
 	thread::id AsyncExecutor::m_main_id;
-	mutex AsyncExecutor::m_exec_mutex;
-	map<thread::id, blocking_queue<AsyncExecutor::task_t>> AsyncExecutor::m_exec_queues;
+	mpsc_overflow_queue<AsyncExecutor::main_task_t> AsyncExecutor::m_main_queue(4096);
+	deque<AsyncExecutor::main_task_t> AsyncExecutor::m_main_deferred;
+	mutex AsyncExecutor::m_exec_mutex;
+	map<thread::id, mpsc_overflow_queue<AsyncExecutor::task_t> *> AsyncExecutor::m_exec_queues;
+	atomic<int> AsyncExecutor::m_main_pending(0);
+	mutex AsyncExecutor::m_stats_mutex;
+	map<string, unique_ptr<task_stats>> AsyncExecutor::m_stats;
+	// run time here is time spent in each execute() on the main thread, and completed is the number of calls
+	task_stats * const AsyncExecutor::m_execute_stats = AsyncExecutor::stats("AsyncExec.execute");
+	thread AsyncExecutor::m_timer_thread;
+	mutex AsyncExecutor::m_timer_mutex;
+	condition_variable AsyncExecutor::m_timer_cond;
+	timer_wheel AsyncExecutor::m_timers;
+	bool AsyncExecutor::m_timer_stop(false);
+	chrono::steady_clock::time_point AsyncExecutor::m_timer_wake;
+
+	void AsyncExecutor::timerLoop() {
+		log("AsyncExec:timer") % 0 << "Timer thread started";
+		vector<timer_wheel::handle_t> fired;
+		unique_lock<mutex> lock(m_timer_mutex);
+		while (!m_timer_stop) {
+			m_timers.advance(chrono::steady_clock::now(), fired);
+			if (!fired.empty()) {
+				// these only hand the real task over to the executor
+				lock.unlock();
+				for (auto &h : fired) run("AsyncExec:timer", h->task);
+				// drops the last reference to one-off timers nobody kept a handle to
+				fired.clear();
+				lock.lock();
+				continue;
+			}
+			if (m_timers.nextEvent(m_timer_wake)) {
+				m_timer_cond.wait_until(lock, m_timer_wake);
+			} else {
+				m_timer_wake = chrono::steady_clock::time_point::max();
+				m_timer_cond.wait(lock);
+			}
+		}
+	}
+
+	timer_wheel::handle_t AsyncExecutor::schedule(chrono::steady_clock::time_point when, chrono::steady_clock::duration period, target_t target, const task_t &f) {
+		assert(m_started && "AsyncExecutor not started");
+		// whether the last firing is still waiting to run
+		auto queued = make_shared<atomic<bool>>(false);
+		lock_guard<mutex> lock(m_timer_mutex);
+		timer_wheel::handle_t h = m_timers.add(when, period, nullptr);
+		// the timer thread holds a reference while this runs; capturing the handle itself would be a cycle
+		weak_ptr<timer_wheel::entry_t> wh = h;
+		h->task = [=] {
+			if (queued->exchange(true)) return;
+			timer_wheel::handle_t self = wh.lock();
+			enqueueOn(target, [=] {
+				queued->store(false);
+				if (!self->cancelled) f();
+			});
+		};
+		chrono::steady_clock::time_point next;
+		if (m_timers.nextEvent(next) && next < m_timer_wake) {
+			// only wake the timer thread if it would otherwise sleep through this
+			m_timer_wake = next;
+			m_timer_cond.notify_all();
+		}
+		return h;
+	}
+
+	bool AsyncExecutor::cancel(const timer_wheel::handle_t &h) {
+		lock_guard<mutex> lock(m_timer_mutex);
+		return m_timers.cancel(h);
+	}
+
+	size_t AsyncExecutor::timerCount() {
+		lock_guard<mutex> lock(m_timer_mutex);
+		return m_timers.size();
+	}
+
+	void AsyncExecutor::executeMain(chrono::steady_clock::time_point deadline) {
+		auto time0 = chrono::steady_clock::now();
+		auto now = time0;
+		// tasks passed over or left part done this time; these go back in front of the deferred list, in order
+		vector<main_task_t> held;
+		auto cost = [](const main_task_t &mt) {
+			if (mt.cost.count() > 0) return mt.cost;
+			return mt.tag ? mt.tag->estimate() : chrono::nanoseconds(0);
+		};
+		while (held.size() < max_lookahead) {
+			main_task_t mt;
+			if (!m_main_deferred.empty()) {
+				mt = move(m_main_deferred.front());
+				m_main_deferred.pop_front();
+			} else if (!m_main_queue.pop(mt)) {
+				break;
+			}
+			auto c = cost(mt);
+			if (c.count() > 0 && c > deadline - now && mt.deferrals < max_deferrals) {
+				// known not to fit; something behind it might. unknown costs always get a go.
+				mt.deferrals++;
+				held.push_back(move(mt));
+				continue;
+			}
+			if (!mt.started) {
+				mt.started = true;
+				if (mt.tag) mt.tag->wait.record(now - mt.submitted);
+			}
+			bool again;
+			do {
+				auto time1 = now;
+				bool failed = false;
+				try {
+					again = mt.step();
+				} catch (exception &e) {
+					log("AsyncExec").error() << "Uncaught exception on main thread; what(): " << e.what();
+					again = false;
+					failed = true;
+				} catch (...) {
+					log("AsyncExec").error() << "Uncaught exception on main thread (not derived from std::exception)";
+					again = false;
+					failed = true;
+				}
+				now = chrono::steady_clock::now();
+				if (mt.tag) {
+					mt.tag->run.record(now - time1);
+					mt.tag->learn(now - time1);
+					if (!again) (failed ? mt.tag->failed : mt.tag->completed)++;
+				}
+			} while (again && cost(mt) <= deadline - now);
+			if (again) {
+				// out of time; resume next time
+				held.push_back(move(mt));
+			} else {
+				m_main_pending--;
+			}
+			if (now >= deadline) break;
+		}
+		for (auto it = held.rbegin(); it != held.rend(); ++it) {
+			m_main_deferred.push_front(move(*it));
+		}
+		// how much of the budget the main thread actually used
+		m_execute_stats->submitted++;
+		m_execute_stats->run.record(chrono::steady_clock::now() - time0);
+		m_execute_stats->completed++;
+	}
+
+	task_stats * AsyncExecutor::stats(const string &tag) {
+		lock_guard<mutex> lock(m_stats_mutex);
+		unique_ptr<task_stats> &ts = m_stats[tag];
+		if (!ts) ts.reset(new task_stats(tag));
+		return ts.get();
+	}
+
+	namespace {
+		double to_us(latency_histogram::duration_t d) {
+			return chrono::duration_cast<chrono::duration<double, micro>>(d).count();
+		}
+
+		void write_histogram_json(ostream &out, const latency_histogram &h) {
+			out << "{\"count\":" << h.count();
+			out << ",\"mean\":" << to_us(h.mean());
+			out << ",\"p50\":" << to_us(h.percentile(50));
+			out << ",\"p90\":" << to_us(h.percentile(90));
+			out << ",\"p99\":" << to_us(h.percentile(99));
+			out << ",\"max\":" << to_us(h.max()) << "}";
+		}
+
+		void write_json_string(ostream &out, const string &str) {
+			out << '"';
+			for (char c : str) {
+				if (c == '"' || c == '\\') out << '\\';
+				out << c;
+			}
+			out << '"';
+		}
+	}
+
+	void AsyncExecutor::logStats(unsigned verbosity) {
+		// copy the list so logging doesn't happen under the lock
+		vector<task_stats *> all;
+		{
+			lock_guard<mutex> lock(m_stats_mutex);
+			for (auto &pair : m_stats) all.push_back(pair.second.get());
+		}
+		log("AsyncExec") % verbosity << "Queue depth: pool " << poolQueueDepth() << ", main " << mainQueueDepth();
+		for (task_stats *ts : all) {
+			if (ts->wait.count() == 0 && ts->run.count() == 0) continue;
+			auto us = [](latency_histogram::duration_t d) { return to_us(d); };
+			log("AsyncExec") % verbosity << fixed << setprecision(1) << ts->tag
+				<< ": done " << ts->completed << ", failed " << ts->failed << ", in flight " << ts->inFlight()
+				<< "; wait us p50 " << us(ts->wait.percentile(50)) << " p99 " << us(ts->wait.percentile(99)) << " max " << us(ts->wait.max())
+				<< "; run us p50 " << us(ts->run.percentile(50)) << " p99 " << us(ts->run.percentile(99)) << " max " << us(ts->run.max());
+		}
+	}
+
+	string AsyncExecutor::statsJSON() {
+		ostringstream out;
+		out << "{\"queues\":{\"pool\":" << poolQueueDepth() << ",\"main\":" << mainQueueDepth() << "},\"tags\":{";
+		lock_guard<mutex> lock(m_stats_mutex);
+		bool first = true;
+		for (auto &pair : m_stats) {
+			task_stats *ts = pair.second.get();
+			if (!first) out << ",";
+			first = false;
+			write_json_string(out, ts->tag);
+			out << ":{\"submitted\":" << ts->submitted << ",\"completed\":" << ts->completed << ",\"failed\":" << ts->failed;
+			out << ",\"wait_us\":";
+			write_histogram_json(out, ts->wait);
+			out << ",\"run_us\":";
+			write_histogram_json(out, ts->run);
+			out << "}";
+		}
+		out << "}}";
+		return out.str();
+	}
+
+
+	TaskGraph::node_t TaskGraph::add(const string &name, AsyncExecutor::target_t target, const task_t &task, initializer_list<node_t> dependencies) {
+		node_t node = node_t(m_nodes.size());
+		unique_ptr<node_data_t> nd(new node_data_t());
+		nd->name = name;
+		nd->target = target;
+		nd->task = task;
+		for (node_t dep : dependencies) {
+			assert(dep < node && "dependency must be added first");
+			nd->dependencies.push_back(dep);
+			m_nodes[dep]->dependents.push_back(node);
+		}
+		m_nodes.push_back(move(nd));
+		return node;
+	}
+
+	void TaskGraph::dispatch(node_t node) {
+		if (m_nodes[node]->target == AsyncExecutor::main) {
+			lock_guard<mutex> lock(m_mutex);
+			m_main_ready.push_back(node);
+			m_cond.notify_all();
+		} else {
+			AsyncExecutor::enqueueOn(m_nodes[node]->target, [=] { execute(node); });
+		}
+	}
+
+	void TaskGraph::execute(node_t node) {
+		node_data_t &nd = *m_nodes[node];
+		auto time1 = chrono::steady_clock::now();
+		if (!m_failed) {
+			try {
+				nd.task();
+			} catch (...) {
+				lock_guard<mutex> lock(m_mutex);
+				if (!m_error) m_error = current_exception();
+				m_failed = true;
+			}
+		}
+		auto time2 = chrono::steady_clock::now();
+		nd.timing.start = time1 - m_time0;
+		nd.timing.duration = time2 - time1;
+		// release dependents before saying we're done, so run() can't return while we're still here
+		for (node_t dep : nd.dependents) {
+			if (--m_nodes[dep]->waiting_on == 0) dispatch(dep);
+		}
+		lock_guard<mutex> lock(m_mutex);
+		m_remaining--;
+		m_cond.notify_all();
+	}
+
+	void TaskGraph::run() {
+		m_main_ready.clear();
+		m_remaining = m_nodes.size();
+		m_error = nullptr;
+		m_failed = false;
+		for (auto &nd : m_nodes) {
+			nd->waiting_on = unsigned(nd->dependencies.size());
+			nd->timing = timing_t();
+		}
+		m_time0 = chrono::steady_clock::now();
+		for (node_t node = 0; node < m_nodes.size(); node++) {
+			if (m_nodes[node]->dependencies.empty()) dispatch(node);
+		}
+		unique_lock<mutex> lock(m_mutex);
+		while (m_remaining > 0) {
+			if (!m_main_ready.empty()) {
+				node_t node = m_main_ready.front();
+				m_main_ready.pop_front();
+				lock.unlock();
+				execute(node);
+				lock.lock();
+			} else {
+				// if this thread is interrupted while waiting, this will throw
+				InterruptManager::wait(m_cond, lock);
+			}
+		}
+		m_total = chrono::steady_clock::now() - m_time0;
+		if (m_error) rethrow_exception(m_error);
+	}
+
+	vector<TaskGraph::node_t> TaskGraph::criticalPath() const {
+		vector<node_t> path;
+		if (m_nodes.empty()) return path;
+		auto end = [&](node_t node) {
+			return m_nodes[node]->timing.start + m_nodes[node]->timing.duration;
+		};
+		// start from whatever finished last, then keep following the dependency that held it up
+		node_t node = 0;
+		for (node_t n = 1; n < m_nodes.size(); n++) {
+			if (end(n) > end(node)) node = n;
+		}
+		while (true) {
+			path.push_back(node);
+			const auto &deps = m_nodes[node]->dependencies;
+			if (deps.empty()) break;
+			node_t next = deps[0];
+			for (node_t dep : deps) {
+				if (end(dep) > end(next)) next = dep;
+			}
+			node = next;
+		}
+		reverse(path.begin(), path.end());
+		return path;
+	}
 
 }
\ No newline at end of file
@@ -1,17 +1,28 @@
 #ifndef AMBITION_CONCURRENT_HPP
 #define AMBITION_CONCURRENT_HPP
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
 #include <stdexcept>
+#include <utility>
 #include <map>
+#include <set>
 #include <vector>
 #include <deque>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <exception>
+#include <type_traits>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <chrono>
+#include <string>
 
 #include "Ambition.hpp"
 #include "Log.hpp"
@@ -27,18 +38,48 @@ namespace ambition {
 	};
 
 	// High-level mechanism for providing interruption of condition variable waiting.
-	// I dont know how well this actually performs, but it seems to work at least.
 	// Only threads that are waiting using this class can be interrupted using this class.
+	// Each thread gets its own interruption state the first time it waits (or is interrupted);
+	// these are kept in an intrusive list that is only locked when a thread starts or exits and
+	// when interrupting, so waiting itself only touches the calling thread's state.
 	class InterruptManager {
 	private:
-		struct thread_data_t {
+		struct wait_t {
 			std::condition_variable *condition;
 			std::mutex *mutex;
-			bool interrupt;
 		};
 
+		struct thread_state_t {
+			std::thread::id id;
+			std::atomic<bool> interrupt { false };
+			// what this thread is currently waiting on, if anything
+			std::atomic<wait_t *> waiting { nullptr };
+			// number of interrupting threads currently reading 'waiting'
+			std::atomic<unsigned> readers { 0 };
+			thread_state_t *prev = nullptr;
+			thread_state_t *next = nullptr;
+		};
+
+		// unregisters the thread's state on thread exit
+		struct thread_handle_t {
+			thread_state_t *state = nullptr;
+			~thread_handle_t();
+		};
+
+		// guards the list of thread states
 		static std::mutex m_mutex;
-		static std::map<std::thread::id, thread_data_t> m_thread_data;
+		static thread_state_t *m_threads;
+		static thread_local thread_handle_t m_this_thread;
+
+		// m_mutex must be locked
+		static thread_state_t * find(const std::thread::id &id);
+		static thread_state_t * link(const std::thread::id &id);
+		static void unlink(thread_state_t *ts);
+
+		static thread_state_t * thisThread();
+
+		// copy out what a thread is waiting on without racing the end of its wait
+		static bool waitingOn(thread_state_t *ts, wait_t &w);
 
 	public:
 		// wait on a condition variable.
@@ -61,20 +102,83 @@ namespace ambition {
 		// return true to detach
 		using observer_t = std::function<bool(const EventArgT &)>;
 
+		// runs a notification's observers somewhere else (e.g. on AsyncExecutor)
+		using dispatcher_t = std::function<void(const std::function<void()> &)>;
+
 	private:
-		unsigned m_next_key = 0;
-		unsigned m_count = 0;
-		unsigned m_waiters = 0;
-		std::map<unsigned, observer_t> m_observers;
+		struct observer_entry_t {
+			unsigned key;
+			observer_t func;
+			std::atomic<bool> detached { false };
+		};
+
+		using observer_list_t = std::vector<std::shared_ptr<observer_entry_t>>;
+
+		// observers are published as an immutable list that is swapped whole when attaching or detaching,
+		// so notify() never locks. deferred notifications keep this alive if they outlive the event.
+		struct observers_t {
+			// only taken to modify the list
+			std::mutex mutex;
+			unsigned next_key = 0;
+			// only access with std::atomic_load / std::atomic_store
+			std::shared_ptr<const observer_list_t> list { std::make_shared<observer_list_t>() };
+
+			inline unsigned attach(const observer_t &func) {
+				std::lock_guard<std::mutex> lock(mutex);
+				auto oe = std::make_shared<observer_entry_t>();
+				oe->key = next_key++;
+				oe->func = func;
+				auto list1 = std::make_shared<observer_list_t>(*std::atomic_load(&list));
+				list1->push_back(std::move(oe));
+				std::atomic_store(&list, std::shared_ptr<const observer_list_t>(std::move(list1)));
+				return next_key - 1;
+			}
+
+			inline bool detach(unsigned key) {
+				std::lock_guard<std::mutex> lock(mutex);
+				auto list0 = std::atomic_load(&list);
+				auto list1 = std::make_shared<observer_list_t>();
+				list1->reserve(list0->size());
+				bool found = false;
+				for (auto &oe : *list0) {
+					if (oe->key == key) {
+						oe->detached = true;
+						found = true;
+					} else {
+						list1->push_back(oe);
+					}
+				}
+				if (found) std::atomic_store(&list, std::shared_ptr<const observer_list_t>(std::move(list1)));
+				return found;
+			}
+
+			inline void notify(const EventArgT &e) {
+				auto list0 = std::atomic_load(&list);
+				for (auto &oe : *list0) {
+					// skip observers detached since we took the snapshot
+					if (oe->detached.load()) continue;
+					if (oe->func(e) && !oe->detached.exchange(true)) {
+						detach(oe->key);
+					}
+				}
+			}
+		};
+
+		std::shared_ptr<observers_t> m_observers { std::make_shared<observers_t>() };
+		dispatcher_t m_dispatcher;
+
+		// only used for wait()
+		std::atomic<unsigned> m_count { 0 };
+		std::atomic<unsigned> m_waiters { 0 };
 		std::mutex m_mutex;
 		std::condition_variable m_cond;
 
 		class waiter_guard {
 		private:
-			unsigned *m_waiters;
+			std::atomic<unsigned> *m_waiters;
 
 		public:
-			inline waiter_guard(unsigned &waiters_) : m_waiters(&waiters_) {
+			inline waiter_guard(std::atomic<unsigned> &waiters_) : m_waiters(&waiters_) {
 				(*m_waiters)++;
 			}
 
@@ -86,33 +190,41 @@ namespace ambition {
 	public:
 		inline Event() {}
 
+		// observers are run by the dispatcher instead of by the notifying thread
+		inline explicit Event(const dispatcher_t &dispatcher_) : m_dispatcher(dispatcher_) {}
+
+		// set (or clear) the dispatcher.
+		// not safe to call while other threads may be notifying.
+		inline void dispatcher(const dispatcher_t &dispatcher_) {
+			m_dispatcher = dispatcher_;
+		}
+
 		inline unsigned attach(const observer_t &func) {
-			std::lock_guard<std::mutex> lock(m_mutex);
-			unsigned key = m_next_key++;
-			m_observers[key] = func;
-			return key;
+			return m_observers->attach(func);
 		}
 
 		inline bool detach(unsigned key) {
-			std::lock_guard<std::mutex> lock(m_mutex);
-			return m_observers.erase(key);
+			return m_observers->detach(key);
 		}
 
+		// call all observers with the current snapshot of the observer list.
+		// observers attached or detached during a notify may or may not see it,
+		// and overlapping notifies may run the same observer concurrently.
+		// waiting threads are woken immediately, even if observers are deferred.
 		inline void notify(const EventArgT &e) {
-			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_dispatcher) {
+				std::shared_ptr<observers_t> observers = m_observers;
+				m_dispatcher([=] { observers->notify(e); });
+			} else {
+				m_observers->notify(e);
+			}
 			m_count++;
-			if (!m_observers.empty()) {
-				std::vector<unsigned> detach_keys;
-				for (auto pair : m_observers) {
-					if (pair.second(e)) {
-						detach_keys.push_back(pair.first);
-					}
-				}
-				for (auto key : detach_keys) {
-					m_observers.erase(key);
-				}
+			// a waiter registers before reading the count, and we bump the count before checking for waiters,
+			// so either it sees this notify as already done or we see it and wake it
+			if (m_waiters.load()) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_cond.notify_all();
 			}
-			m_cond.notify_all();
 		}
 
 		// returns true if the event was fired
@@ -223,67 +335,661 @@ namespace ambition {
 
 	};
 
+	// bounded lock-free multi-producer single-consumer ring.
+	// based on Dmitry Vyukov's bounded queue; each cell carries a sequence number that tells
+	// producers and the consumer whose turn it is, so neither side ever takes a lock.
+	// capacity is rounded up to a power of 2.
+	template <typename T>
+	class mpsc_queue : private Uncopyable {
+	private:
+		struct cell_t {
+			std::atomic<size_t> seq;
+			T value;
+		};
+
+		// keep the producer and consumer indices on separate cache lines
+		char m_pad0[64];
+		std::atomic<size_t> m_head;
+		char m_pad1[64 - sizeof(std::atomic<size_t>)];
+		size_t m_tail;
+		char m_pad2[64 - sizeof(size_t)];
+		cell_t *m_cells;
+		size_t m_mask;
+
+		template <typename U>
+		inline bool push_impl(U &&value) {
+			cell_t *cell;
+			size_t pos = m_head.load(std::memory_order_relaxed);
+			while (true) {
+				cell = &m_cells[pos & m_mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				std::ptrdiff_t diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+				if (diff == 0) {
+					// cell is free for this position, try to claim it
+					if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+				} else if (diff < 0) {
+					// consumer hasn't freed this cell yet; full
+					return false;
+				} else {
+					// another producer got here first
+					pos = m_head.load(std::memory_order_relaxed);
+				}
+			}
+			cell->value = std::forward<U>(value);
+			cell->seq.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+	public:
+		inline explicit mpsc_queue(size_t capacity) : m_head(0), m_tail(0) {
+			size_t size = 2;
+			while (size < capacity) size <<= 1;
+			m_cells = new cell_t[size];
+			m_mask = size - 1;
+			for (size_t i = 0; i < size; i++) {
+				m_cells[i].seq.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		inline size_t capacity() const {
+			return m_mask + 1;
+		}
+
+		// returns false (and leaves value untouched) if the queue is full.
+		// safe to call from any thread.
+		inline bool try_push(const T &value) {
+			return push_impl(value);
+		}
+
+		inline bool try_push(T &&value) {
+			return push_impl(std::move(value));
+		}
+
+		// consumer thread only
+		inline bool try_pop(T &ret) {
+			cell_t &cell = m_cells[m_tail & m_mask];
+			size_t seq = cell.seq.load(std::memory_order_acquire);
+			if (seq != m_tail + 1) return false;
+			ret = std::move(cell.value);
+			// don't hold on to whatever the moved-from value still owns
+			cell.value = T();
+			cell.seq.store(m_tail + m_mask + 1, std::memory_order_release);
+			m_tail++;
+			return true;
+		}
+
+		// consumer thread only.
+		// pop up to max items, calling func(T &&) on each; returns the number popped.
+		template <typename FuncT>
+		inline size_t drain(FuncT func, size_t max) {
+			size_t c = 0;
+			T t;
+			while (c < max && try_pop(t)) {
+				func(std::move(t));
+				c++;
+			}
+			return c;
+		}
+
+		// consumer thread only
+		inline bool empty() const {
+			return m_cells[m_tail & m_mask].seq.load(std::memory_order_acquire) != m_tail + 1;
+		}
+
+		inline ~mpsc_queue() {
+			delete[] m_cells;
+		}
+
+	};
+
+	// unbounded multi-producer single-consumer queue with batched consumption.
+	// producers normally only touch a lock-free mpsc_queue; if the consumer falls far enough
+	// behind to fill it, items spill into a locked overflow list so pushing never fails.
+	template <typename T>
+	class mpsc_overflow_queue : private Uncopyable {
+	private:
+		static const size_t batch_size = 64;
+
+		mpsc_queue<T> m_ring;
+		std::atomic<bool> m_overflowed;
+		std::mutex m_overflow_mutex;
+		std::deque<T> m_overflow;
+		// consumer only: items drained from the ring but not yet popped
+		std::deque<T> m_batch;
+
+		inline void refill() {
+			m_ring.drain([this](T &&t) { m_batch.push_back(std::move(t)); }, batch_size);
+			// only look at the overflow once the ring is empty, so a producer's items stay in order
+			if (m_batch.empty() && m_overflowed) {
+				std::lock_guard<std::mutex> lock(m_overflow_mutex);
+				m_batch.swap(m_overflow);
+				m_overflowed = false;
+			}
+		}
+
+	public:
+		inline explicit mpsc_overflow_queue(size_t capacity) : m_ring(capacity), m_overflowed(false) { }
+
+		// any thread
+		inline void push(const T &value) {
+			// once overflowed, keep using the overflow until the consumer empties it
+			if (!m_overflowed && m_ring.try_push(value)) return;
+			std::lock_guard<std::mutex> lock(m_overflow_mutex);
+			m_overflowed = true;
+			m_overflow.push_back(value);
+		}
+
+		// consumer thread only
+		inline bool pop(T &ret) {
+			if (m_batch.empty()) refill();
+			if (m_batch.empty()) return false;
+			ret = std::move(m_batch.front());
+			m_batch.pop_front();
+			return true;
+		}
+
+		// consumer thread only
+		inline bool empty() const {
+			return m_batch.empty() && m_ring.empty() && !m_overflowed;
+		}
+
+	};
+
+	// double-ended work queue belonging to one pool worker.
+	// the owning worker pushes and pops at the back (most recent first, for locality),
+	// other workers steal from the front (oldest first).
+	template <typename T>
+	class work_deque : private Uncopyable {
+	private:
+		std::mutex m_mutex;
+		std::deque<T> m_deque;
+
+	public:
+		inline work_deque() { }
+
+		inline void push(T value) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_deque.push_back(std::move(value));
+		}
+
+		inline bool pop(T &ret) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_deque.empty()) return false;
+			ret = std::move(m_deque.back());
+			m_deque.pop_back();
+			return true;
+		}
+
+		inline bool steal(T &ret) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_deque.empty()) return false;
+			ret = std::move(m_deque.front());
+			m_deque.pop_front();
+			return true;
+		}
+
+	};
+
+	// lock-free log-linear histogram of durations in nanoseconds, in the style of HdrHistogram.
+	// each power of 2 is split into 16 linear buckets, so recorded values are kept to within ~6%
+	// over the whole 64-bit range. recording is a few relaxed atomic ops, so it can stay on in release builds.
+	class latency_histogram : private Uncopyable {
+	public:
+		using duration_t = std::chrono::nanoseconds;
+
+	private:
+		static const unsigned sub_bits = 5;
+		static const unsigned half_count = 1u << (sub_bits - 1);
+		static const unsigned bucket_count = (64 - sub_bits + 1) * half_count + half_count;
+
+		std::atomic<unsigned long long> m_buckets[bucket_count];
+		std::atomic<unsigned long long> m_count { 0 };
+		std::atomic<unsigned long long> m_sum { 0 };
+		std::atomic<unsigned long long> m_max { 0 };
+
+		static inline unsigned msb(unsigned long long v) {
+			unsigned r = 0;
+			while (v >>= 1) r++;
+			return r;
+		}
+
+		static inline unsigned bucketIndex(unsigned long long v) {
+			if (v < 2 * half_count) return unsigned(v);
+			unsigned shift = msb(v) - sub_bits + 1;
+			return shift * half_count + unsigned(v >> shift);
+		}
+
+		// middle of the range of values that land in a bucket
+		static inline unsigned long long bucketValue(unsigned i) {
+			if (i < 2 * half_count) return i;
+			unsigned shift = i / half_count - 1;
+			unsigned long long low = (unsigned long long)(i % half_count + half_count) << shift;
+			return low + ((1ull << shift) >> 1);
+		}
+
+	public:
+		inline latency_histogram() {
+			reset();
+		}
+
+		inline void record(duration_t d) {
+			unsigned long long v = d.count() > 0 ? (unsigned long long)(d.count()) : 0;
+			m_buckets[bucketIndex(v)].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(v, std::memory_order_relaxed);
+			unsigned long long m = m_max.load(std::memory_order_relaxed);
+			while (v > m && !m_max.compare_exchange_weak(m, v, std::memory_order_relaxed));
+		}
+
+		// not atomic with respect to concurrent recording
+		inline void reset() {
+			for (auto &b : m_buckets) b.store(0, std::memory_order_relaxed);
+			m_count = 0;
+			m_sum = 0;
+			m_max = 0;
+		}
+
+		inline unsigned long long count() const {
+			return m_count.load(std::memory_order_relaxed);
+		}
+
+		inline duration_t mean() const {
+			unsigned long long c = count();
+			return duration_t(c ? (long long)(m_sum.load(std::memory_order_relaxed) / c) : 0);
+		}
+
+		inline duration_t max() const {
+			return duration_t((long long)(m_max.load(std::memory_order_relaxed)));
+		}
+
+		// value at percentile p (0-100), to within the bucket precision
+		inline duration_t percentile(double p) const {
+			unsigned long long c = count();
+			if (c == 0) return duration_t(0);
+			unsigned long long target = (unsigned long long)(std::ceil(c * (p / 100.0)));
+			if (target == 0) target = 1;
+			unsigned long long seen = 0;
+			for (unsigned i = 0; i < bucket_count; i++) {
+				seen += m_buckets[i].load(std::memory_order_relaxed);
+				if (seen >= target) return std::min(duration_t((long long)(bucketValue(i))), max());
+			}
+			return max();
+		}
+	};
+
+	// counters and latency histograms for one tag of tasks (see AsyncExecutor::tagged())
+	struct task_stats : private Uncopyable {
+		const std::string tag;
+		std::atomic<unsigned long long> submitted { 0 };
+		std::atomic<unsigned long long> completed { 0 };
+		std::atomic<unsigned long long> failed { 0 };
+		// from submission to starting to run
+		latency_histogram wait;
+		// from starting to finishing
+		latency_histogram run;
+
+		inline explicit task_stats(const std::string &tag_) : tag(tag_) { }
+
+		// tasks submitted but not yet finished
+		inline long long inFlight() const {
+			return (long long)(submitted.load()) - (long long)(completed.load()) - (long long)(failed.load());
+		}
+
+		// moving average of recent run times (or slice times, for sliced tasks); 0 until something has run
+		inline std::chrono::nanoseconds estimate() const {
+			return std::chrono::nanoseconds(std::max(0ll, m_estimate.load(std::memory_order_relaxed)));
+		}
+
+		inline void learn(std::chrono::nanoseconds d) {
+			long long e = m_estimate.load(std::memory_order_relaxed);
+			// concurrent learners can only lose a sample
+			m_estimate.store(e < 0 ? d.count() : e + (d.count() - e) / 8, std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<long long> m_estimate { -1 };
+	};
+
+	// hierarchical timing wheel with 1ms ticks.
+	// each level has 64 slots covering 64 times the span of the level below; a timer sits in the
+	// lowest level that reaches its due tick, and moves down a level each time the level below wraps.
+	// adding, cancelling and firing are O(1), and a bitmap of occupied slots per level lets
+	// advance() and nextEvent() skip empty time without visiting it.
+	// not thread-safe; AsyncExecutor drives one from its timer thread.
+	class timer_wheel : private Uncopyable {
+	public:
+		using task_t = std::function<void(void)>;
+		using tick_t = unsigned long long;
+
+		struct entry_t {
+			task_t task;
+			// tick this is next due at
+			tick_t due = 0;
+			// ticks between firings, or 0 for a one-off
+			tick_t period = 0;
+			// set by cancel(), so whoever runs a firing that is already out of the wheel can check
+			std::atomic<bool> cancelled { false };
+
+		private:
+			friend class timer_wheel;
+			entry_t *prev = nullptr;
+			entry_t *next = nullptr;
+			unsigned level = 0;
+			unsigned slot = 0;
+			// keeps the entry alive while it is in the wheel
+			std::shared_ptr<entry_t> self;
+		};
+
+		using handle_t = std::shared_ptr<entry_t>;
+
+	private:
+		static const unsigned slot_bits = 6;
+		static const unsigned slot_count = 1 << slot_bits;
+		// 64^5 ticks is about 12 days; anything later is parked in the top level until it comes in range
+		static const unsigned level_count = 5;
+
+		std::chrono::steady_clock::time_point m_epoch;
+		// last tick processed
+		tick_t m_now = 0;
+		// tick the current advance() is going up to
+		tick_t m_horizon = 0;
+		size_t m_size = 0;
+		entry_t *m_slots[level_count][slot_count];
+		// bit i set when slot i of that level has any entries
+		unsigned long long m_occupied[level_count];
+
+		// distance from slot 'from' to the next occupied slot, 1-64 (64 meaning 'from' itself)
+		static inline unsigned slotDistance(unsigned long long bits, unsigned from) {
+			unsigned r = (from + 1) % slot_count;
+			unsigned long long rot = r ? (bits >> r) | (bits << (slot_count - r)) : bits;
+#ifdef __GNUC__
+			return unsigned(__builtin_ctzll(rot)) + 1;
+#else
+			unsigned d = 1;
+			for (; !(rot & 1); rot >>= 1) d++;
+			return d;
+#endif
+		}
+
+		void link(entry_t *e);
+		void unlink(entry_t *e);
+		entry_t * take(unsigned level, unsigned slot);
+		void expire(entry_t *e, std::vector<handle_t> &fired);
+		void step(std::vector<handle_t> &fired);
+
+	public:
+		explicit timer_wheel(std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now());
+
+		~timer_wheel();
+
+		// first tick at or after a time
+		tick_t toTick(std::chrono::steady_clock::time_point t) const;
+
+		std::chrono::steady_clock::time_point toTime(tick_t tick) const;
+
+		// add a timer due at 'when', then every 'period' after that if period > 0.
+		// a time already passed is due on the next tick.
+		handle_t add(std::chrono::steady_clock::time_point when, std::chrono::steady_clock::duration period, const task_t &task);
+
+		// take a timer out of the wheel. returns false if it had already fired for the last time.
+		bool cancel(const handle_t &h);
+
+		// remove all timers
+		void clear();
+
+		// process every tick up to 'now', appending timers that are due to 'fired'.
+		// periodic timers are rescheduled before they are returned, and fire at most once per call;
+		// periods missed by calling this late are skipped.
+		void advance(std::chrono::steady_clock::time_point now, std::vector<handle_t> &fired);
+
+		// the next time advance() has anything to do, or false if the wheel is empty
+		bool nextEvent(std::chrono::steady_clock::time_point &when) const;
+
+		inline size_t size() const {
+			return m_size;
+		}
+	};
+
+	template <typename T>
+	class task_future;
+
 	// mechanism for asynchronous execution of arbitrary tasks
 	// yes i know std::async exists
 	class AsyncExecutor {
 	public:
 		using task_t = std::function<void(void)>;
 
+		// a main thread task that runs in slices; returns true to be called again
+		using slice_task_t = std::function<bool(void)>;
+
+		// where a task runs: the main thread (see execute()) or the worker pool at either priority
+		enum target_t {
+			main,
+			fast,
+			slow
+		};
+
 	private:
+		// background task priority classes; workers always look for fast work before slow work
+		enum {
+			priority_fast,
+			priority_slow,
+			priority_count
+		};
+
+		struct main_task_t {
+			slice_task_t step;
+			// stats to record under and learn the cost from, if any
+			task_stats *tag = nullptr;
+			// declared cost of a slice, or 0 to use the tag's estimate
+			std::chrono::nanoseconds cost { 0 };
+			std::chrono::steady_clock::time_point submitted;
+			bool started = false;
+			// number of times this has been passed over for not fitting the time left
+			unsigned deferrals = 0;
+		};
+
+		// a main thread task is passed over at most this many times before it runs regardless
+		static const unsigned max_deferrals = 8;
+		// stop looking for a task that fits after passing over this many
+		static const unsigned max_lookahead = 32;
+
+		struct worker_t {
+			std::thread thread;
+			work_deque<task_t> queues[priority_count];
+			// tasks that must run on this particular worker (see enqueue())
+			mpsc_overflow_queue<task_t> exec_queue;
+
+			inline worker_t() : exec_queue(256) { }
+		};
+
 		static bool m_started;
-		static blocking_queue<task_t> m_fast_queue, m_slow_queue;
-		static std::thread m_fast_thread, m_slow_thread;
+		static std::vector<worker_t *> m_workers;
+		// worker thread id -> worker index; only modified by start()
+		static std::map<std::thread::id, unsigned> m_worker_index;
+		static std::atomic<unsigned> m_next_worker;
+		// number of tasks sitting in worker deques, and how many of those are slow
+		static std::atomic<int> m_pending;
+		static std::atomic<int> m_pending_slow;
+		// number of slow tasks taken by workers and not yet finished; see slowLimit()
+		static std::atomic<unsigned> m_slow_running;
+		static std::mutex m_pool_mutex;
+		static std::condition_variable m_pool_cond;
 		static std::thread::id m_main_id;
+		// the main thread's queue is found without any lookup, as it is by far the busiest
+		static mpsc_overflow_queue<main_task_t> m_main_queue;
+		// main thread only: tasks passed over or part done by an earlier execute(), in order
+		static std::deque<main_task_t> m_main_deferred;
+		// queues for other threads; these are created on demand and never destroyed
 		static std::mutex m_exec_mutex;
-		static std::map<std::thread::id, blocking_queue<task_t>> m_exec_queues;
+		static std::map<std::thread::id, mpsc_overflow_queue<task_t> *> m_exec_queues;
+		// number of tasks waiting in m_main_queue or m_main_deferred
+		static std::atomic<int> m_main_pending;
+		// stats by tag; never removed, so pointers handed out stay valid
+		static std::mutex m_stats_mutex;
+		static std::map<std::string, std::unique_ptr<task_stats>> m_stats;
+		static task_stats * const m_execute_stats;
+		// delayed and periodic tasks; the timer thread sleeps until the wheel next has something to do
+		static std::thread m_timer_thread;
+		static std::mutex m_timer_mutex;
+		static std::condition_variable m_timer_cond;
+		static timer_wheel m_timers;
+		static bool m_timer_stop;
+		// when the timer thread will next wake up by itself
+		static std::chrono::steady_clock::time_point m_timer_wake;
+
+		static inline unsigned defaultWorkerCount() {
+			// leave a core for the main thread, but always have at least 2 workers
+			// so one can be kept free for fast tasks (see slowLimit())
+			unsigned hw = std::thread::hardware_concurrency();
+			return hw > 3 ? hw - 1 : 2;
+		}
+
+		static inline void wakeWorkers(bool all) {
+			{
+				// ensures a worker that has just found nothing to do is either
+				// yet to check the wait condition or is actually waiting
+				std::lock_guard<std::mutex> lock(m_pool_mutex);
+			}
+			if (all) {
+				m_pool_cond.notify_all();
+			} else {
+				m_pool_cond.notify_one();
+			}
+		}
+
+		// most slow tasks that may run at once. workers don't preempt, so one worker is
+		// always kept back for fast tasks; with a single worker this isn't possible.
+		static inline unsigned slowLimit() {
+			return m_workers.size() > 1 ? m_workers.size() - 1 : 1;
+		}
+
+		// claim one of the slowLimit() slots for running a slow task
+		static inline bool reserveSlow() {
+			unsigned n = m_slow_running;
+			while (n < slowLimit()) {
+				if (m_slow_running.compare_exchange_weak(n, n + 1)) return true;
+			}
+			return false;
+		}
+
+		// number of pending tasks this worker could take right now
+		static inline int takeable() {
+			return m_slow_running < slowLimit() ? int(m_pending) : m_pending - m_pending_slow;
+		}
+
+		// take a task from this worker's own deques, or steal one from another worker.
+		// sets slow if the task holds a slow slot, which the caller must release once it has run.
+		static inline bool take(unsigned index, task_t &task, bool &slow) {
+			unsigned count = m_workers.size();
+			for (unsigned p = 0; p < priority_count; p++) {
+				slow = p == priority_slow;
+				if (slow && !reserveSlow()) return false;
+				bool found = m_workers[index]->queues[p].pop(task);
+				for (unsigned i = 1; !found && i < count; i++) {
+					found = m_workers[(index + i) % count]->queues[p].steal(task);
+				}
+				if (found) {
+					if (slow) m_pending_slow--;
+					m_pending--;
+					return true;
+				}
+				if (slow) m_slow_running--;
+			}
+			return false;
+		}
+
+		static inline void run(const std::string &source, const task_t &task) {
+			try {
+				task();
+			} catch (std::exception &e) {
+				log(source).error() << "Uncaught exception; what(): " << e.what();
+			} catch (...) {
+				log(source).error() << "Uncaught exception (not derived from std::exception)";
+			}
+		}
+
+		static inline void work(unsigned index) {
+			const std::string source = "AsyncExec:" + std::to_string(index);
+			worker_t *self = m_workers[index];
+			log(source) % 0 << "Background thread started";
+			while (true) {
+				task_t task;
+				bool slow = false;
+				if (self->exec_queue.pop(task) || take(index, task, slow)) {
+					run(source, task);
+					if (slow) {
+						m_slow_running--;
+						// a worker may be asleep because the slow slots were full
+						if (m_pending_slow > 0) wakeWorkers(false);
+					}
+					continue;
+				}
+				try {
+					std::unique_lock<std::mutex> lock(m_pool_mutex);
+					while (takeable() <= 0 && self->exec_queue.empty()) {
+						// if this thread is interrupted while waiting, this will throw
+						InterruptManager::wait(m_pool_cond, lock);
+					}
+				} catch (interruption &e) {
+					// thread needs to quit
+					log(source) << "Interrupted, exiting";
+					break;
+				}
+			}
+		}
+
+		static inline void submitMain(main_task_t &&mt) {
+			if (mt.tag) mt.tag->submitted++;
+			mt.submitted = std::chrono::steady_clock::now();
+			m_main_pending++;
+			m_main_queue.push(mt);
+		}
+
+		static void executeMain(std::chrono::steady_clock::time_point deadline);
+
+		static void timerLoop();
+
+		static timer_wheel::handle_t schedule(
+			std::chrono::steady_clock::time_point when, std::chrono::steady_clock::duration period, target_t target, const task_t &f
+		);
+
+		static inline void submit(unsigned priority, const task_t &f) {
+			assert(m_started && "AsyncExecutor not started");
+			// workers push onto their own deque, other threads spread tasks over all workers
+			unsigned index;
+			auto it = m_worker_index.find(std::this_thread::get_id());
+			if (it != m_worker_index.end()) {
+				index = it->second;
+			} else {
+				index = m_next_worker++ % m_workers.size();
+			}
+			// m_pending goes up first and down last so takeable() never undercounts fast work
+			m_workers[index]->queues[priority].push(f);
+			m_pending++;
+			if (priority == priority_slow) m_pending_slow++;
+			wakeWorkers(false);
+		}
 
 	public:
-		// start the background threads.
+		// start the background worker pool.
 		// must be called from the main thread.
-		static inline void start() {
+		// threads == 0 sizes the pool from std::thread::hardware_concurrency().
+		static inline void start(unsigned threads = 0) {
 			if (!m_started) {
-				log("AsyncExec") % 0 << "Starting...";
+				if (threads == 0) threads = defaultWorkerCount();
+				log("AsyncExec") % 0 << "Starting " << threads << " background threads...";
 				m_main_id = std::this_thread::get_id();
-				m_fast_thread = std::thread([] {
-					log("AsyncExec:fast") % 0 << "Background thread started";
-					while (true) {
-						task_t task;
-						try {
-							task = m_fast_queue.pop();
-						} catch (interruption &e) {
-							// thread needs to quit
-							log("AsyncExec:fast") << "Interrupted, exiting";
-							break;
-						}
-						try {
-							task();
-						} catch (std::exception &e) {
-							log("AsyncExec:fast").error() << "Uncaught exception; what(): " << e.what();
-						} catch (...) {
-							log("AsyncExec:fast").error() << "Uncaught exception (not derived from std::exception)";
-						}
-					}
-				});
-				m_slow_thread = std::thread([] {
-					log("AsyncExec:slow") % 0 << "Background thread started";
-					while (true) {
-						task_t task;
-						try {
-							task = m_slow_queue.pop();
-						} catch (interruption &e) {
-							// thread needs to quit
-							log("AsyncExec:slow") << "Interrupted, exiting";
-							break;
-						}
-						try {
-							task();
-						} catch (std::exception &e) {
-							log("AsyncExec:slow").error() << "Uncaught exception; what(): " << e.what();
-						} catch (...) {
-							log("AsyncExec:slow").error() << "Uncaught exception (not derived from std::exception)";
-						}
-					}
-				});
+				// all workers must exist before any thread starts stealing
+				for (unsigned i = 0; i < threads; i++) {
+					m_workers.push_back(new worker_t());
+				}
+				for (unsigned i = 0; i < threads; i++) {
+					m_workers[i]->thread = std::thread(work, i);
+					m_worker_index[m_workers[i]->thread.get_id()] = i;
+				}
+				m_timer_stop = false;
+				m_timer_thread = std::thread(timerLoop);
 				m_started = true;
 			}
 		}
@@ -297,52 +1003,118 @@ namespace ambition {
 				log("AsyncExec") % 0 << "Stopping background threads...";
 				// give the last log message time to show up
 				std::this_thread::sleep_for(std::chrono::milliseconds(10));
-				InterruptManager::interrupt(m_fast_thread.get_id());
-				InterruptManager::interrupt(m_slow_thread.get_id());
-				m_fast_thread.join();
-				m_slow_thread.join();
+				for (worker_t *w : m_workers) {
+					InterruptManager::interrupt(w->thread.get_id());
+				}
+				for (worker_t *w : m_workers) {
+					w->thread.join();
+				}
+				{
+					std::lock_guard<std::mutex> lock(m_timer_mutex);
+					m_timer_stop = true;
+					m_timers.clear();
+				}
+				m_timer_cond.notify_all();
+				m_timer_thread.join();
+				// anything still queued is dropped; this allows start() to be called again
+				for (worker_t *w : m_workers) {
+					delete w;
+				}
+				m_workers.clear();
+				m_worker_index.clear();
+				main_task_t mt;
+				while (m_main_queue.pop(mt)) { }
+				m_main_deferred.clear();
+				m_main_pending = 0;
+				m_pending = 0;
+				m_pending_slow = 0;
+				m_slow_running = 0;
+				m_started = false;
 			}
 		}
 
+		// number of background worker threads.
+		// start() must have completed before calling.
+		static inline unsigned workerCount() {
+			assert(m_started && "AsyncExecutor not started");
+			return m_workers.size();
+		}
+
+		// number of workers that may be running slow tasks at once; the rest are kept for fast tasks.
+		// start() must have completed before calling.
+		static inline unsigned slowWorkerCount() {
+			assert(m_started && "AsyncExecutor not started");
+			return slowLimit();
+		}
+
+		// get the id of a background worker thread, for use with enqueue().
+		// start() must have completed before calling.
+		static inline std::thread::id workerThreadID(unsigned index) {
+			assert(m_started && "AsyncExecutor not started");
+			return m_workers.at(index)->thread.get_id();
+		}
+
 		// add a high-priority background task with expected duration < ~50ms.
-		// this always goes to the same background thread.
+		// idle workers always take these before any slow tasks.
 		static inline void enqueueFast(const task_t &f) {
-			m_fast_queue.push(f);
+			submit(priority_fast, f);
 		}
 
-		// add a low-priority or slow (but still non-blocking) background task
-		// this always goes to the same background thread.
+		// add a low-priority or slow (but still non-blocking) background task.
+		// this may run on any worker, concurrently with other slow tasks.
 		static inline void enqueueSlow(const task_t &f) {
-			m_slow_queue.push(f);
+			submit(priority_slow, f);
 		}
 
-		// add a task to a specific thread
+		// add a task to a specific thread.
+		// background workers run these ahead of pool tasks; other threads must call execute().
 		static inline void enqueue(const std::thread::id &tid, const task_t &f) {
-			std::lock_guard<std::mutex> lock(m_exec_mutex);
-			auto it = m_exec_queues.find(tid);
-			if (it == m_exec_queues.end()) {
-				// create a new queue
-				blocking_queue<task_t> q;
-				q.push(f);
-				m_exec_queues[tid] = std::move(q);
-			} else {
-				it->second.push(f);
+			if (m_started && tid == m_main_id) {
+				main_task_t mt;
+				mt.step = [f] { f(); return false; };
+				submitMain(std::move(mt));
+				return;
 			}
-		}
-
-		// execute tasks for the current thread up to some time limit
-		template <typename RepT, typename Period>
-		static inline void execute(const std::chrono::duration<RepT, Period> &dur) {
-			blocking_queue<task_t> *q = nullptr;
+			auto wit = m_worker_index.find(tid);
+			if (wit != m_worker_index.end()) {
+				m_workers[wit->second]->exec_queue.push(f);
+				// we can't choose which worker gets woken, so wake them all
+				wakeWorkers(true);
+				return;
+			}
+			mpsc_overflow_queue<task_t> *q;
 			{
 				std::lock_guard<std::mutex> lock(m_exec_mutex);
-				auto it = m_exec_queues.find(std::this_thread::get_id());
-				if (it != m_exec_queues.end()) q = &it->second;
+				auto it = m_exec_queues.find(tid);
+				if (it == m_exec_queues.end()) {
+					// create a new queue
+					q = new mpsc_overflow_queue<task_t>(256);
+					m_exec_queues[tid] = q;
+				} else {
+					q = it->second;
+				}
 				// safe to release this lock because the queues never get destroyed
 			}
+			q->push(f);
+		}
+
+		// execute tasks for the current thread until a deadline.
+		// on the main thread, a task whose cost is known (declared, or learned from its tag) and
+		// won't fit in the time left is passed over for one that will, and sliced tasks run a slice
+		// at a time until they are done or out of time.
+		static inline void executeUntil(std::chrono::steady_clock::time_point deadline) {
+			if (m_started && std::this_thread::get_id() == m_main_id) {
+				executeMain(deadline);
+				return;
+			}
+			mpsc_overflow_queue<task_t> *q = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(m_exec_mutex);
+				auto it = m_exec_queues.find(std::this_thread::get_id());
+				if (it != m_exec_queues.end()) q = it->second;
+			}
 			if (q) {
 				// there is a queue for this thread
-				auto time1 = std::chrono::steady_clock::now() + dur;
 				do {
 					task_t task;
 					if (!q->pop(task)) return;
@@ -353,10 +1125,16 @@ namespace ambition {
 					} catch (...) {
 						log("AsyncExec").error() << "Uncaught exception on thread " << std::this_thread::get_id() << " (not derived from std::exception)";
 					}
-				} while (std::chrono::steady_clock::now() < time1);
+				} while (std::chrono::steady_clock::now() < deadline);
 			}
 		}
 
+		// execute tasks for the current thread up to some time limit
+		template <typename RepT, typename Period>
+		static inline void execute(const std::chrono::duration<RepT, Period> &dur) {
+			executeUntil(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(dur));
+		}
+
 		// get the id of the main thread.
 		// start() must have completed before calling.
 		static inline std::thread::id mainThreadID() {
@@ -369,6 +1147,952 @@ namespace ambition {
 			enqueue(mainThreadID(), f);
 		}
 
+		// add a task to the 'main' thread, declaring roughly how long it takes to run
+		static inline void enqueueMain(const task_t &f, std::chrono::nanoseconds cost) {
+			assert(m_started && "AsyncExecutor not started");
+			main_task_t mt;
+			mt.step = [f] { f(); return false; };
+			mt.cost = cost;
+			submitMain(std::move(mt));
+		}
+
+		// add a task to the 'main' thread, recording stats under a tag and learning its cost from them
+		static inline void enqueueMain(task_stats *tag, const task_t &f) {
+			enqueueMainSliced(tag, [f] { f(); return false; });
+		}
+
+		// add a task to the 'main' thread that is called repeatedly until it returns false.
+		// each call should do a small, similar amount of work, so the cost learned per call is meaningful;
+		// a task can be resumed in a later execute() if it runs out of time.
+		// wait time is recorded up to the first call, run time and the cost estimate for each call.
+		static inline void enqueueMainSliced(task_stats *tag, const slice_task_t &f, std::chrono::nanoseconds cost = std::chrono::nanoseconds(0)) {
+			assert(m_started && "AsyncExecutor not started");
+			main_task_t mt;
+			mt.step = f;
+			mt.tag = tag;
+			mt.cost = cost;
+			submitMain(std::move(mt));
+		}
+
+		// add a task to the main thread or the worker pool
+		static inline void enqueueOn(target_t target, const task_t &f) {
+			switch (target) {
+			case main:
+				enqueueMain(f);
+				break;
+			case fast:
+				enqueueFast(f);
+				break;
+			default:
+				enqueueSlow(f);
+			}
+		}
+
+		// dispatcher for Event<T> that runs observers on the main thread or the worker pool
+		static inline std::function<void(const task_t &)> dispatcher(target_t target) {
+			return [target](const task_t &f) { enqueueOn(target, f); };
+		}
+
+		// run a function on the main thread or the worker pool, returning a future for its result
+		template <typename FuncT>
+		static task_future<typename std::result_of<FuncT()>::type> async(target_t target, FuncT f);
+
+		// run a task on the main thread or the worker pool after a delay (rounded up to the next ms).
+		// returns a handle for cancel().
+		template <typename RepT, typename Period>
+		static inline timer_wheel::handle_t scheduleAfter(const std::chrono::duration<RepT, Period> &delay, target_t target, const task_t &f) {
+			auto d = std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+			return schedule(std::chrono::steady_clock::now() + d, std::chrono::steady_clock::duration(0), target, f);
+		}
+
+		// run a task on the main thread or the worker pool every period, starting one period from now.
+		// a firing is skipped if the previous one is still waiting to run, so a busy target doesn't pile them up.
+		template <typename RepT, typename Period>
+		static inline timer_wheel::handle_t scheduleEvery(const std::chrono::duration<RepT, Period> &period, target_t target, const task_t &f) {
+			auto d = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+			return schedule(std::chrono::steady_clock::now() + d, d, target, f);
+		}
+
+		// stop a timer from firing again. a firing that has already started may still be running.
+		// returns false if the timer had already fired for the last time (or was already cancelled).
+		static bool cancel(const timer_wheel::handle_t &h);
+
+		// number of timers waiting to fire
+		static size_t timerCount();
+
+		// get the stats for a tag, creating them if needed.
+		// the pointer stays valid forever, so look it up once and keep it.
+		static task_stats * stats(const std::string &tag);
+
+		// wrap a task so its wait and run times are recorded under a tag.
+		// submit the result straight away, as waiting is timed from this call.
+		static inline task_t tagged(task_stats *tag, const task_t &f) {
+			tag->submitted++;
+			auto time0 = std::chrono::steady_clock::now();
+			return [=] {
+				auto time1 = std::chrono::steady_clock::now();
+				tag->wait.record(time1 - time0);
+				try {
+					f();
+				} catch (...) {
+					tag->run.record(std::chrono::steady_clock::now() - time1);
+					tag->failed++;
+					throw;
+				}
+				tag->run.record(std::chrono::steady_clock::now() - time1);
+				tag->completed++;
+			};
+		}
+
+		static inline task_t tagged(const std::string &tag, const task_t &f) {
+			return tagged(stats(tag), f);
+		}
+
+		// number of tasks waiting in the worker pool
+		static inline int poolQueueDepth() {
+			return std::max(0, int(m_pending));
+		}
+
+		// number of tasks waiting for the main thread to call execute()
+		static inline int mainQueueDepth() {
+			return std::max(0, int(m_main_pending));
+		}
+
+		// write a summary of all tagged task stats and queue depths to the log
+		static void logStats(unsigned verbosity = 2);
+
+		// all tagged task stats and queue depths as a JSON object; durations are in microseconds
+		static std::string statsJSON();
+
+	};
+
+	class task_cancelled : public std::runtime_error {
+	public:
+		task_cancelled() : runtime_error("task cancelled") {};
+	};
+
+	// shared state behind a task_future.
+	// every stage of a chain (task, continuation or when_all) is exactly one of these,
+	// allocated once; results are moved from one stage's state into the next.
+	class future_state_base : public std::enable_shared_from_this<future_state_base>, private Uncopyable {
+	public:
+		enum status_t {
+			pending,
+			running,
+			ready,
+			failed,
+			cancelled
+		};
+
+	private:
+		mutable std::mutex m_mutex;
+		mutable std::condition_variable m_cond;
+		status_t m_status = pending;
+		std::exception_ptr m_error;
+		// the one stage waiting on this one; released once notified
+		std::shared_ptr<future_state_base> m_next;
+		// the stages this one is waiting on; only kept so cancellation can travel upstream
+		std::vector<std::shared_ptr<future_state_base>> m_parents;
+
+		inline bool settled(status_t s) const {
+			return s != pending && s != running;
+		}
+
+		// returns false if this state had already settled (or wasn't pending, if only_pending)
+		inline bool settle(status_t s, std::exception_ptr e, bool only_pending) {
+			std::shared_ptr<future_state_base> next;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (settled(m_status) || (only_pending && m_status != pending)) return false;
+				m_status = s;
+				m_error = e;
+				next = std::move(m_next);
+				m_parents.clear();
+			}
+			m_cond.notify_all();
+			if (next) next->parent_settled();
+			return true;
+		}
+
+	protected:
+		inline future_state_base() { }
+
+		// called (once per parent) when a parent stage settles
+		virtual void parent_settled() { }
+
+		// move from pending to running; false if cancelled
+		inline bool begin() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_status != pending) return false;
+			m_status = running;
+			m_parents.clear();
+			return true;
+		}
+
+		inline void finish() {
+			settle(ready, nullptr, false);
+		}
+
+		inline void fail(std::exception_ptr e) {
+			settle(failed, e, false);
+		}
+
+		// settle as cancelled because a parent was
+		inline void abandon() {
+			settle(cancelled, nullptr, false);
+		}
+
+	public:
+		inline status_t status() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_status;
+		}
+
+		inline std::exception_ptr error() const {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_error;
+		}
+
+		// block until settled
+		inline void wait() const {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while (!settled(m_status)) {
+				// if this thread is interrupted while waiting, this will throw
+				InterruptManager::wait(m_cond, lock);
+			}
+		}
+
+		inline void addParent(std::shared_ptr<future_state_base> parent) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_parents.push_back(std::move(parent));
+		}
+
+		// set the stage to be told when this one settles (immediately, if it already has)
+		inline void attach(std::shared_ptr<future_state_base> next) {
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				assert(!m_next && "future already has a continuation");
+				if (!settled(m_status)) {
+					m_next = std::move(next);
+					return;
+				}
+			}
+			next->parent_settled();
+		}
+
+		// cancel this stage if it hasn't started, and any upstream stages that haven't either.
+		// returns true if this stage will now never run.
+		inline bool cancel() {
+			std::vector<std::shared_ptr<future_state_base>> parents;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_status != pending) return m_status == cancelled;
+				parents = m_parents;
+			}
+			if (!settle(cancelled, nullptr, true)) return status() == cancelled;
+			for (auto &p : parents) {
+				p->cancel();
+			}
+			return true;
+		}
+
+		virtual ~future_state_base() { }
+	};
+
+	// in-place storage for a future's result, so no allocation beyond the state itself
+	template <typename T>
+	class future_value : private Uncopyable {
+	private:
+		typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type m_storage;
+		bool m_set = false;
+
+	public:
+		inline future_value() { }
+
+		template <typename U>
+		inline void set(U &&u) {
+			assert(!m_set);
+			new (&m_storage) T(std::forward<U>(u));
+			m_set = true;
+		}
+
+		// move the result out; can only be done once
+		inline T take() {
+			assert(m_set && "future result already taken");
+			T *p = reinterpret_cast<T *>(&m_storage);
+			T t(std::move(*p));
+			p->~T();
+			m_set = false;
+			return t;
+		}
+
+		inline ~future_value() {
+			if (m_set) reinterpret_cast<T *>(&m_storage)->~T();
+		}
+	};
+
+	template <>
+	class future_value<void> {
+	public:
+		inline void set() { }
+		inline void take() { }
+	};
+
+	template <typename T>
+	class future_state : public future_state_base {
+	public:
+		future_value<T> value;
+	};
+
+	// call a function and store its result (if any)
+	template <typename R>
+	struct future_invoke {
+		template <typename FuncT, typename... ArgTR>
+		static inline void go(future_value<R> &v, FuncT &f, ArgTR &&...args) {
+			v.set(f(std::forward<ArgTR>(args)...));
+		}
+	};
+
+	template <>
+	struct future_invoke<void> {
+		template <typename FuncT, typename... ArgTR>
+		static inline void go(future_value<void> &, FuncT &f, ArgTR &&...args) {
+			f(std::forward<ArgTR>(args)...);
+		}
+	};
+
+	// call a continuation with the (moved) result of its parent
+	template <typename T>
+	struct future_continue {
+		template <typename R, typename FuncT>
+		static inline void go(future_value<R> &v, FuncT &f, future_state<T> &parent) {
+			future_invoke<R>::go(v, f, parent.value.take());
+		}
+	};
+
+	template <>
+	struct future_continue<void> {
+		template <typename R, typename FuncT>
+		static inline void go(future_value<R> &v, FuncT &f, future_state<void> &) {
+			future_invoke<R>::go(v, f);
+		}
+	};
+
+	template <typename T, typename FuncT>
+	struct future_continuation_result {
+		using type = typename std::result_of<FuncT(T)>::type;
+	};
+
+	template <typename FuncT>
+	struct future_continuation_result<void, FuncT> {
+		using type = typename std::result_of<FuncT()>::type;
+	};
+
+	// stage that runs a function with no inputs
+	template <typename R, typename FuncT>
+	class task_state : public future_state<R> {
+	private:
+		FuncT m_func;
+
+	public:
+		inline explicit task_state(FuncT f) : m_func(std::move(f)) { }
+
+		inline void run() {
+			if (!this->begin()) return;
+			try {
+				future_invoke<R>::go(this->value, m_func);
+			} catch (...) {
+				this->fail(std::current_exception());
+				return;
+			}
+			this->finish();
+		}
+	};
+
+	// stage that runs a function on the result of another stage
+	template <typename T, typename R, typename FuncT>
+	class continuation_state : public future_state<R> {
+	private:
+		std::shared_ptr<future_state<T>> m_parent;
+		AsyncExecutor::target_t m_target;
+		FuncT m_func;
+
+		inline void run() {
+			if (!this->begin()) {
+				m_parent.reset();
+				return;
+			}
+			try {
+				future_continue<T>::go(this->value, m_func, *m_parent);
+			} catch (...) {
+				m_parent.reset();
+				this->fail(std::current_exception());
+				return;
+			}
+			m_parent.reset();
+			this->finish();
+		}
+
+	protected:
+		virtual void parent_settled() override {
+			switch (m_parent->status()) {
+			case future_state_base::ready:
+			{
+				auto self = std::static_pointer_cast<continuation_state>(this->shared_from_this());
+				AsyncExecutor::enqueueOn(m_target, [self] { self->run(); });
+				break;
+			}
+			case future_state_base::failed:
+				this->fail(m_parent->error());
+				m_parent.reset();
+				break;
+			default:
+				this->abandon();
+				m_parent.reset();
+			}
+		}
+
+	public:
+		inline continuation_state(std::shared_ptr<future_state<T>> parent_, AsyncExecutor::target_t target_, FuncT f) :
+			m_parent(std::move(parent_)), m_target(target_), m_func(std::move(f)) { }
+	};
+
+	// collects the results of several stages, in order
+	template <typename T>
+	struct when_all_collect {
+		using result_t = std::vector<T>;
+
+		static inline void go(future_value<result_t> &v, std::vector<std::shared_ptr<future_state<T>>> &inputs) {
+			result_t r;
+			r.reserve(inputs.size());
+			for (auto &in : inputs) {
+				r.push_back(in->value.take());
+			}
+			v.set(std::move(r));
+		}
+	};
+
+	template <>
+	struct when_all_collect<void> {
+		using result_t = void;
+
+		static inline void go(future_value<void> &, std::vector<std::shared_ptr<future_state<void>>> &) { }
+	};
+
+	// stage that settles once all of its inputs have.
+	// runs inline on whichever thread settles the last input.
+	template <typename T>
+	class when_all_state : public future_state<typename when_all_collect<T>::result_t> {
+	private:
+		std::vector<std::shared_ptr<future_state<T>>> m_inputs;
+		std::atomic<size_t> m_remaining;
+
+	protected:
+		virtual void parent_settled() override {
+			if (--m_remaining > 0) return;
+			if (!this->begin()) {
+				m_inputs.clear();
+				return;
+			}
+			for (auto &in : m_inputs) {
+				if (in->status() == future_state_base::failed) {
+					this->fail(in->error());
+					m_inputs.clear();
+					return;
+				}
+			}
+			for (auto &in : m_inputs) {
+				if (in->status() != future_state_base::ready) {
+					this->abandon();
+					m_inputs.clear();
+					return;
+				}
+			}
+			when_all_collect<T>::go(this->value, m_inputs);
+			m_inputs.clear();
+			this->finish();
+		}
+
+	public:
+		inline explicit when_all_state(std::vector<std::shared_ptr<future_state<T>>> inputs_) :
+			m_inputs(std::move(inputs_)), m_remaining(m_inputs.size()) { }
+
+		// hook up to the inputs; must be done once the state is owned by a shared_ptr
+		inline void start() {
+			if (m_inputs.empty()) {
+				m_remaining = 1;
+				parent_settled();
+				return;
+			}
+			// copy, as the last attach may settle this stage and clear m_inputs
+			auto inputs = m_inputs;
+			for (auto &in : inputs) {
+				this->addParent(in);
+			}
+			for (auto &in : inputs) {
+				in->attach(this->shared_from_this());
+			}
+		}
+	};
+
+	// handle to the eventual result of a task run through AsyncExecutor.
+	// results are moved along a chain, so get() and then_on() each consume the result,
+	// and a future can have at most one continuation.
+	template <typename T>
+	class task_future {
+		template <typename U>
+		friend task_future<typename when_all_collect<U>::result_t> when_all(std::vector<task_future<U>>);
+
+	private:
+		std::shared_ptr<future_state<T>> m_state;
+
+	public:
+		inline task_future() { }
+
+		inline explicit task_future(std::shared_ptr<future_state<T>> state_) : m_state(std::move(state_)) { }
+
+		inline bool valid() const {
+			return bool(m_state);
+		}
+
+		// true once the result (or failure, or cancellation) is available
+		inline bool ready() const {
+			auto s = m_state->status();
+			return s != future_state_base::pending && s != future_state_base::running;
+		}
+
+		inline bool cancelled() const {
+			return m_state->status() == future_state_base::cancelled;
+		}
+
+		// block until ready.
+		// don't do this on the main thread for anything that needs the main thread to finish.
+		inline void wait() const {
+			m_state->wait();
+		}
+
+		// wait for and take the result.
+		// rethrows the task's exception if it failed, or throws task_cancelled.
+		inline T get() {
+			m_state->wait();
+			switch (m_state->status()) {
+			case future_state_base::failed:
+				std::rethrow_exception(m_state->error());
+			case future_state_base::cancelled:
+				throw task_cancelled();
+			default:
+				break;
+			}
+			return m_state->value.take();
+		}
+
+		// stop this stage and everything upstream of it that hasn't started yet.
+		// returns true if this stage will now never run.
+		inline bool cancel() {
+			return m_state->cancel();
+		}
+
+		// run f on target with the result of this future once it is ready.
+		// failure and cancellation pass straight through to the returned future without calling f.
+		template <typename FuncT>
+		inline task_future<typename future_continuation_result<T, FuncT>::type> then_on(AsyncExecutor::target_t target, FuncT f) {
+			using result_t = typename future_continuation_result<T, FuncT>::type;
+			using state_t = continuation_state<T, result_t, FuncT>;
+			auto next = std::make_shared<state_t>(m_state, target, std::move(f));
+			next->addParent(m_state);
+			m_state->attach(next);
+			return task_future<result_t>(next);
+		}
+	};
+
+	// future that becomes ready once all the given futures are, with their results in order
+	template <typename T>
+	inline task_future<typename when_all_collect<T>::result_t> when_all(std::vector<task_future<T>> futures) {
+		std::vector<std::shared_ptr<future_state<T>>> inputs;
+		for (auto &f : futures) {
+			inputs.push_back(f.m_state);
+		}
+		auto state = std::make_shared<when_all_state<T>>(std::move(inputs));
+		state->start();
+		return task_future<typename when_all_collect<T>::result_t>(state);
+	}
+
+	template <typename FuncT>
+	inline task_future<typename std::result_of<FuncT()>::type> AsyncExecutor::async(target_t target, FuncT f) {
+		using result_t = typename std::result_of<FuncT()>::type;
+		auto state = std::make_shared<task_state<result_t, FuncT>>(std::move(f));
+		enqueueOn(target, [state] { state->run(); });
+		return task_future<result_t>(state);
+	}
+
+	// splits a loop into numbered chunks that the calling thread and idle pool workers take in turn.
+	// the caller always works too, so this is safe to use from inside pool tasks.
+	class parallel_chunks : private Uncopyable {
+	private:
+		std::atomic<size_t> m_next { 0 };
+		std::atomic<size_t> m_done { 0 };
+		std::atomic<bool> m_failed { false };
+		size_t m_count;
+		std::mutex m_mutex;
+		// signalled when the last chunk is done
+		std::condition_variable m_cond;
+		std::exception_ptr m_error;
+
+		// take chunks and call func(chunk) on them until there are none left
+		template <typename FuncT>
+		inline void work(FuncT &func) {
+			for (size_t c = m_next++; c < m_count; c = m_next++) {
+				// once something has thrown, just count off the rest
+				if (!m_failed) {
+					try {
+						func(c);
+					} catch (...) {
+						std::lock_guard<std::mutex> lock(m_mutex);
+						if (!m_error) m_error = std::current_exception();
+						m_failed = true;
+					}
+				}
+				if (++m_done == m_count) {
+					// under the lock, so the waiter can't check and then miss this
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_cond.notify_all();
+				}
+			}
+		}
+
+	public:
+		inline explicit parallel_chunks(size_t count_) : m_count(count_) { }
+
+		// call func(chunk) for every chunk in [0, count), in parallel, and wait for them all.
+		// if func throws, chunks that haven't started are skipped and the first exception is rethrown.
+		template <typename FuncT>
+		static inline void run(size_t count, FuncT func) {
+			if (count == 0) return;
+			auto chunks = std::make_shared<parallel_chunks>(count);
+			// helpers keep the chunk counter alive, but only touch func while there are chunks left,
+			// and we don't return until every chunk is done
+			FuncT *pfunc = &func;
+			size_t helpers = std::min<size_t>(AsyncExecutor::workerCount(), count - 1);
+			for (size_t i = 0; i < helpers; i++) {
+				AsyncExecutor::enqueueFast([chunks, pfunc] { chunks->work(*pfunc); });
+			}
+			chunks->work(func);
+			// every chunk has been taken by now, so this only waits for the ones helpers are
+			// still running, which need nothing from this thread
+			std::unique_lock<std::mutex> lock(chunks->m_mutex);
+			chunks->m_cond.wait(lock, [&] { return chunks->m_done == count; });
+			if (chunks->m_error) std::rethrow_exception(chunks->m_error);
+		}
+
+		// a grain size giving a few chunks per thread
+		static inline int defaultGrain(int n) {
+			return std::max(1, n / int(4 * (AsyncExecutor::workerCount() + 1)));
+		}
+	};
+
+	// call func(i) for every i in [begin, end) in parallel, in chunks of grain indices (0 to choose).
+	template <typename FuncT>
+	inline void parallel_for(int begin, int end, FuncT func, int grain = 0) {
+		if (end <= begin) return;
+		if (grain <= 0) grain = parallel_chunks::defaultGrain(end - begin);
+		parallel_chunks::run((end - begin + grain - 1) / grain, [&](size_t c) {
+			int i0 = begin + int(c) * grain;
+			int i1 = std::min(end, i0 + grain);
+			for (int i = i0; i < i1; i++) {
+				func(i);
+			}
+		});
+	}
+
+	// call func(x, y) for every x in [x0, x1) and y in [y0, y1) in parallel, in tiles of tile_x by tile_y (0 to choose).
+	// each tile is visited row by row.
+	template <typename FuncT>
+	inline void parallel_for_2d(int x0, int x1, int y0, int y1, FuncT func, int tile_x = 0, int tile_y = 0) {
+		if (x1 <= x0 || y1 <= y0) return;
+		// default to whole rows, split only as far as needed
+		if (tile_x <= 0) tile_x = x1 - x0;
+		if (tile_y <= 0) tile_y = parallel_chunks::defaultGrain(y1 - y0);
+		int tiles_x = (x1 - x0 + tile_x - 1) / tile_x;
+		int tiles_y = (y1 - y0 + tile_y - 1) / tile_y;
+		parallel_chunks::run(size_t(tiles_x) * size_t(tiles_y), [&](size_t c) {
+			int tx0 = x0 + int(c % tiles_x) * tile_x;
+			int ty0 = y0 + int(c / tiles_x) * tile_y;
+			int tx1 = std::min(x1, tx0 + tile_x);
+			int ty1 = std::min(y1, ty0 + tile_y);
+			for (int y = ty0; y < ty1; y++) {
+				for (int x = tx0; x < tx1; x++) {
+					func(x, y);
+				}
+			}
+		});
+	}
+
+	// reduce map(i) for i in [begin, end) with combine(a, b), in parallel, in chunks of grain indices (0 to choose).
+	// each chunk is folded from identity in index order, then the chunk results are folded in order,
+	// so combine only needs to be associative.
+	template <typename T, typename MapT, typename CombineT>
+	inline T parallel_reduce(int begin, int end, const T &identity, MapT map, CombineT combine, int grain = 0) {
+		if (end <= begin) return identity;
+		if (grain <= 0) grain = parallel_chunks::defaultGrain(end - begin);
+		// each chunk writes its own element from its own thread, so these must not share
+		// storage (as std::vector<bool> does) and are kept on separate cache lines
+		struct partial_t {
+			T value;
+			char pad[64];
+		};
+		std::vector<partial_t> partials((end - begin + grain - 1) / grain, partial_t { identity, { } });
+		parallel_chunks::run(partials.size(), [&](size_t c) {
+			int i0 = begin + int(c) * grain;
+			int i1 = std::min(end, i0 + grain);
+			T acc = identity;
+			for (int i = i0; i < i1; i++) {
+				acc = combine(acc, map(i));
+			}
+			partials[c].value = acc;
+		});
+		T r = identity;
+		for (const partial_t &p : partials) {
+			r = combine(r, p.value);
+		}
+		return r;
+	}
+
+	// runs keyed background requests in priority order (highest first).
+	// intended for work whose usefulness changes every frame, like terrain generation:
+	// - request() for a key that is already queued or running is dropped as a duplicate
+	// - queued requests are refreshed with a new priority every frame they are still wanted
+	// - update() (once per frame, on the thread that makes requests) cancels queued requests
+	//   that weren't refreshed since the last update(), then fills any free pool slots
+	// only a few requests are handed to the pool at a time, so the rest can still be
+	// reordered or cancelled before they start.
+	template <typename KeyT>
+	class priority_scheduler : private Uncopyable {
+	public:
+		using task_t = AsyncExecutor::task_t;
+
+	private:
+		struct request_t {
+			double priority;
+			unsigned long generation;
+			task_t task;
+			task_t on_cancel;
+		};
+
+		std::mutex m_mutex;
+		// signalled when the last running request finishes
+		std::condition_variable m_idle;
+		std::map<KeyT, request_t> m_queued;
+		std::set<KeyT> m_running;
+		unsigned long m_generation = 0;
+		unsigned m_max_running;
+		AsyncExecutor::target_t m_target;
+		task_stats *m_tag;
+		unsigned long m_cancelled = 0;
+
+		inline unsigned maxRunning() const {
+			return m_max_running ? m_max_running : AsyncExecutor::slowWorkerCount();
+		}
+
+		// m_mutex must be locked
+		inline void dispatch() {
+			while (m_running.size() < maxRunning() && !m_queued.empty()) {
+				auto best = m_queued.begin();
+				for (auto it = m_queued.begin(); it != m_queued.end(); ++it) {
+					if (it->second.priority > best->second.priority) best = it;
+				}
+				KeyT key = best->first;
+				task_t task = std::move(best->second.task);
+				m_queued.erase(best);
+				m_running.insert(key);
+				if (m_tag) task = AsyncExecutor::tagged(m_tag, task);
+				AsyncExecutor::enqueueOn(m_target, [this, key, task] {
+					try {
+						task();
+					} catch (...) {
+						finished(key);
+						throw;
+					}
+					finished(key);
+				});
+			}
+		}
+
+		inline void finished(const KeyT &key) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running.erase(key);
+			dispatch();
+			// under the lock, so the destructor can't wake and free this first
+			if (m_running.empty()) m_idle.notify_all();
+		}
+
+	public:
+		// max_running == 0 allows one running request per worker that may run slow tasks,
+		// so requests never wait on each other for a worker and never take the one kept for fast tasks.
+		// if tag is given, requests are recorded under it from when they are handed to the pool.
+		inline explicit priority_scheduler(AsyncExecutor::target_t target_ = AsyncExecutor::slow, unsigned max_running_ = 0, task_stats *tag_ = nullptr) :
+			m_max_running(max_running_), m_target(target_), m_tag(tag_) { }
+
+		// running requests call back into the scheduler when they finish, so they are waited for
+		// (the executor must still be running); queued ones are dropped without on_cancel.
+		inline ~priority_scheduler() {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_queued.clear();
+			m_idle.wait(lock, [this] { return m_running.empty(); });
+		}
+
+		// queue a request, or refresh its priority if already queued.
+		// on_cancel is called from update() if the request goes stale before it starts.
+		// returns false if the request was a duplicate.
+		inline bool request(const KeyT &key, double priority, const task_t &task, const task_t &on_cancel = task_t()) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_running.count(key)) return false;
+			auto it = m_queued.find(key);
+			if (it != m_queued.end()) {
+				it->second.priority = priority;
+				it->second.generation = m_generation;
+				return false;
+			}
+			request_t &r = m_queued[key];
+			r.priority = priority;
+			r.generation = m_generation;
+			r.task = task;
+			r.on_cancel = on_cancel;
+			return true;
+		}
+
+		// refresh the priority of a queued request.
+		// returns false if the key isn't queued (it may be running already).
+		inline bool refresh(const KeyT &key, double priority) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_queued.find(key);
+			if (it == m_queued.end()) return false;
+			it->second.priority = priority;
+			it->second.generation = m_generation;
+			return true;
+		}
+
+		// cancel a queued request; returns false if it isn't queued.
+		// on_cancel is not called.
+		inline bool cancel(const KeyT &key) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_queued.erase(key) > 0;
+		}
+
+		// drop stale requests and start the best remaining ones.
+		// call once per frame, after all of the frame's requests/refreshes.
+		inline void update() {
+			std::vector<task_t> cancelled;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				for (auto it = m_queued.begin(); it != m_queued.end(); ) {
+					if (it->second.generation != m_generation) {
+						if (it->second.on_cancel) cancelled.push_back(std::move(it->second.on_cancel));
+						it = m_queued.erase(it);
+						m_cancelled++;
+					} else {
+						++it;
+					}
+				}
+				m_generation++;
+				dispatch();
+			}
+			// outside the lock, in case these make new requests
+			for (auto &f : cancelled) {
+				f();
+			}
+		}
+
+		inline size_t queued() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_queued.size();
+		}
+
+		inline size_t running() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_running.size();
+		}
+
+		// total number of requests dropped as stale
+		inline unsigned long cancelledCount() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_cancelled;
+		}
+	};
+
+	// a fixed graph of tasks with dependencies, run as a whole (e.g. once per frame).
+	// nodes start as soon as all their dependencies have finished, so independent nodes overlap.
+	// 'main' nodes run on the thread that calls run(); the rest go to the worker pool.
+	// every node is timed, so the critical path of the last run can be inspected.
+	class TaskGraph : private Uncopyable {
+	public:
+		using task_t = AsyncExecutor::task_t;
+		using node_t = unsigned;
+		using duration_t = std::chrono::duration<double, std::milli>;
+
+		struct timing_t {
+			// relative to the start of run()
+			duration_t start;
+			duration_t duration;
+		};
+
+	private:
+		struct node_data_t {
+			std::string name;
+			AsyncExecutor::target_t target;
+			task_t task;
+			std::vector<node_t> dependencies;
+			std::vector<node_t> dependents;
+			std::atomic<unsigned> waiting_on { 0 };
+			timing_t timing;
+		};
+
+		std::vector<std::unique_ptr<node_data_t>> m_nodes;
+
+		// state for the current run
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::deque<node_t> m_main_ready;
+		size_t m_remaining = 0;
+		std::exception_ptr m_error;
+		std::atomic<bool> m_failed { false };
+		std::chrono::steady_clock::time_point m_time0;
+		duration_t m_total { 0 };
+
+		void dispatch(node_t node);
+		void execute(node_t node);
+
+	public:
+		inline TaskGraph() { }
+
+		// add a node; dependencies must already be in the graph, so it can't have cycles
+		node_t add(const std::string &name, AsyncExecutor::target_t target, const task_t &task, std::initializer_list<node_t> dependencies = {});
+
+		// run every node once and wait for them all.
+		// if a node throws, nodes that haven't started yet are skipped and the first exception is rethrown.
+		// not reentrant; don't call from a pool worker.
+		void run();
+
+		inline size_t size() const {
+			return m_nodes.size();
+		}
+
+		inline const std::string & name(node_t node) const {
+			return m_nodes[node]->name;
+		}
+
+		// timing of a node during the last run
+		inline const timing_t & timing(node_t node) const {
+			return m_nodes[node]->timing;
+		}
+
+		// wall time of the last run
+		inline duration_t totalTime() const {
+			return m_total;
+		}
+
+		// the chain of nodes that determined how long the last run took, first to last
+		std::vector<node_t> criticalPath() const;
+
 	};
 
 }
@@ -15,7 +15,11 @@ namespace ambition {
 			neterr_not_connected,
 			neterr_lost_connection,
 			neterr_already_connected,
-			neterr_packet_id_not_found
+			neterr_packet_id_not_found,
+			neterr_decompress_failure,
+			neterr_bad_frame,
+			neterr_reactor_failure,
+			neterr_listen_failure
 		};
 	}
 	class network_error : public std::runtime_error {
@@ -0,0 +1,136 @@
+/*
+ * Length-prefixed framing for stream sockets. TCP is free to merge and split writes, so every
+ * message goes on the wire behind its length and the receiving end puts frames back together.
+ *
+ * Writing several frames into one buffer (or chain) sends them all with one call.
+ */
+
+#ifndef FRAMING_HPP
+#define FRAMING_HPP
+
+#include <cstdint>
+
+#include <ambition/ByteBuffer.hpp>
+#include <ambition/Error.hpp>
+
+namespace ambition {
+
+	// how a frame's length is written in front of it
+	enum class frame_prefix {
+		// LEB128, 1 byte for frames under 128 bytes
+		varint,
+		// 4 bytes, big endian
+		fixed32
+	};
+
+	inline void write_frame_header(byte_buffer &out, size_t size, frame_prefix prefix) {
+		if (prefix == frame_prefix::varint) {
+			out << varint<uint64_t>(size);
+		} else {
+			out << uint32_t(size);
+		}
+	}
+
+	// append one frame; call repeatedly to batch frames into one send
+	inline void write_frame(byte_buffer &out, byte_view payload, frame_prefix prefix = frame_prefix::varint) {
+		write_frame_header(out, payload.size(), prefix);
+		out.add_array(payload.data(), payload.size());
+	}
+
+	// append one frame without copying the payload
+	inline void write_frame(byte_chain &out, byte_slice payload, frame_prefix prefix = frame_prefix::varint) {
+		byte_buffer header;
+		write_frame_header(header, payload.size(), prefix);
+		out << std::move(header) << std::move(payload);
+	}
+
+	// splits a received byte stream back into frames. frames that arrive whole are handed out as
+	// slices of the received data; only a frame split across reads is copied, into a buffer that is
+	// carried over to the next read. not thread-safe: use one per connection.
+	class frame_reader {
+	private:
+		frame_prefix m_prefix;
+		size_t m_max_frame_size;
+		// the unfinished frame, prefix included
+		byte_buffer m_partial;
+
+		// parses a prefix at the start of v. returns false if v doesn't hold all of it yet;
+		// throws network_error (neterr_bad_frame) if it is malformed or too large
+		inline bool header(byte_view v, size_t &header_size, size_t &frame_size) const {
+			uint64_t size = 0;
+			if (m_prefix == frame_prefix::varint) {
+				size_t i = 0;
+				for (;; i++) {
+					if (i == v.size()) return false;
+					// a 10th byte may only carry bit 63
+					if (i == 10 || (i == 9 && (v[i] & 0x7E))) throw network_error(error::neterr_bad_frame, "Malformed frame length");
+					size |= uint64_t(v[i] & 0x7F) << (7 * i);
+					if (!(v[i] & 0x80)) break;
+				}
+				header_size = i + 1;
+			} else {
+				if (v.size() < 4) return false;
+				size = byte_buffer::reader(v).get<uint32_t>();
+				header_size = 4;
+			}
+			if (size > m_max_frame_size) throw network_error(error::neterr_bad_frame, "Frame too large");
+			frame_size = size_t(size);
+			return true;
+		}
+
+	public:
+		inline explicit frame_reader(frame_prefix prefix_ = frame_prefix::varint, size_t max_frame_size_ = 1 << 24) :
+			m_prefix(prefix_), m_max_frame_size(max_frame_size_) { }
+
+		// calls on_frame(const byte_slice &) for every frame completed by in, which may be none or many.
+		// returns the number of frames.
+		template <typename FuncT>
+		inline size_t feed(const byte_slice &in, FuncT on_frame) {
+			const byte_view data = in.view();
+			size_t frames = 0;
+			size_t pos = 0;
+			size_t header_size, frame_size;
+
+			if (m_partial.size()) {
+				// the prefix itself may have been split; take it a byte at a time
+				while (!header(m_partial.view(), header_size, frame_size)) {
+					if (pos == data.size()) return frames;
+					m_partial << data[pos++];
+				}
+				m_partial.reserve(header_size + frame_size);
+				size_t want = header_size + frame_size - m_partial.size();
+				size_t take = std::min(want, data.size() - pos);
+				m_partial.add_array(data.data() + pos, take);
+				pos += take;
+				if (take < want) return frames;
+				on_frame(m_partial.release().slice(header_size));
+				frames++;
+			}
+
+			while (pos < data.size()) {
+				if (!header(data.slice(pos), header_size, frame_size)) break;
+				if (data.size() - pos - header_size < frame_size) break;
+				on_frame(in.slice(pos + header_size, frame_size));
+				pos += header_size + frame_size;
+				frames++;
+			}
+
+			if (pos < data.size()) {
+				m_partial.add_array(data.data() + pos, data.size() - pos);
+			}
+			return frames;
+		}
+
+		// bytes held over from an unfinished frame
+		inline size_t pending() const {
+			return m_partial.size();
+		}
+
+		inline void reset() {
+			m_partial.clear();
+		}
+	};
+
+}
+
+#endif
@@ -5,18 +5,13 @@
 
 namespace ambition {
 	class http_result {
-		const byte_t *body_i;
-		std::string body_i_s;
+		// shares the received data rather than copying it
+		byte_slice body_i;
 	public:
-		http_result(const byte_t* b, size_t sz) {
-			std::cout << __LINE__ << std::endl;
-			//memcpy(body_i, b, sz); // the fuck are you doing with an unitialized pointer?
-			body_i = b;
-			body_i_s = std::string(reinterpret_cast<const char *>(body_i), sz);
-			std::cout << __LINE__ << std::endl;
-		}
-		const byte_t* body() { return body_i; }
-		std::string body_s() { return body_i_s; }
+		http_result(const byte_slice &b) : body_i(b) { }
+		const byte_t* body() { return body_i.data(); }
+		size_t body_size() { return body_i.size(); }
+		std::string body_s() { return std::string(reinterpret_cast<const char *>(body_i.data()), body_i.size()); }
 	};
 
 
@@ -27,9 +22,9 @@ namespace ambition {
 		Event<http_result> on_complete;
 
 		virtual std::string generate_request() const =0;
-		void complete_request(const byte_t* data, size_t sz) {
+		void complete_request(const byte_slice &data) {
 			std::cout << __LINE__ << std::endl;
-			result = new http_result(data, sz);
+			result = new http_result(data);
 			std::cout << __LINE__ << std::endl;
 			on_complete.notify(*result);
 			std::cout << __LINE__ << std::endl;
@@ -70,7 +65,7 @@ namespace ambition {
 			//byte_t* data = new byte_t(r.size()); // this was the main problem: () instead of []
 			//r.get_array(data, r.size());
 			std::cout << __LINE__ << std::endl;
-			current_request->complete_request(sr.data.data(), sr.data.size());
+			current_request->complete_request(sr.data);
 			std::cout << __LINE__ << std::endl;
 			return false;
 		}
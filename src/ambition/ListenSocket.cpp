@@ -1,11 +1,15 @@
 #include "ListenSocket.hpp"
 #include "Log.hpp"
 #include "Error.hpp"
+#include "Reactor.hpp"
 
 
+#include <algorithm>
+#include <memory>
 #include <thread>
-#include <cstdio>
 #include <cstring>
+#include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #include <winsock.h>
@@ -19,67 +23,62 @@ using SOCKET = int;
 #include <sys/socket.h>
 #include <errno.h>
 #include <netinet/in.h>
-#define FD_CLR_F FD_CLR
-#define FD_SET_F FD_SET
 #define	closesocket(i) close(i)
 #endif
 
 namespace ambition {
 
-	#ifdef _WIN32
-		#define FD_CLR_F(fd, set) u_int __i; \
-		for (__i = 0; __i < ((fd_set FAR *)(set))->fd_count; __i++) { \
-		if (((fd_set FAR *)(set))->fd_array[__i] == fd) { \
-			while (__i < ((fd_set FAR *)(set))->fd_count - 1) {	\
-				((fd_set FAR *)(set))->fd_array[__i] = \
-				((fd_set FAR *)(set))->fd_array[__i + 1]; \
-				__i++; \
-			} \
-			((fd_set FAR *)(set))->fd_count--; \
-			break; \
-		} \
+	namespace {
+		// closes the listener that failed to open
+		network_error listen_error(SOCKET listener, const char *what) {
+			network_error ne(error::neterr_listen_failure, what);
+			ne.error_no = errno;
+			ne.error_message = strerror(errno);
+			if(listener != INVALID_SOCKET) closesocket(listener);
+			return ne;
 		}
-
-		#define FD_SET_F(fd, set) if (((fd_set FAR *)(set))->fd_count < FD_SETSIZE) \
-			((fd_set FAR *)(set))->fd_array[((fd_set FAR *)(set))->fd_count++] = (fd);
-
-		
-		
-	#endif
-
-	#define FD_ZERO_F FD_ZERO
-	#define FD_ISSET_F FD_ISSET
+	}
 
 	class ListenSocket::ListenSocketImpl {
 	public:
-		ListenSocketImpl(ListenSocket*);
+		// a reactor thread with its own listener and the connections accepted on it. a connection
+		// is only ever touched by its shard's thread, so none of this needs locking
+		struct shard {
+			SOCKET listener = INVALID_SOCKET;
+			Reactor reactor;
+			std::thread* twork = nullptr;
+			std::unordered_map<SOCKET, ClientSocket*> cons;
+		};
+
+		ListenSocketImpl(ListenSocket*, uint16_t port, unsigned reactors, int backlog);
+		~ListenSocketImpl();
 		sockaddr_in serveraddr;
-		sockaddr_in clientaddr;
-		fd_set master;
-		fd_set read_fds;
-		SOCKET fdmax;
-		SOCKET listener;
 		ListenSocket* outer;
 
 		uint16_t listen_port_impl = -1;
-
-		byte_t buf[2048];
-		int nBytes;
+		unsigned n_shards;
+		int backlog;
 
 		int yes = 1;
-		socklen_t addrlen;
-		std::thread* twork;
-		std::map<SOCKET, ClientSocket*> cons;
-		static void work(ListenSocket::ListenSocketImpl*);
+		std::vector<std::unique_ptr<shard>> shards;
+		static void work(shard*);
+		SOCKET open_listener();
+		void accepted(shard *sh, SOCKET newfd);
+		void receive(shard *sh, SOCKET s, ClientSocket *cs, const byte_slice &data, int error);
+		void hang_up(shard *sh, SOCKET s, bool clean);
 
 	public:
 		void init();
 		uint16_t listen_port() { return listen_port_impl; }
 	};
 
-	ListenSocket::ListenSocket() {
-		lsock = new ListenSocketImpl(this);
-		init();
+	ListenSocket::ListenSocket() : ListenSocket(8119) {}
+
+	ListenSocket::ListenSocket(uint16_t port, unsigned reactors, int backlog) {
+		// the listeners already opened go with the impl if a later one fails
+		std::unique_ptr<ListenSocketImpl> impl(new ListenSocketImpl(this, port, reactors, backlog));
+		impl->init();
+		lsock = impl.release();
 	}
 
 	ListenSocket::~ListenSocket() {
@@ -90,109 +89,154 @@ namespace ambition {
 
 	uint16_t ListenSocket::listen_port() { return lsock->listen_port(); }
 
-	void ListenSocket::ListenSocketImpl::work(ListenSocket::ListenSocketImpl* target) {
-		int rv;
-		while(true) {
-			target->read_fds = target->master;
-			rv = select(target->fdmax+1, &target->read_fds, NULL, NULL, NULL);
-
-			if(rv == INVALID_SOCKET) {
-				network_error ne(error::neterr_select_failure, "General select() error");
-				ne.error_no = errno;
-				ne.error_message = strerror(errno);
-				throw ne;
-			}			
-
-			for(SOCKET i = 0; i <= target->fdmax; i++) {
-				if(FD_ISSET(i, &target->read_fds))
-				{
-					if(i == target->listener) {
-						target->addrlen = sizeof(target->clientaddr);
-						SOCKET newfd;
-						if((newfd = accept(target->listener, (sockaddr*)&target->clientaddr, &target->addrlen)) == INVALID_SOCKET)
-							throw "accept() error";
-
-						FD_SET_F(newfd, &target->master);
-						if(newfd > target->fdmax)
-							target->fdmax = newfd;
-
-						SocketResult sr;
-						sr.success = true;
-						ClientSocket* cs_new = new ClientSocket(newfd);
-						target->cons[newfd] = cs_new;
-						sr.client = cs_new;
-						target->outer->on_accepted.notify(sr);
-					} else {
-						int rx = recv(i, reinterpret_cast<char *>(target->buf), sizeof(target->buf), 0);
-						if(rx == INVALID_SOCKET) {
-							closesocket(i);
-							FD_CLR_F(i, &target->master);
-							throw "recv error";
-
-						}
-						else if(rx == 0) {
-							printf("socket %d hung up\n", i);
-							closesocket(i);
-							FD_CLR_F(i, &target->master);
-						} else {
-							// recv
-							std::map<SOCKET, ClientSocket*>::const_iterator cif = target->cons.find(i);
-							if(cif == target->cons.end()) {
-								// oh snap!
-							} else {
-								SocketResult sr;
-								sr.success = true;
-								sr.data = byte_buffer(target->buf, rx);
-								sr.client = cif->second;
-								cif->second->on_recieved.notify(sr);
-							}
-						}
-					}
-				}
-			}
+	size_t ListenSocket::reactors() { return lsock->shards.size(); }
+
+	Reactor::Stats ListenSocket::reactor_stats() {
+		Reactor::Stats ret = Reactor::Stats();
+		for(auto &sh : lsock->shards) {
+			Reactor::Stats s = sh->reactor.stats();
+			ret.polls += s.polls;
+			ret.syscalls += s.syscalls;
+			ret.events += s.events;
 		}
+		return ret;
 	}
 
-	void ListenSocket::ListenSocketImpl::init() {
-		FD_ZERO_F(&master);
-		FD_ZERO_F(&read_fds);
+	void ListenSocket::ListenSocketImpl::work(shard* target) {
+		target->reactor.run();
+	}
+
+	// runs on sh's thread; the reactor has made newfd non-blocking
+	void ListenSocket::ListenSocketImpl::accepted(shard *sh, SOCKET newfd) {
+		ClientSocket* cs_new = new ClientSocket(newfd);
+		sh->cons[newfd] = cs_new;
+
+		// the connection's send queue asks this reactor for write events when it needs them,
+		// so it has to be watched before anyone can send on it
+		cs_new->watched_by(&sh->reactor);
+		sh->reactor.add_receiver(newfd, 0, [cs_new](unsigned events) {
+			if(events & Reactor::ev_write) cs_new->writable();
+		}, [this, sh, newfd, cs_new](const byte_slice &data, int error) {
+			receive(sh, newfd, cs_new, data, error);
+		});
+
+		SocketResult sr;
+		sr.success = true;
+		sr.client = cs_new;
+		outer->on_accepted.notify(sr);
+	}
+
+	void ListenSocket::ListenSocketImpl::receive(shard *sh, SOCKET s, ClientSocket *cs, const byte_slice &data, int error) {
+		if(data.size()) {
+			SocketResult sr;
+			sr.success = true;
+			sr.n_bytes = int(data.size());
+			sr.data = data;
+			sr.client = cs;
+			if(!cs->deliver(sr)) hang_up(sh, s, false);
+		} else {
+			// a failed send may have taken the reset, leaving the read side to see an ordinary close
+			hang_up(sh, s, error == 0 && !cs->send_failed());
+		}
+	}
+
+	void ListenSocket::ListenSocketImpl::hang_up(shard *sh, SOCKET s, bool clean) {
+		log("Socket") % 1 << "socket " << s << (clean ? " hung up" : " failed");
+		sh->reactor.remove(s);
+		closesocket(s);
+		auto cif = sh->cons.find(s);
+		if(cif == sh->cons.end()) return;
+		ClientSocket *cs = cif->second;
+		sh->cons.erase(cif);
+		SocketResult sr;
+		sr.success = clean;
+		sr.n_bytes = 0;
+		sr.client = cs;
+		cs->on_closed.notify(sr);
+		delete cs;
+	}
+
+	// bound to serveraddr and listening
+	SOCKET ListenSocket::ListenSocketImpl::open_listener() {
+		SOCKET listener;
+		if((listener = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
+			throw listen_error(listener, "Unable to create listening socket");
+
+		if(setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(int)) == INVALID_SOCKET)
+			throw listen_error(listener, "Unable to set SO_REUSEADDR");
+	#ifdef SO_REUSEPORT
+		// only when sharding: otherwise a second server on the same port would quietly take half
+		// the connections instead of failing to bind
+		if(n_shards > 1 && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, (char*)&yes, sizeof(int)) == INVALID_SOCKET)
+			throw listen_error(listener, "Unable to set SO_REUSEPORT");
+	#endif
+
+		if((bind(listener, (sockaddr*)&serveraddr, sizeof(serveraddr))) == INVALID_SOCKET)
+			throw listen_error(listener, "Unable to bind listening socket");
+
+		if(listen(listener, backlog > 0 ? backlog : SOMAXCONN) == INVALID_SOCKET)
+			throw listen_error(listener, "Unable to listen");
+
+		Reactor::set_nonblocking(listener);
+		return listener;
+	}
 
+	void ListenSocket::ListenSocketImpl::init() {
 	#ifdef _WIN32
 		WSAData data;
 		WSAStartup(MAKEWORD(1, 1), &data);
 	#endif
 
-		if((listener = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
-			throw "unable to socket()";
+		for(unsigned i = 0; i < n_shards; i++) {
+			shards.emplace_back(new shard());
+			shard *sh = shards.back().get();
+			sh->listener = open_listener();
+
+			if(i == 0) {
+				// we've bound - report the port we have bound to, and have the rest bind to it too
+				socklen_t addrlen = sizeof(serveraddr);
+				getsockname(sh->listener, (sockaddr*)&serveraddr, &addrlen);
+				listen_port_impl = ntohs(serveraddr.sin_port);
+				log("Socket") % 0 << "Bound to port: " << ntohs(serveraddr.sin_port) << " (" << sh->reactor.name()
+					<< ", " << n_shards << (n_shards == 1 ? " reactor)" : " reactors)");
+			}
 
-		printf("listener: %d errno: %d\n", listener, errno);
+			sh->reactor.add_acceptor(sh->listener, [this, sh](SOCKET newfd) {
+				accepted(sh, newfd);
+			});
+		}
 
-		if(setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (char*)&yes, sizeof(int)) == INVALID_SOCKET) {
-			printf("Error#: %d\n", errno);
-			throw "unable to setup socket";
+		for(auto &sh : shards) {
+			sh->twork = new std::thread(work, sh.get());
 		}
+	}
 
+	ListenSocket::ListenSocketImpl::ListenSocketImpl(ListenSocket* o, uint16_t port, unsigned reactors, int backlog_) :
+		outer(o), n_shards(reactors), backlog(backlog_) {
+		if(n_shards == 0) n_shards = std::max(1u, std::thread::hardware_concurrency());
+	#ifndef SO_REUSEPORT
+		n_shards = 1;
+	#endif
+		memset(&serveraddr, 0, sizeof(serveraddr));
 		serveraddr.sin_family = AF_INET;
 		serveraddr.sin_addr.s_addr = INADDR_ANY;
-		serveraddr.sin_port = htons(8119);
-		
-		if((bind(listener, (sockaddr*)&serveraddr, sizeof(serveraddr))) == INVALID_SOCKET)
-			throw "unable to bind()";
-
-		// we've bound - report the port we have bound to
-
-		listen_port_impl = ntohs(serveraddr.sin_port);
-		std::cout << "bound to: " << ntohs(serveraddr.sin_port) << std::endl;
-		log("Socket") % 0 << "Bound to port: " << ntohs(serveraddr.sin_port);
-
-		if(listen(listener, 10) == INVALID_SOCKET)
-			throw "unable to listen()";
-
-		FD_SET_F(listener, &master);
-		fdmax = listener;
-
-		twork = new std::thread(work, this);		
+		serveraddr.sin_port = htons(port);
 	}
 
-	ListenSocket::ListenSocketImpl::ListenSocketImpl(ListenSocket* o) : outer(o) {}
+	ListenSocket::ListenSocketImpl::~ListenSocketImpl() {
+		for(auto &sh : shards) {
+			if(sh->twork) sh->reactor.stop();
+		}
+		for(auto &sh : shards) {
+			if(sh->twork) {
+				sh->twork->join();
+				delete sh->twork;
+			}
+			for(auto &c : sh->cons) {
+				closesocket(c.first);
+				delete c.second;
+			}
+			if(sh->listener != INVALID_SOCKET) closesocket(sh->listener);
+		}
+	}
 }
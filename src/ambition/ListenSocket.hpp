@@ -3,6 +3,7 @@
 
 #include "Concurrent.hpp"
 #include "ClientSocket.hpp"
+#include "Reactor.hpp"
 
 #include <cstdio>
 #include <cstdint>
@@ -13,12 +14,25 @@ namespace ambition {
 		ListenSocketImpl *lsock;
 
 	public:
+		// raised on the reactor thread that will serve the connection from then on: a connection
+		// stays on the reactor that accepted it, so its events never run on two threads
 		Event<SocketResult> on_accepted;
 		ListenSocket();
+		// port 0 picks a free one. with more than one reactor, each gets its own listener on the
+		// port (SO_REUSEPORT) and the kernel spreads new connections across them; where that isn't
+		// supported there is just the one. 0 reactors means one per core, and a backlog of 0 the
+		// system's maximum
+		explicit ListenSocket(uint16_t port, unsigned reactors = 1, int backlog = 0);
 		~ListenSocket();
 
 		void init();
 		uint16_t listen_port();
+
+		// reactor threads accepting and serving connections
+		size_t reactors();
+
+		// summed over the reactors serving the listeners and their connections
+		Reactor::Stats reactor_stats();
 	};
 }
 
@@ -1,6 +1,13 @@
 #ifndef PACKET_HPP
 #define PACKET_HPP
 
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
 #include <ambition/ByteBuffer.hpp>
 #include <ambition/Error.hpp>
 
@@ -18,7 +25,103 @@ namespace ambition {
 
 	class Packet;
 
-	
+	// recycles packet storage for one connection, so decoding doesn't touch the heap once the
+	// connection has warmed up. not thread-safe; must outlive every packet made from it.
+	class packet_arena {
+	private:
+		static const size_t granularity = 16;
+		static const size_t max_pooled = 512;
+		static const size_t block_size = 16384;
+
+		// in front of every allocation; keeps objects max-aligned
+		union header_t {
+			size_t size_class;
+			std::max_align_t align;
+		};
+
+		struct free_t {
+			free_t *next;
+		};
+
+		std::array<free_t *, max_pooled / granularity + 1> m_free;
+		std::vector<std::unique_ptr<byte_t[]>> m_blocks;
+		byte_t *m_bump = nullptr;
+		size_t m_bump_left = 0;
+
+	public:
+		inline packet_arena() {
+			m_free.fill(nullptr);
+		}
+
+		packet_arena(const packet_arena &) = delete;
+		packet_arena & operator=(const packet_arena &) = delete;
+
+		inline void * allocate(size_t sz) {
+			size_t c = (sz + granularity - 1) / granularity;
+			if (c * granularity > max_pooled) {
+				// too big to be worth pooling; size class 0 means it came from the heap
+				header_t *h = static_cast<header_t *>(::operator new(sizeof(header_t) + sz));
+				h->size_class = 0;
+				return h + 1;
+			}
+			c = std::max<size_t>(c, 1);
+			header_t *h;
+			if (m_free[c]) {
+				h = reinterpret_cast<header_t *>(m_free[c]);
+				m_free[c] = m_free[c]->next;
+			} else {
+				size_t total = sizeof(header_t) + c * granularity;
+				if (m_bump_left < total) {
+					m_blocks.emplace_back(new byte_t[block_size]);
+					m_bump = m_blocks.back().get();
+					m_bump_left = block_size;
+				}
+				h = reinterpret_cast<header_t *>(m_bump);
+				m_bump += total;
+				m_bump_left -= total;
+			}
+			h->size_class = c;
+			return h + 1;
+		}
+
+		inline void deallocate(void *p) {
+			header_t *h = static_cast<header_t *>(p) - 1;
+			size_t c = h->size_class;
+			if (!c) {
+				::operator delete(h);
+				return;
+			}
+			free_t *f = reinterpret_cast<free_t *>(h);
+			f->next = m_free[c];
+			m_free[c] = f;
+		}
+
+		template <typename T, typename... ArgTR>
+		inline T * make(ArgTR &&...args) {
+			void *p = allocate(sizeof(T));
+			try {
+				return new (p) T(std::forward<ArgTR>(args)...);
+			} catch (...) {
+				deallocate(p);
+				throw;
+			}
+		}
+
+		// blocks taken from the heap so far
+		inline size_t blocks() const {
+			return m_blocks.size();
+		}
+	};
+
+	// destroys a packet and gives its storage back to the arena it came from
+	struct packet_deleter {
+		packet_arena *arena;
+
+		inline void operator()(Packet *p) const;
+	};
+
+	using packet_ptr = std::unique_ptr<Packet, packet_deleter>;
+
 	class PacketVisitor {
 	public:
 		virtual void visit(const Packet &) = 0;
@@ -30,29 +133,38 @@ namespace ambition {
 	};
 		 
 	class Packet {
-		template <unsigned I, typename Dummy = void>
-		struct deserialize_impl {
-			static Packet * go(unsigned id, byte_buffer::reader &r) {
-				if (I == id) {
-						return PacketImpl<I>::deserialize(r);
-				} else {
-						return deserialize_impl<I + 1>::go(id, r);
-				}
-			}
-		};
-	   
-		template <typename Dummy>
-		struct deserialize_impl<PacketID::last, Dummy> {
-			static Packet * go(unsigned id, byte_buffer::reader &r) {
-				throw new network_error(error::neterr_packet_id_not_found, "Unrecognised packet ID");
-			}
+		using deserialize_fn = Packet * (*)(byte_buffer::reader &, packet_arena &);
+
+		template <unsigned... I>
+		struct id_list { };
+
+		template <unsigned N, unsigned... I>
+		struct make_ids : make_ids<N - 1, N - 1, I...> { };
+
+		template <unsigned... I>
+		struct make_ids<0, I...> {
+			using type = id_list<I...>;
 		};
-		   
+
+		// deserialisers indexed by packet ID, so lookup costs the same however many IDs there are
+		template <unsigned... I>
+		static inline const deserialize_fn * deserialize_table(id_list<I...>) {
+			static const deserialize_fn table[] = { &PacketImpl<I>::deserialize... };
+			return table;
+		}
+
 	public:
-		static Packet * deserialize(const byte_buffer &bb) {
-			auto r = bb.read();
-			unsigned id = r.get<uint16_t>();
-			return deserialize_impl<0>::go(id, r);
+		// reads straight from the given memory, e.g. a received byte_slice.
+		// defined out-of-class because implementation needs to know about specialization of PacketImpl
+		static inline packet_ptr deserialize(byte_view v, packet_arena &a);
+
+		static inline packet_ptr deserialize(const byte_buffer &bb, packet_arena &a) {
+			return deserialize(bb.view(), a);
+		}
+
+		// decode a packet, hand it to the visitor, and recycle it straight away
+		static inline void dispatch(byte_view v, packet_arena &a, PacketVisitor &visitor) {
+			deserialize(v, a)->accept(visitor);
 		}
 
 		virtual void accept(PacketVisitor &v) const =0;
@@ -64,8 +176,8 @@ namespace ambition {
 	class PacketImpl<PacketID::c2s_init> : public Packet {
 		uint16_t client_version_impl = 0;
 	public:
-		static Packet * deserialize(byte_buffer::reader &r) {
-			return new PacketImpl<PacketID::c2s_init>(r.get<uint16_t>());
+		static Packet * deserialize(byte_buffer::reader &r, packet_arena &a) {
+			return a.make<PacketImpl<PacketID::c2s_init>>(r.get<uint16_t>());
 		}
 
 		PacketImpl(uint16_t nc) : client_version_impl(nc) {}
@@ -76,11 +188,11 @@ namespace ambition {
 
 		byte_buffer serialize() const override {
 			byte_buffer nbuf;
-			nbuf << (uint16_t)client_version_impl;
-			return byte_buffer();
+			nbuf << uint16_t(PacketID::c2s_init) << (uint16_t)client_version_impl;
+			return nbuf;
 		}
 
-		uint16_t client_version() { return client_version_impl; }
+		uint16_t client_version() const { return client_version_impl; }
 	};
 
 	class PacketHandler : public PacketVisitor {
@@ -98,6 +210,23 @@ namespace ambition {
 	inline void PacketVisitor::visit(const PacketImpl<PacketID::c2s_init> &p) {
 		visit(static_cast<const Packet &>(p));
 	}
+
+	inline void packet_deleter::operator()(Packet *p) const {
+		// the arena handed out the most-derived object, which need not start where Packet does
+		void *storage = dynamic_cast<void *>(p);
+		p->~Packet();
+		arena->deallocate(storage);
+	}
+
+	inline packet_ptr Packet::deserialize(byte_view v, packet_arena &a) {
+		const deserialize_fn *table = deserialize_table(make_ids<PacketID::last>::type());
+		byte_buffer::reader r(v);
+		unsigned id = r.get<uint16_t>();
+		if (id >= PacketID::last) {
+			throw network_error(error::neterr_packet_id_not_found, "Unrecognised packet ID");
+		}
+		return packet_ptr(table[id](r, a), packet_deleter{ &a });
+	}
 }
 
 
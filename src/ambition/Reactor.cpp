@@ -0,0 +1,1145 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Reactor.hpp"
+#include "Error.hpp"
+#include "Log.hpp"
+
+#if defined(__linux__) && !defined(AMBITION_REACTOR_SELECT)
+	#define AMBITION_REACTOR_EPOLL
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <linux/io_uring.h>
+		// multishot recv is the newest thing used
+		#ifdef IORING_RECV_MULTISHOT
+			#define AMBITION_REACTOR_URING
+		#endif
+	#endif
+#endif
+
+#ifdef _WIN32
+	#include <winsock2.h>
+#else
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/select.h>
+	#include <sys/socket.h>
+	#ifdef AMBITION_REACTOR_EPOLL
+		#include <sys/epoll.h>
+		#include <sys/eventfd.h>
+	#endif
+	#ifdef AMBITION_REACTOR_URING
+		#include <poll.h>
+		#include <signal.h>
+		#include <sys/mman.h>
+		#include <sys/syscall.h>
+		#include <sys/uio.h>
+	#endif
+#endif
+
+namespace ambition {
+
+	namespace {
+		network_error reactor_error(const char *what) {
+			network_error ne(error::neterr_reactor_failure, what);
+			ne.error_no = errno;
+			ne.error_message = strerror(errno);
+			return ne;
+		}
+
+		int last_error() {
+		#ifdef _WIN32
+			return WSAGetLastError();
+		#else
+			return errno;
+		#endif
+		}
+
+		const socket_t invalid_socket = socket_t(-1);
+
+		struct entry_t {
+			socket_t fd;
+			unsigned events;
+			Reactor::handler_t handler;
+			// set for sockets the reactor accepts on or reads for
+			Reactor::accept_handler_t on_accept;
+			Reactor::receive_handler_t on_data;
+			// tells this registration apart from earlier ones for the same (reused) descriptor
+			uint32_t gen;
+			// held while the handler runs, so remove() can wait for it to finish
+			std::mutex running;
+			bool removed = false;
+		#ifdef AMBITION_REACTOR_URING
+			// the send in flight, which the kernel reads from until it completes
+			byte_chain sending;
+			std::vector<iovec> iov;
+			msghdr msg;
+			Reactor::send_handler_t send_done;
+			// tells the current multishot poll apart from one modify() replaced, whose last completion
+			// may still be on its way. only changed under the registry lock
+			mutable uint8_t poll_seq = 0;
+		#endif
+		};
+
+		// what a backend found during a wait
+		struct ready_t {
+			enum kind_t {
+				// events for the handler; the reactor accepts or reads itself where it has to
+				readiness,
+				// the kernel accepted result
+				accepted,
+				// the kernel read data (result bytes), or the connection went (result -errno, or 0)
+				received,
+				sent
+			};
+			socket_t fd;
+			// 0 if the backend can't tell registrations apart
+			uint32_t gen;
+			kind_t kind;
+			unsigned events;
+			int result;
+			byte_view data;
+			// set if the entry may no longer be in the table
+			std::shared_ptr<entry_t> entry;
+		};
+
+		// what every backend shares with the reactor
+		struct registry_t {
+			mutable std::mutex mutex;
+			std::unordered_map<socket_t, std::shared_ptr<entry_t>> entries;
+			std::atomic<uint64_t> syscalls { 0 };
+
+			std::shared_ptr<entry_t> find(socket_t s, uint32_t gen) const {
+				std::lock_guard<std::mutex> lock(mutex);
+				auto it = entries.find(s);
+				if (it == entries.end() || (gen && it->second->gen != gen)) return nullptr;
+				return it->second;
+			}
+		};
+
+		class backend_t {
+		public:
+			virtual ~backend_t() { }
+			virtual void add(const entry_t &e) = 0;
+			virtual void modify(const entry_t &e) = 0;
+			virtual void remove(const entry_t &e) = 0;
+			virtual void wake() = 0;
+			// fills in what happened; returns false if interrupted
+			virtual bool wait(int timeout_ms, std::vector<ready_t> &out) = 0;
+			// called once the handlers for a wait have run
+			virtual void done() { }
+			// true if the kernel accepts and receives for sockets, rather than saying they are ready
+			virtual bool completions() const { return false; }
+			virtual void send(const std::shared_ptr<entry_t> &, const byte_chain &) {
+				throw std::logic_error("Reactor backend can't send");
+			}
+		};
+
+	#ifdef AMBITION_REACTOR_EPOLL
+		class epoll_backend : public backend_t {
+			registry_t &reg;
+			int epfd;
+			int wakefd;
+			std::vector<epoll_event> ready { 256 };
+
+			static uint32_t to_epoll(unsigned events) {
+				uint32_t e = EPOLLET | EPOLLRDHUP;
+				if (events & Reactor::ev_read) e |= EPOLLIN;
+				if (events & Reactor::ev_write) e |= EPOLLOUT;
+				return e;
+			}
+
+		public:
+			explicit epoll_backend(registry_t &reg_) : reg(reg_) {
+				epfd = epoll_create1(EPOLL_CLOEXEC);
+				if (epfd < 0) throw reactor_error("Unable to create epoll instance");
+				wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if (wakefd < 0) {
+					close(epfd);
+					throw reactor_error("Unable to create eventfd");
+				}
+				epoll_event ev;
+				ev.events = EPOLLIN | EPOLLET;
+				ev.data.fd = wakefd;
+				epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+			}
+
+			~epoll_backend() {
+				close(wakefd);
+				close(epfd);
+			}
+
+			void add(const entry_t &e) override {
+				epoll_event ev;
+				ev.events = to_epoll(e.events);
+				ev.data.fd = e.fd;
+				reg.syscalls++;
+				if (epoll_ctl(epfd, EPOLL_CTL_ADD, e.fd, &ev) < 0) throw reactor_error("Unable to watch socket");
+			}
+
+			void modify(const entry_t &e) override {
+				epoll_event ev;
+				ev.events = to_epoll(e.events);
+				ev.data.fd = e.fd;
+				reg.syscalls++;
+				if (epoll_ctl(epfd, EPOLL_CTL_MOD, e.fd, &ev) < 0) throw reactor_error("Unable to change watched events");
+			}
+
+			void remove(const entry_t &e) override {
+				// fails harmlessly if the socket was already closed, which unwatches it anyway
+				reg.syscalls++;
+				epoll_ctl(epfd, EPOLL_CTL_DEL, e.fd, nullptr);
+			}
+
+			void wake() override {
+				uint64_t one = 1;
+				ssize_t r = write(wakefd, &one, sizeof(one));
+				(void) r;
+			}
+
+			bool wait(int timeout_ms, std::vector<ready_t> &out) override {
+				reg.syscalls++;
+				int n = epoll_wait(epfd, ready.data(), int(ready.size()), timeout_ms);
+				if (n < 0) {
+					if (errno == EINTR) return false;
+					throw reactor_error("General epoll_wait() error");
+				}
+				for (int i = 0; i < n; i++) {
+					const epoll_event &ev = ready[i];
+					if (ev.data.fd == wakefd) {
+						uint64_t count;
+						ssize_t r = read(wakefd, &count, sizeof(count));
+						(void) r;
+						continue;
+					}
+					ready_t r = ready_t();
+					r.fd = ev.data.fd;
+					r.kind = ready_t::readiness;
+					if (ev.events & EPOLLIN) r.events |= Reactor::ev_read;
+					if (ev.events & EPOLLOUT) r.events |= Reactor::ev_write;
+					if (ev.events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) r.events |= Reactor::ev_error | Reactor::ev_read;
+					out.push_back(r);
+				}
+				// a full batch suggests more are waiting; take more next time
+				if (size_t(n) == ready.size()) ready.resize(ready.size() * 2);
+				return true;
+			}
+		};
+	#endif
+
+		// select() rebuilds its sets every call, so this costs O(sockets) per wakeup
+		class select_backend : public backend_t {
+			registry_t &reg;
+		#ifndef _WIN32
+			int wake_pipe[2];
+		#endif
+
+		public:
+			explicit select_backend(registry_t &reg_) : reg(reg_) {
+			#ifndef _WIN32
+				if (pipe(wake_pipe) < 0) throw reactor_error("Unable to create wake pipe");
+				Reactor::set_nonblocking(wake_pipe[0]);
+				Reactor::set_nonblocking(wake_pipe[1]);
+			#endif
+			}
+
+			~select_backend() {
+			#ifndef _WIN32
+				close(wake_pipe[0]);
+				close(wake_pipe[1]);
+			#endif
+			}
+
+			void add(const entry_t &e) override {
+			#ifndef _WIN32
+				if (e.fd >= FD_SETSIZE) {
+					errno = EMFILE;
+					throw reactor_error("Socket number too high for select()");
+				}
+			#endif
+				wake();
+			}
+
+			void modify(const entry_t &) override {
+				wake();
+			}
+
+			void remove(const entry_t &) override {
+				wake();
+			}
+
+			void wake() override {
+			#ifndef _WIN32
+				char c = 0;
+				ssize_t r = write(wake_pipe[1], &c, 1);
+				(void) r;
+			#endif
+			}
+
+			bool wait(int timeout_ms, std::vector<ready_t> &out) override {
+				fd_set rfds, wfds, efds;
+				FD_ZERO(&rfds);
+				FD_ZERO(&wfds);
+				FD_ZERO(&efds);
+				socket_t maxfd = 0;
+				{
+					std::lock_guard<std::mutex> lock(reg.mutex);
+					for (const auto &kv : reg.entries) {
+						const entry_t &e = *kv.second;
+						if (e.events & Reactor::ev_read) FD_SET(e.fd, &rfds);
+						if (e.events & Reactor::ev_write) FD_SET(e.fd, &wfds);
+						FD_SET(e.fd, &efds);
+						maxfd = std::max(maxfd, e.fd);
+					}
+				}
+			#ifndef _WIN32
+				FD_SET(wake_pipe[0], &rfds);
+				maxfd = std::max(maxfd, wake_pipe[0]);
+			#else
+				// no wake pipe on windows; look again for changes at least this often
+				if (timeout_ms < 0 || timeout_ms > 10) timeout_ms = 10;
+			#endif
+				timeval tv;
+				tv.tv_sec = timeout_ms / 1000;
+				tv.tv_usec = (timeout_ms % 1000) * 1000;
+				reg.syscalls++;
+				int n = select(int(maxfd + 1), &rfds, &wfds, &efds, timeout_ms < 0 ? nullptr : &tv);
+				if (n < 0) {
+				#ifndef _WIN32
+					// EBADF: a socket was removed and closed after the sets were made; it's gone next time
+					if (errno == EINTR || errno == EBADF) return false;
+				#endif
+					throw reactor_error("General select() error");
+				}
+			#ifndef _WIN32
+				if (FD_ISSET(wake_pipe[0], &rfds)) {
+					char buf[64];
+					while (read(wake_pipe[0], buf, sizeof(buf)) > 0);
+				}
+			#endif
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				for (const auto &kv : reg.entries) {
+					const entry_t &e = *kv.second;
+					ready_t r = ready_t();
+					r.fd = e.fd;
+					r.kind = ready_t::readiness;
+					if (FD_ISSET(e.fd, &rfds)) r.events |= Reactor::ev_read;
+					if (FD_ISSET(e.fd, &wfds)) r.events |= Reactor::ev_write;
+					if (FD_ISSET(e.fd, &efds)) r.events |= Reactor::ev_error | Reactor::ev_read;
+					if (r.events) out.push_back(r);
+				}
+				return true;
+			}
+		};
+
+	#ifdef AMBITION_REACTOR_URING
+		// io_uring without liburing: the rings are mapped and driven by hand.
+		//
+		// sockets the reactor reads for get a multishot recv that takes buffers from a provided ring, and
+		// listeners a multishot accept, so neither costs a system call per message or connection. other
+		// interest is a multishot poll. everything asked for on the polling thread is queued and goes in
+		// with the next wait; other threads submit straight away.
+		class uring_backend : public backend_t {
+			registry_t &reg;
+			int ring_fd = -1;
+
+			void *ring = MAP_FAILED;
+			size_t ring_size = 0;
+			io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+			size_t sqes_size = 0;
+			unsigned *sq_head, *sq_tail, *sq_array;
+			unsigned sq_mask, sq_entries;
+			unsigned *cq_head, *cq_tail;
+			unsigned cq_mask;
+			io_uring_cqe *cqes;
+			// guards the submission queue tail, which any thread may add to
+			std::mutex sq_mutex;
+
+			// received data lands in these, and is copied out before they go back in the ring
+			static const unsigned buffer_count = 256;
+			static const unsigned buffer_size = 4096;
+			// the ring is used as a plain array: in C++ the header's flexible array member doesn't start
+			// at offset 0, and the tail lives in the first entry's reserved field
+			io_uring_buf *buf_ring = static_cast<io_uring_buf *>(MAP_FAILED);
+			std::unique_ptr<byte_t[]> buffers;
+			uint16_t buf_tail = 0;
+			std::vector<uint16_t> spent;
+			// multishot requests the kernel ended, to be started again once the handlers have run
+			std::vector<uint64_t> rearm;
+			// sends hold on to their entry, and so to the data, until the kernel is done with it
+			std::unordered_map<uint64_t, std::shared_ptr<entry_t>> in_flight;
+
+			enum ops : uint8_t {
+				op_poll = 1,
+				op_recv,
+				op_accept,
+				op_send,
+				op_wake,
+				op_cancel
+			};
+
+			// fd in the low 32 bits, then the generation (24), the op (4) and the poll sequence (4)
+			static uint64_t user_data(socket_t fd, uint32_t gen, ops op, uint8_t seq = 0) {
+				return uint64_t(uint32_t(fd)) | (uint64_t(gen & 0xFFFFFF) << 32) | (uint64_t(op & 0xF) << 56) | (uint64_t(seq & 0xF) << 60);
+			}
+
+			static socket_t fd_of(uint64_t ud) { return socket_t(uint32_t(ud)); }
+			static uint32_t gen_of(uint64_t ud) { return uint32_t(ud >> 32) & 0xFFFFFF; }
+			static ops op_of(uint64_t ud) { return ops((ud >> 56) & 0xF); }
+			static uint8_t seq_of(uint64_t ud) { return uint8_t(ud >> 60); }
+
+			// submits whatever is queued. the kernel only waits if it submitted exactly as many as it was
+			// told to, so the count has to be right; if another thread submits at the same time this may
+			// return early, which is just a spurious wakeup
+			int enter(unsigned min_complete, unsigned flags, const void *arg = nullptr, size_t arg_size = 0) {
+				unsigned to_submit = __atomic_load_n(sq_tail, __ATOMIC_ACQUIRE) - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+				reg.syscalls++;
+				return int(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size));
+			}
+
+			static uint32_t to_poll(unsigned events) {
+				uint32_t p = 0;
+				if (events & Reactor::ev_read) p |= POLLIN | POLLRDHUP;
+				if (events & Reactor::ev_write) p |= POLLOUT;
+				return p;
+			}
+
+			// sockets that are read by recv (or accept) are only polled for what else they want
+			static unsigned polled(const entry_t &e) {
+				return (e.on_data || e.on_accept) ? e.events & ~Reactor::ev_read : e.events;
+			}
+
+			// copies sqe into the queue; submitted now if asked, otherwise with the next wait
+			void push(const io_uring_sqe &sqe, bool now) {
+				std::lock_guard<std::mutex> lock(sq_mutex);
+				unsigned tail = *sq_tail;
+				if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+					// full; submitting takes them off
+					if (enter(0, 0) < 0) throw reactor_error("Unable to submit to io_uring");
+				}
+				unsigned index = tail & sq_mask;
+				sqes[index] = sqe;
+				sq_array[index] = index;
+				__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+				if (now && enter(0, 0) < 0) throw reactor_error("Unable to submit to io_uring");
+			}
+
+			static io_uring_sqe make_sqe(uint8_t opcode, socket_t fd, uint64_t ud) {
+				io_uring_sqe sqe;
+				memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = opcode;
+				sqe.fd = fd;
+				sqe.user_data = ud;
+				return sqe;
+			}
+
+			void start_recv(const entry_t &e, bool now) {
+				io_uring_sqe sqe = make_sqe(IORING_OP_RECV, e.fd, user_data(e.fd, e.gen, op_recv));
+				sqe.ioprio = IORING_RECV_MULTISHOT;
+				sqe.flags = IOSQE_BUFFER_SELECT;
+				sqe.buf_group = 0;
+				push(sqe, now);
+			}
+
+			void start_accept(const entry_t &e, bool now) {
+				io_uring_sqe sqe = make_sqe(IORING_OP_ACCEPT, e.fd, user_data(e.fd, e.gen, op_accept));
+				sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+				sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+				push(sqe, now);
+			}
+
+			void start_poll(const entry_t &e, bool now) {
+				io_uring_sqe sqe = make_sqe(IORING_OP_POLL_ADD, e.fd, user_data(e.fd, e.gen, op_poll, e.poll_seq));
+				sqe.len = IORING_POLL_ADD_MULTI;
+				sqe.poll32_events = to_poll(polled(e));
+				push(sqe, now);
+			}
+
+			void stop_poll(const entry_t &e, bool now) {
+				io_uring_sqe sqe = make_sqe(IORING_OP_POLL_REMOVE, -1, user_data(e.fd, e.gen, op_cancel));
+				sqe.addr = user_data(e.fd, e.gen, op_poll, e.poll_seq);
+				push(sqe, now);
+			}
+
+			bool on_poller() const {
+				return poller.load() == std::this_thread::get_id();
+			}
+
+			void recycle(uint16_t bid) {
+				io_uring_buf &b = buf_ring[buf_tail & (buffer_count - 1)];
+				b.addr = reinterpret_cast<uint64_t>(buffers.get() + size_t(bid) * buffer_size);
+				b.len = buffer_size;
+				b.bid = bid;
+				buf_tail++;
+			}
+
+			void release() {
+				if (ring != MAP_FAILED) munmap(ring, ring_size);
+				if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+				if (buf_ring != MAP_FAILED) munmap(buf_ring, buffer_count * sizeof(io_uring_buf));
+				if (ring_fd >= 0) close(ring_fd);
+			}
+
+		public:
+			// set by the reactor before each wait
+			std::atomic<std::thread::id> poller;
+
+			explicit uring_backend(registry_t &reg_) : reg(reg_) {
+				io_uring_params p;
+				memset(&p, 0, sizeof(p));
+				// bursts of completions from many sockets shouldn't overflow
+				p.flags = IORING_SETUP_CQSIZE;
+				p.cq_entries = 4096;
+				ring_fd = int(syscall(__NR_io_uring_setup, 256, &p));
+				if (ring_fd < 0) throw reactor_error("Unable to create io_uring");
+				const unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+				if ((p.features & needed) != needed) {
+					release();
+					errno = ENOSYS;
+					throw reactor_error("io_uring too old");
+				}
+
+				ring_size = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned), p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+				ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+				sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+				sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+				if (ring == MAP_FAILED || sqes == MAP_FAILED) {
+					release();
+					throw reactor_error("Unable to map io_uring");
+				}
+				char *base = static_cast<char *>(ring);
+				sq_head = reinterpret_cast<unsigned *>(base + p.sq_off.head);
+				sq_tail = reinterpret_cast<unsigned *>(base + p.sq_off.tail);
+				sq_array = reinterpret_cast<unsigned *>(base + p.sq_off.array);
+				sq_mask = *reinterpret_cast<unsigned *>(base + p.sq_off.ring_mask);
+				sq_entries = p.sq_entries;
+				cq_head = reinterpret_cast<unsigned *>(base + p.cq_off.head);
+				cq_tail = reinterpret_cast<unsigned *>(base + p.cq_off.tail);
+				cq_mask = *reinterpret_cast<unsigned *>(base + p.cq_off.ring_mask);
+				cqes = reinterpret_cast<io_uring_cqe *>(base + p.cq_off.cqes);
+
+				buf_ring = static_cast<io_uring_buf *>(mmap(nullptr, buffer_count * sizeof(io_uring_buf),
+					PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+				if (buf_ring == MAP_FAILED) {
+					release();
+					throw reactor_error("Unable to map io_uring buffer ring");
+				}
+				io_uring_buf_reg breg;
+				memset(&breg, 0, sizeof(breg));
+				breg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+				breg.ring_entries = buffer_count;
+				breg.bgid = 0;
+				if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &breg, 1) < 0) {
+					release();
+					throw reactor_error("Unable to register io_uring buffer ring");
+				}
+				buffers.reset(new byte_t[size_t(buffer_count) * buffer_size]);
+				for (unsigned i = 0; i < buffer_count; i++) recycle(uint16_t(i));
+				__atomic_store_n(&buf_ring[0].resv, buf_tail, __ATOMIC_RELEASE);
+			}
+
+			~uring_backend() {
+				// closing the ring cancels whatever is still outstanding
+				release();
+			}
+
+			bool completions() const override {
+				return true;
+			}
+
+			void add(const entry_t &e) override {
+				bool now = !on_poller();
+				if (e.on_accept) start_accept(e, now);
+				if (e.on_data) start_recv(e, now);
+				if (polled(e)) start_poll(e, now);
+			}
+
+			void modify(const entry_t &e) override {
+				// the old poll is removed by its user data and the new one gets another sequence
+				// number, so an ending of the old one that is already in the completion queue isn't
+				// taken for the new one and started again
+				stop_poll(e, false);
+				e.poll_seq = (e.poll_seq + 1) & 0xF;
+				if (polled(e)) start_poll(e, false);
+				if (!on_poller()) {
+					std::lock_guard<std::mutex> lock(sq_mutex);
+					enter(0, 0);
+				}
+			}
+
+			void remove(const entry_t &e) override {
+				// cancelling by descriptor needs it to still be open, which it may not be once this
+				// returns, so this one goes in straight away
+				io_uring_sqe sqe = make_sqe(IORING_OP_ASYNC_CANCEL, e.fd, user_data(e.fd, e.gen, op_cancel));
+				sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+				push(sqe, true);
+			}
+
+			void wake() override {
+				push(make_sqe(IORING_OP_NOP, -1, user_data(0, 0, op_wake)), !on_poller());
+			}
+
+			void send(const std::shared_ptr<entry_t> &e, const byte_chain &data) override {
+				static const size_t max_gather = 64;
+				e->sending = data;
+				e->iov.clear();
+				for (const byte_slice &seg : e->sending) {
+					if (e->iov.size() == max_gather) break;
+					iovec v;
+					v.iov_base = const_cast<byte_t *>(seg.data());
+					v.iov_len = seg.size();
+					e->iov.push_back(v);
+				}
+				memset(&e->msg, 0, sizeof(e->msg));
+				e->msg.msg_iov = e->iov.data();
+				e->msg.msg_iovlen = e->iov.size();
+				uint64_t ud = user_data(e->fd, e->gen, op_send);
+				io_uring_sqe sqe = make_sqe(IORING_OP_SENDMSG, e->fd, ud);
+				sqe.addr = reinterpret_cast<uint64_t>(&e->msg);
+				sqe.len = 1;
+				sqe.msg_flags = MSG_NOSIGNAL;
+				in_flight[ud] = e;
+				push(sqe, false);
+			}
+
+			bool wait(int timeout_ms, std::vector<ready_t> &out) override {
+				unsigned flags = IORING_ENTER_GETEVENTS;
+				unsigned min_complete = 1;
+				// completions already waiting shouldn't wait for more
+				if (__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE) != *cq_head || timeout_ms == 0) min_complete = 0;
+				io_uring_getevents_arg arg;
+				__kernel_timespec ts;
+				memset(&arg, 0, sizeof(arg));
+				if (timeout_ms >= 0) {
+					ts.tv_sec = timeout_ms / 1000;
+					ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+					arg.sigmask_sz = _NSIG / 8;
+					arg.ts = reinterpret_cast<uint64_t>(&ts);
+					flags |= IORING_ENTER_EXT_ARG;
+				}
+				int r = enter(min_complete, flags, timeout_ms >= 0 ? &arg : nullptr, timeout_ms >= 0 ? sizeof(arg) : 0);
+				if (r < 0 && errno != ETIME && errno != EBUSY) {
+					if (errno == EINTR) return false;
+					throw reactor_error("General io_uring_enter() error");
+				}
+
+				unsigned head = *cq_head;
+				unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+				for (; head != tail; head++) {
+					const io_uring_cqe &cqe = cqes[head & cq_mask];
+					const ops op = op_of(cqe.user_data);
+					const bool more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+					ready_t rd = ready_t();
+					rd.fd = fd_of(cqe.user_data);
+					rd.gen = gen_of(cqe.user_data);
+					rd.result = cqe.res;
+
+					if (op == op_poll) {
+						if (cqe.res == -ECANCELED) continue;
+						if (!more) rearm.push_back(cqe.user_data);
+						if (cqe.res < 0) continue;
+						rd.kind = ready_t::readiness;
+						if (cqe.res & POLLIN) rd.events |= Reactor::ev_read;
+						if (cqe.res & POLLOUT) rd.events |= Reactor::ev_write;
+						if (cqe.res & (POLLERR | POLLHUP | POLLRDHUP)) rd.events |= Reactor::ev_error | Reactor::ev_read;
+						out.push_back(rd);
+					} else if (op == op_recv) {
+						if (cqe.res == -ECANCELED) continue;
+						if (cqe.res == -ENOBUFS) {
+							// every buffer was in use; they are back once this batch has been handled
+							rearm.push_back(cqe.user_data);
+							continue;
+						}
+						rd.kind = ready_t::received;
+						if (cqe.res > 0) {
+							uint16_t bid = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+							rd.data = byte_view(buffers.get() + size_t(bid) * buffer_size, size_t(cqe.res));
+							spent.push_back(bid);
+							if (!more) rearm.push_back(cqe.user_data);
+						}
+						out.push_back(rd);
+					} else if (op == op_accept) {
+						if (cqe.res == -ECANCELED) continue;
+						if (!more) rearm.push_back(cqe.user_data);
+						if (cqe.res < 0) {
+							log("Socket") % 0 << "accept() failed: " << strerror(-cqe.res);
+							continue;
+						}
+						rd.kind = ready_t::accepted;
+						out.push_back(rd);
+					} else if (op == op_send) {
+						auto it = in_flight.find(cqe.user_data);
+						if (it == in_flight.end()) continue;
+						rd.kind = ready_t::sent;
+						rd.entry = std::move(it->second);
+						in_flight.erase(it);
+						out.push_back(rd);
+					}
+				}
+				__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+				return true;
+			}
+
+			void done() override {
+				if (!spent.empty()) {
+					for (uint16_t bid : spent) recycle(bid);
+					__atomic_store_n(&buf_ring[0].resv, buf_tail, __ATOMIC_RELEASE);
+					spent.clear();
+				}
+				// under the registry lock, so modify() can't start a poll in between the check and the rearm
+				std::lock_guard<std::mutex> lock(reg.mutex);
+				for (uint64_t ud : rearm) {
+					// gone if it was removed in the meantime
+					auto it = reg.entries.find(fd_of(ud));
+					if (it == reg.entries.end() || it->second->gen != gen_of(ud)) continue;
+					const entry_t &e = *it->second;
+					switch (op_of(ud)) {
+						case op_recv: start_recv(e, false); break;
+						case op_accept: start_accept(e, false); break;
+						// a poll modify() has replaced since is already running
+						case op_poll: if (seq_of(ud) == e.poll_seq && polled(e)) start_poll(e, false); break;
+						default: break;
+					}
+				}
+				rearm.clear();
+			}
+		};
+	#endif
+
+		std::atomic<int> default_backend { Reactor::backend_default };
+
+		int resolve(int backend) {
+			if (backend == Reactor::backend_default) backend = default_backend.load();
+			if (backend != Reactor::backend_default) return backend;
+		#ifdef AMBITION_REACTOR_EPOLL
+			return Reactor::backend_epoll;
+		#else
+			return Reactor::backend_select;
+		#endif
+		}
+
+		const char * backend_name(int backend) {
+			switch (backend) {
+				case Reactor::backend_epoll: return "epoll";
+				case Reactor::backend_io_uring: return "io_uring";
+				default: return "select";
+			}
+		}
+	}
+
+	class Reactor::ReactorImpl {
+	public:
+		registry_t reg;
+		int kind;
+		std::unique_ptr<backend_t> backend;
+		std::atomic<bool> stopped { false };
+		std::vector<ready_t> ready_list;
+		// held while a batch of handlers runs, so a remove() that finds its socket already gone
+		// (a handler took it off itself) can still wait for that handler to return
+		std::mutex dispatching;
+		std::atomic<std::thread::id> poller;
+		uint32_t next_gen = 0;
+		std::atomic<uint64_t> polls { 0 };
+		std::atomic<uint64_t> events { 0 };
+		// received data goes straight into shared storage that is handed out as-is
+		byte_slab rx_slab { 65536, 4096 };
+
+		explicit ReactorImpl(int backend_) : kind(resolve(backend_)) {
+			switch (kind) {
+			#ifdef AMBITION_REACTOR_EPOLL
+				case backend_epoll: backend.reset(new epoll_backend(reg)); break;
+			#endif
+			#ifdef AMBITION_REACTOR_URING
+				case backend_io_uring: backend.reset(new uring_backend(reg)); break;
+			#endif
+				case backend_select: backend.reset(new select_backend(reg)); break;
+				default:
+					errno = ENOSYS;
+					throw reactor_error("Reactor backend not built in");
+			}
+		}
+
+		void add(std::shared_ptr<entry_t> e) {
+			// the backend reads the entry's events, which a handler may modify() as soon as it is
+			// registered, so it is handed over under the same lock
+			std::lock_guard<std::mutex> lock(reg.mutex);
+			// never 0, which stands for any
+			next_gen = (next_gen + 1) & 0xFFFFFF;
+			if (!next_gen) next_gen = 1;
+			e->gen = next_gen;
+			reg.entries[e->fd] = e;
+			try {
+				backend->add(*e);
+			} catch (...) {
+				reg.entries.erase(e->fd);
+				throw;
+			}
+		}
+
+		// edge-triggered: accept until there are no more
+		void accept_all(entry_t &e) {
+			while (!e.removed) {
+				reg.syscalls++;
+			#ifdef __linux__
+				socket_t s = accept4(e.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			#else
+				socket_t s = accept(e.fd, nullptr, nullptr);
+			#endif
+				if (s == invalid_socket) {
+					if (!Reactor::would_block()) {
+						log("Socket") % 0 << "accept() failed: " << strerror(errno);
+					}
+					return;
+				}
+			#ifndef __linux__
+				Reactor::set_nonblocking(s);
+			#endif
+				e.on_accept(s);
+			}
+		}
+
+		// edge-triggered: read until the socket would block
+		void receive(entry_t &e) {
+			while (!e.removed) {
+				reg.syscalls++;
+				int rx = int(recv(e.fd, reinterpret_cast<char *>(rx_slab.space()), int(rx_slab.capacity()), 0));
+				if (rx > 0) {
+					e.on_data(rx_slab.commit(rx), 0);
+				} else if (rx == 0) {
+					e.on_data(byte_slice(), 0);
+					return;
+				} else {
+					if (!Reactor::would_block()) e.on_data(byte_slice(), last_error());
+					return;
+				}
+			}
+		}
+
+		void dispatch(entry_t &e, const ready_t &r) {
+			switch (r.kind) {
+				case ready_t::accepted:
+					e.on_accept(socket_t(r.result));
+					break;
+				case ready_t::received:
+					if (r.data.size()) {
+						// the kernel's buffer goes back to it once this batch is handled
+						byte_view in = r.data;
+						while (in.size() && !e.removed) {
+							size_t n = std::min(in.size(), rx_slab.capacity());
+							memcpy(rx_slab.space(), in.data(), n);
+							e.on_data(rx_slab.commit(n), 0);
+							in = in.slice(n);
+						}
+					} else {
+						e.on_data(byte_slice(), -r.result);
+					}
+					break;
+				case ready_t::sent: {
+				#ifdef AMBITION_REACTOR_URING
+					Reactor::send_handler_t done = std::move(e.send_done);
+					e.sending.clear();
+					done(r.result);
+				#endif
+					break;
+				}
+				case ready_t::readiness:
+					if (e.on_accept) {
+						if (r.events & ev_read) accept_all(e);
+					} else if (e.on_data) {
+						unsigned others = r.events & ~(ev_read | ev_error);
+						if (others && e.handler) e.handler(others);
+						if (!backend->completions() && (r.events & ev_read) && !e.removed) receive(e);
+					} else {
+						e.handler(r.events);
+					}
+					break;
+			}
+		}
+	};
+
+	Reactor::Reactor(int backend) : m_impl(new ReactorImpl(backend)) { }
+
+	Reactor::~Reactor() {
+		delete m_impl;
+	}
+
+	void Reactor::add(socket_t s, unsigned events, handler_t handler) {
+		auto e = std::make_shared<entry_t>();
+		e->fd = s;
+		e->events = events;
+		e->handler = std::move(handler);
+		m_impl->add(std::move(e));
+	}
+
+	void Reactor::add_acceptor(socket_t listener, accept_handler_t on_accept) {
+		auto e = std::make_shared<entry_t>();
+		e->fd = listener;
+		e->events = ev_read;
+		e->on_accept = std::move(on_accept);
+		m_impl->add(std::move(e));
+	}
+
+	void Reactor::add_receiver(socket_t s, unsigned events, handler_t handler, receive_handler_t on_data) {
+		auto e = std::make_shared<entry_t>();
+		e->fd = s;
+		e->events = events | ev_read;
+		e->handler = std::move(handler);
+		e->on_data = std::move(on_data);
+		m_impl->add(std::move(e));
+	}
+
+	void Reactor::modify(socket_t s, unsigned events) {
+		// under the lock, so the backend is told about changes in the order they were made
+		std::lock_guard<std::mutex> lock(m_impl->reg.mutex);
+		auto it = m_impl->reg.entries.find(s);
+		if (it == m_impl->reg.entries.end()) return;
+		entry_t &e = *it->second;
+		if (e.on_data) events |= ev_read;
+		e.events = events;
+		m_impl->backend->modify(e);
+	}
+
+	void Reactor::remove(socket_t s) {
+		std::shared_ptr<entry_t> e;
+		{
+			std::lock_guard<std::mutex> lock(m_impl->reg.mutex);
+			auto it = m_impl->reg.entries.find(s);
+			if (it != m_impl->reg.entries.end()) {
+				e = it->second;
+				m_impl->reg.entries.erase(it);
+			}
+		}
+		if (!e) {
+			if (!on_poller_thread()) {
+				std::lock_guard<std::mutex> wait(m_impl->dispatching);
+			}
+			return;
+		}
+		m_impl->backend->remove(*e);
+		if (on_poller_thread()) {
+			// handlers run one at a time on this thread, so this one can't be running now
+			e->removed = true;
+		} else {
+			std::lock_guard<std::mutex> lock(e->running);
+			e->removed = true;
+		}
+	}
+
+	size_t Reactor::poll(int timeout_ms) {
+		// kept between calls so the steady state doesn't allocate
+		std::vector<ready_t> &ready = m_impl->ready_list;
+		ready.clear();
+		m_impl->poller.store(std::this_thread::get_id());
+	#ifdef AMBITION_REACTOR_URING
+		if (m_impl->kind == backend_io_uring) {
+			static_cast<uring_backend *>(m_impl->backend.get())->poller.store(std::this_thread::get_id());
+		}
+	#endif
+		m_impl->polls++;
+		if (!m_impl->backend->wait(timeout_ms, ready)) return 0;
+		size_t ran = 0;
+		std::lock_guard<std::mutex> batch(m_impl->dispatching);
+		for (const auto &r : ready) {
+			// removed (and maybe replaced) since the wait returned: a new handler may see a spurious
+			// event, which is harmless since it has to cope with would-block anyway
+			std::shared_ptr<entry_t> e = r.entry ? r.entry : m_impl->reg.find(r.fd, r.gen);
+			if (!e) continue;
+			std::lock_guard<std::mutex> lock(e->running);
+			if (e->removed) continue;
+			m_impl->dispatch(*e, r);
+			ran++;
+		}
+		m_impl->backend->done();
+		m_impl->events += ran;
+		return ran;
+	}
+
+	void Reactor::run() {
+		while (!m_impl->stopped.load()) {
+			poll(-1);
+		}
+		m_impl->stopped.store(false);
+	}
+
+	void Reactor::stop() {
+		m_impl->stopped.store(true);
+		m_impl->backend->wake();
+	}
+
+	void Reactor::wake() {
+		m_impl->backend->wake();
+	}
+
+	size_t Reactor::size() const {
+		std::lock_guard<std::mutex> lock(m_impl->reg.mutex);
+		return m_impl->reg.entries.size();
+	}
+
+	bool Reactor::batches_sends() const {
+		return m_impl->backend->completions();
+	}
+
+	void Reactor::send(socket_t s, const byte_chain &data, send_handler_t done) {
+		if (!on_poller_thread()) throw std::logic_error("Reactor::send() called off the polling thread");
+		std::shared_ptr<entry_t> e = m_impl->reg.find(s, 0);
+		if (!e) throw std::logic_error("Reactor::send() on a socket that isn't watched");
+	#ifdef AMBITION_REACTOR_URING
+		e->send_done = std::move(done);
+	#else
+		(void) done;
+	#endif
+		m_impl->backend->send(e, data);
+	}
+
+	bool Reactor::on_poller_thread() const {
+		return m_impl->poller.load() == std::this_thread::get_id();
+	}
+
+	Reactor::Stats Reactor::stats() const {
+		Stats ret;
+		ret.polls = m_impl->polls.load();
+		ret.syscalls = m_impl->reg.syscalls.load();
+		ret.events = m_impl->events.load();
+		return ret;
+	}
+
+	const char * Reactor::name() const {
+		return backend_name(m_impl->kind);
+	}
+
+	void Reactor::set_default_backend(int backend) {
+		if (!available(backend)) {
+			errno = ENOSYS;
+			throw reactor_error("Reactor backend not available");
+		}
+		default_backend.store(backend);
+	}
+
+	const char * Reactor::backend() {
+		return backend_name(resolve(backend_default));
+	}
+
+	bool Reactor::available(int backend) {
+		switch (backend) {
+			case backend_default:
+			case backend_select:
+				return true;
+			case backend_epoll:
+			#ifdef AMBITION_REACTOR_EPOLL
+				return true;
+			#else
+				return false;
+			#endif
+			case backend_io_uring: {
+			#ifdef AMBITION_REACTOR_URING
+				// the kernel may be too old, or have io_uring turned off
+				static const bool works = [] {
+					try {
+						registry_t reg;
+						uring_backend probe(reg);
+						return true;
+					} catch (const network_error &) {
+						return false;
+					}
+				}();
+				return works;
+			#else
+				return false;
+			#endif
+			}
+			default:
+				return false;
+		}
+	}
+
+	std::mutex ReactorPool::m_mutex;
+	std::vector<Reactor *> ReactorPool::m_reactors;
+	std::vector<std::thread *> ReactorPool::m_threads;
+
+	void ReactorPool::startLocked(unsigned threads) {
+		if (!m_reactors.empty()) return;
+		if (!threads) threads = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
+		for (unsigned i = 0; i < threads; i++) {
+			Reactor *r = new Reactor();
+			m_reactors.push_back(r);
+			m_threads.push_back(new std::thread([r] { r->run(); }));
+		}
+	}
+
+	void ReactorPool::start(unsigned threads) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		startLocked(threads);
+	}
+
+	void ReactorPool::stop() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (Reactor *r : m_reactors) {
+			r->stop();
+		}
+		for (std::thread *t : m_threads) {
+			t->join();
+			delete t;
+		}
+		for (Reactor *r : m_reactors) {
+			delete r;
+		}
+		m_threads.clear();
+		m_reactors.clear();
+	}
+
+	Reactor & ReactorPool::next() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		startLocked(0);
+		Reactor *best = m_reactors.front();
+		for (Reactor *r : m_reactors) {
+			if (r->size() < best->size()) best = r;
+		}
+		return *best;
+	}
+
+	size_t ReactorPool::size() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_reactors.size();
+	}
+
+	Reactor::Stats ReactorPool::stats() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Reactor::Stats ret = Reactor::Stats();
+		for (Reactor *r : m_reactors) {
+			Reactor::Stats s = r->stats();
+			ret.polls += s.polls;
+			ret.syscalls += s.syscalls;
+			ret.events += s.events;
+		}
+		return ret;
+	}
+
+	void Reactor::set_nonblocking(socket_t s) {
+	#ifdef _WIN32
+		u_long mode = 1;
+		ioctlsocket(s, FIONBIO, &mode);
+	#else
+		fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+	#endif
+	}
+
+	bool Reactor::would_block() {
+	#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+	#else
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	#endif
+	}
+
+}
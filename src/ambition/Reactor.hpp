@@ -0,0 +1,170 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ambition/ByteBuffer.hpp>
+
+namespace ambition {
+
+	#ifdef _WIN32
+	using socket_t = uintptr_t;
+	#else
+	using socket_t = int;
+	#endif
+
+	// waits on any number of sockets from one thread and calls back the ones that are ready.
+	// uses epoll on linux, so the cost of an event doesn't depend on how many sockets are idle;
+	// elsewhere it falls back to select(), which is limited to FD_SETSIZE sockets. on linux 6.0 or
+	// newer io_uring can be asked for instead (see backends).
+	//
+	// readiness is edge-triggered: a handler is only called again once more data arrives (or more
+	// room frees up), so it must keep reading (or writing) until the socket would block.
+	class Reactor {
+	public:
+		enum events {
+			ev_read = 1,
+			ev_write = 2,
+			// error or hang-up; always reported
+			ev_error = 4
+		};
+
+		enum backends {
+			// epoll on linux, select() elsewhere or when built with AMBITION_REACTOR_SELECT
+			backend_default,
+			backend_select,
+			backend_epoll,
+			// the kernel accepts and receives by itself (multishot, into a ring of provided buffers)
+			// and whatever was asked for during a poll is submitted along with the next wait, so
+			// a busy socket costs no system calls of its own
+			backend_io_uring
+		};
+
+		// called on the polling thread with the events that occurred
+		using handler_t = std::function<void(unsigned events)>;
+
+		// called with each accepted socket, already non-blocking
+		using accept_handler_t = std::function<void(socket_t s)>;
+
+		// called with data as it arrives. an empty slice means the connection has gone, and error
+		// is 0 if the peer closed it cleanly. the slice shares the reactor's receive storage
+		using receive_handler_t = std::function<void(const byte_slice &data, int error)>;
+
+		// called once a send() has finished, with the bytes sent or -errno
+		using send_handler_t = std::function<void(int result)>;
+
+		struct Stats {
+			uint64_t polls;
+			// made by the reactor itself, including the reads and accepts it does for sockets
+			uint64_t syscalls;
+			// handlers run
+			uint64_t events;
+		};
+
+	private:
+		class ReactorImpl;
+		ReactorImpl *m_impl;
+
+	public:
+		explicit Reactor(int backend = backend_default);
+		Reactor(const Reactor &) = delete;
+		Reactor & operator=(const Reactor &) = delete;
+		~Reactor();
+
+		// these can be called from any thread, including from inside a handler
+		void add(socket_t s, unsigned events, handler_t handler);
+		void modify(socket_t s, unsigned events);
+
+		// accept connections on a listening socket for as long as it is watched
+		void add_acceptor(socket_t listener, accept_handler_t on_accept);
+
+		// read s on its behalf and hand over whatever arrives; handler gets the other events.
+		// ev_read is implied and stays on through modify()
+		void add_receiver(socket_t s, unsigned events, handler_t handler, receive_handler_t on_data);
+
+		// once this returns the socket's handler isn't running and won't be called again. called
+		// from another thread, it waits for a running handler to finish, even one that has just
+		// removed the socket itself.
+		void remove(socket_t s);
+
+		// wait up to timeout_ms (forever if negative) and run the handlers of ready sockets.
+		// only one thread may poll at a time. returns how many handlers ran
+		size_t poll(int timeout_ms);
+
+		// poll until stop() is called
+		void run();
+
+		// make run() return; safe to call from any thread
+		void stop();
+
+		// interrupt a poll() that is waiting
+		void wake();
+
+		// sockets being watched
+		size_t size() const;
+
+		// true if send() can be used
+		bool batches_sends() const;
+
+		// queue a send of data on s, to be submitted with the next wait. only on the polling thread,
+		// for a socket watched by this reactor, and one at a time per socket. the segments are kept
+		// alive until done is called, which doesn't happen if s is removed first
+		void send(socket_t s, const byte_chain &data, send_handler_t done);
+
+		bool on_poller_thread() const;
+
+		Stats stats() const;
+
+		// "epoll", "select" or "io_uring"
+		const char * name() const;
+
+		// what reactors are made with by default; the name of the default backend
+		static void set_default_backend(int backend);
+		static const char * backend();
+
+		// whether a backend was built in and works on this system
+		static bool available(int backend);
+
+		static void set_nonblocking(socket_t s);
+
+		// true if the last socket call failed only because it would have blocked
+		static bool would_block();
+	};
+
+	// a fixed set of reactor threads that sockets are spread across, so a process with many
+	// connections doesn't need a thread for each
+	class ReactorPool {
+	private:
+		static std::mutex m_mutex;
+		// only freed by stop(). a process that exits without stopping the pool leaves its threads
+		// running, so neither they nor their reactors can go with the statics
+		static std::vector<Reactor *> m_reactors;
+		static std::vector<std::thread *> m_threads;
+
+		static void startLocked(unsigned threads);
+
+	public:
+		// 0 threads means one per core, up to 4
+		static void start(unsigned threads = 0);
+
+		// all sockets must have been removed from the pool's reactors first. optional: without it
+		// the threads are left to end with the process
+		static void stop();
+
+		// the reactor with the fewest sockets; starts the pool if need be
+		static Reactor & next();
+
+		static size_t size();
+
+		static Reactor::Stats stats();
+	};
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <cassert>
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "Window.hpp"
@@ -199,19 +200,17 @@ namespace ambition {
 		vec3d bottomRight = (rotate * vec4d(TerrainChunk::normalFromUV(uvw.x()+size, uvw.y()+size), 0)).xyz<double>();
 
 		int mapSize = getResolutionForUVW(uvw) + 1;
-		vector<double> rawMap;
+		vector<double> rawMap(mapSize * mapSize);
 
-		for (int z = 0; z < mapSize; z++) {
-			for (int x = 0; x < mapSize; x++) {
-				//bilinear interpolation of sphere normals
-				vec3d top = topLeft * (mapSize - 1 - x) + topRight * x;
-				vec3d bottom = bottomLeft * (mapSize - 1 - x) + bottomRight * x;
-				vec3d mid = ~(top * (mapSize - 1 - z) + bottom * z);
+		parallel_for_2d(0, mapSize, 0, mapSize, [&](int x, int z) {
+			//bilinear interpolation of sphere normals
+			vec3d top = topLeft * (mapSize - 1 - x) + topRight * x;
+			vec3d bottom = bottomLeft * (mapSize - 1 - x) + bottomRight * x;
+			vec3d mid = ~(top * (mapSize - 1 - z) + bottom * z);
 
-				double perlinPoint = m_perlin.getNoise(mid.x(), mid.y(), mid.z(), 3);
-				rawMap.push_back(perlinPoint);
-			}
-		}
+			double perlinPoint = m_perlin.getNoise(mid.x(), mid.y(), mid.z(), 3);
+			rawMap[x + z * mapSize] = perlinPoint;
+		});
 
 		return HeightMap(rawMap, mapSize, mapSize, 0, 0);
 	}
@@ -238,56 +237,55 @@ namespace ambition {
 
 
 		int mapSize = getResolutionForUVW(uvw) + 1;
-		vector<double> rawMap;
-
-		for (int z = 0; z < mapSize; z++) {
-			for (int x = 0; x < mapSize; x++) {
-				//bilinear interpolation of sphere normals
-				vec3d top = topLeft * (mapSize - 1 - x) + topRight * x;
-				vec3d bottom = bottomLeft * (mapSize - 1 - x) + bottomRight * x;
-				vec3d mid = ~(top * (mapSize - 1 - z) + bottom * z);
-
-				// -0.5 to 0.5 is 1km, distance between humps is about 4km at 2048hz
-				auto perlin = [&](const Perlin &p_, double fq_) -> double {
-					return p_.getNoise(fq_ * mid.x(), fq_ * mid.y(), fq_ * mid.z());
-				};
-
-				double perlinPoint = 0;
-
-				double regionalNoise0 = std::atan(100 * perlin(m_perlin0, 32.0)) / initial3d::math::pi() + 0.5; //regional
-				double regionalNoise0small = std::atan(100 * (perlin(m_perlin0, 32.0)) - 0.25) / initial3d::math::pi() + 0.5;
-				double regionalNoise1 = std::atan(100 * perlin(m_perlin1, 64.0)) / initial3d::math::pi() + 0.5;
-				double regionalNoise2 = std::atan(100 * perlin(m_perlin2, 128.0)) / initial3d::math::pi() + 0.5;
-
-				//perlinPoint += 2 * perlin(m_perlin0, 2048);
-
-				double hillLine0 = std::exp(-5 * std::pow(perlin(m_perlin0, 9001), 2));
-				double hillLine1 = std::exp(-10 * std::pow(perlin(m_perlin1, 4096), 2));
-				double hillLine2 = std::exp(-5 * std::pow(perlin(m_perlin2, 2048), 2));
-
-				perlinPoint += 0.5 * hillLine0 * (perlin(m_perlin1, 2048) + 0.5) * regionalNoise0;
-				perlinPoint += 0.5 * hillLine1 * (perlin(m_perlin2, 2048) + 0.5) * regionalNoise0 * regionalNoise1;
-				perlinPoint += 0.25 * hillLine2 * (perlin(m_perlin0, 2048) + 0.5) * regionalNoise0 * regionalNoise1 * regionalNoise2;
-
-				//fine detail
-				int octaves = 20;
-				double amp = 0.1;
-				double fq = 2048;
-				for (int i = 0; i<octaves; i++, fq *= 1.8, amp *= 0.55) {
-					perlinPoint += amp * perlin(m_perlin0, fq);
-				}
-
-				//rocky detail
-				octaves = 20;
-				amp = 0.3;
-				fq = 2048;
-				for (int i = 0; i<octaves; i++, fq *= 1.8, amp *= 0.55) {
-					perlinPoint += amp * perlin(m_perlin1, fq) * regionalNoise0small;
-				}
+		vector<double> rawMap(mapSize * mapSize);
+
+		// noise is expensive, so a single chunk is worth spreading over the pool
+		parallel_for_2d(0, mapSize, 0, mapSize, [&](int x, int z) {
+			//bilinear interpolation of sphere normals
+			vec3d top = topLeft * (mapSize - 1 - x) + topRight * x;
+			vec3d bottom = bottomLeft * (mapSize - 1 - x) + bottomRight * x;
+			vec3d mid = ~(top * (mapSize - 1 - z) + bottom * z);
+
+			// -0.5 to 0.5 is 1km, distance between humps is about 4km at 2048hz
+			auto perlin = [&](const Perlin &p_, double fq_) -> double {
+				return p_.getNoise(fq_ * mid.x(), fq_ * mid.y(), fq_ * mid.z());
+			};
+
+			double perlinPoint = 0;
+
+			double regionalNoise0 = std::atan(100 * perlin(m_perlin0, 32.0)) / initial3d::math::pi() + 0.5; //regional
+			double regionalNoise0small = std::atan(100 * (perlin(m_perlin0, 32.0)) - 0.25) / initial3d::math::pi() + 0.5;
+			double regionalNoise1 = std::atan(100 * perlin(m_perlin1, 64.0)) / initial3d::math::pi() + 0.5;
+			double regionalNoise2 = std::atan(100 * perlin(m_perlin2, 128.0)) / initial3d::math::pi() + 0.5;
+
+			//perlinPoint += 2 * perlin(m_perlin0, 2048);
+
+			double hillLine0 = std::exp(-5 * std::pow(perlin(m_perlin0, 9001), 2));
+			double hillLine1 = std::exp(-10 * std::pow(perlin(m_perlin1, 4096), 2));
+			double hillLine2 = std::exp(-5 * std::pow(perlin(m_perlin2, 2048), 2));
+
+			perlinPoint += 0.5 * hillLine0 * (perlin(m_perlin1, 2048) + 0.5) * regionalNoise0;
+			perlinPoint += 0.5 * hillLine1 * (perlin(m_perlin2, 2048) + 0.5) * regionalNoise0 * regionalNoise1;
+			perlinPoint += 0.25 * hillLine2 * (perlin(m_perlin0, 2048) + 0.5) * regionalNoise0 * regionalNoise1 * regionalNoise2;
+
+			//fine detail
+			int octaves = 20;
+			double amp = 0.1;
+			double fq = 2048;
+			for (int i = 0; i<octaves; i++, fq *= 1.8, amp *= 0.55) {
+				perlinPoint += amp * perlin(m_perlin0, fq);
+			}
 
-				rawMap.push_back(perlinPoint);
+			//rocky detail
+			octaves = 20;
+			amp = 0.3;
+			fq = 2048;
+			for (int i = 0; i<octaves; i++, fq *= 1.8, amp *= 0.55) {
+				perlinPoint += amp * perlin(m_perlin1, fq) * regionalNoise0small;
 			}
-		}
+
+			rawMap[x + z * mapSize] = perlinPoint;
+		});
 
 		return HeightMap(rawMap, mapSize, mapSize, 0, 0);
 	}
@@ -417,7 +415,7 @@ namespace ambition {
 		return planet;
 	}
 
-	Planet::Planet(TerrainGen *tg) : m_terrainGen(tg) {  }
+	Planet::Planet(TerrainGen *tg) : m_terrainGen(tg), m_scheduler(AsyncExecutor::slow, 0, AsyncExecutor::stats("Terrain.generate")) {  }
 
 	double Planet::radius() {
 		return m_terrainGen->radius();
@@ -435,6 +433,14 @@ namespace ambition {
 		return m_terrainGen;
 	}
 
+	priority_scheduler<TerrainChunk *> & Planet::scheduler() {
+		return m_scheduler;
+	}
+
+	void Planet::update() {
+		m_scheduler.update();
+	}
+
 
 
 	TerrainChunk::TerrainChunk(Planet *p, const CubeFace &cf)
@@ -498,47 +504,52 @@ namespace ambition {
 		return m_transNode;
 	}
 
-	void TerrainChunk::procreate() {
-		if (m_children.empty() && !m_isPregnant) {
+	void TerrainChunk::procreate(double priority) {
+		if (!m_children.empty()) return;
 
-			m_isPregnant = true;
+		if (m_isPregnant) {
+			// still wanted this frame; keep the request alive with the new priority
+			m_planet->scheduler().refresh(this, priority);
+			return;
+		}
 
+		m_isPregnant = true;
+
+		// build the four children on the pool, then hook them up on the main thread.
+		// if we stop asking before it starts, the request is dropped and we can try again later
+		m_planet->scheduler().request(this, priority, [=] {
 			double hs = m_uvw.z() / 2;
 			vec3d topLeft(m_uvw.x(), m_uvw.y(), hs);
 			vec3d topRight(m_uvw.x() + hs, m_uvw.y(), hs);
 			vec3d bottomLeft(m_uvw.x(), m_uvw.y() + hs, hs);
 			vec3d bottomRight(m_uvw.x() + hs, m_uvw.y() + hs, hs);
 
-			AsyncExecutor::enqueueSlow([=](){
-				TerrainChunk *topLeftC = new TerrainChunk(this, topLeft);
-				TerrainChunk *topRightC = new TerrainChunk(this, topRight);
-				TerrainChunk *bottomLeftC = new TerrainChunk(this, bottomLeft);
-				TerrainChunk *bottomRightC = new TerrainChunk(this, bottomRight);
-
-				AsyncExecutor::enqueueMain([=](){
-					GPUCacheManager::add(topLeftC->m_geometry);
-					GPUCacheManager::add(topRightC->m_geometry);
-					GPUCacheManager::add(bottomLeftC->m_geometry);
-					GPUCacheManager::add(bottomRightC->m_geometry);
-
-					topLeftC->m_geometry->uploadMesh();
-					topRightC->m_geometry->uploadMesh();
-					bottomLeftC->m_geometry->uploadMesh();
-					bottomRightC->m_geometry->uploadMesh();
-
-					m_children.push_back(topLeftC);
-					m_children.push_back(topRightC);
-					m_children.push_back(bottomLeftC);
-					m_children.push_back(bottomRightC);
-
-					for (TerrainChunk *tc : m_children) {
-						m_childrenNode->addChild(tc->getSceneNode());
-					}
+			vector<TerrainChunk *> cs;
+			for (vec3d uvw : { topLeft, topRight, bottomLeft, bottomRight }) {
+				cs.push_back(new TerrainChunk(this, uvw));
+			}
 
-					m_isPregnant = false;
-				});
+			// upload one child per slice so the main thread can fit them around the frame;
+			// the children only appear once they're all uploaded
+			static task_stats * const upload_stats = AsyncExecutor::stats("Terrain.upload");
+			auto next = make_shared<size_t>(0);
+			AsyncExecutor::enqueueMainSliced(upload_stats, [=] {
+				TerrainChunk *tc = cs[(*next)++];
+				GPUCacheManager::add(tc->m_geometry);
+				tc->m_geometry->uploadMesh();
+				if (*next < cs.size()) return true;
+
+				for (TerrainChunk *tc : cs) {
+					m_children.push_back(tc);
+					m_childrenNode->addChild(tc->getSceneNode());
+				}
+
+				m_isPregnant = false;
+				return false;
 			});
-		}
+		}, [=] {
+			m_isPregnant = false;
+		});
 	}
 
 	void TerrainChunk::checkChildren() {
@@ -595,34 +606,34 @@ namespace ambition {
 		vec3d trans(floor(center.x()) * tSize, floor(center.y()) * tSize, floor(center.z()) * tSize);
 
 		//build mesh in planet space
-		vector<vec3d> meshPoints;
-		vector<vec3d> meshNormals;
-		vector<vec3d> meshTangents;
-		vector<vec3d> meshWorldCoord; //triplaner texture coords
-
-		for (int z = 0; z <= squares; z++) {
-			for (int x = 0; x <= squares; x++) {
-				//bilinear interpolation of sphere normals and tangents
-				vec3d top = topLeft * (squares - x) + topRight * x;
-				vec3d bottom = bottomLeft * (squares - x) + bottomRight * x;
-				vec3d mid = ~(top * (squares - z) + bottom * z);
-
-				vec3d top_t = topLeft_tangent * (squares - x) + topRight_tangent * x;
-				vec3d bottom_t = bottomLeft_tangent * (squares - x) + bottomRight_tangent * x;
-				vec3d mid_t = ~(top_t * (squares - z) + bottom_t * z);
-
-				//induction of point into planet space
-				vec3d planetPoint = (mid * (m_planet->radius() + (hm.getHeight(x/double(squares), z/double(squares)) * m_planet->scale())));
-				//transform to local space
-				vec3d localPoint = m_planetLocalMat * planetPoint;
-				meshPoints.push_back(localPoint);
-
-				meshNormals.push_back(mid);
-				meshTangents.push_back(mid_t);
-
-				meshWorldCoord.push_back(planetPoint - trans);
-			}
-		}
+		int meshSize = (squares + 1) * (squares + 1);
+		vector<vec3d> meshPoints(meshSize);
+		vector<vec3d> meshNormals(meshSize);
+		vector<vec3d> meshTangents(meshSize);
+		vector<vec3d> meshWorldCoord(meshSize); //triplaner texture coords
+
+		parallel_for_2d(0, squares + 1, 0, squares + 1, [&](int x, int z) {
+			//bilinear interpolation of sphere normals and tangents
+			vec3d top = topLeft * (squares - x) + topRight * x;
+			vec3d bottom = bottomLeft * (squares - x) + bottomRight * x;
+			vec3d mid = ~(top * (squares - z) + bottom * z);
+
+			vec3d top_t = topLeft_tangent * (squares - x) + topRight_tangent * x;
+			vec3d bottom_t = bottomLeft_tangent * (squares - x) + bottomRight_tangent * x;
+			vec3d mid_t = ~(top_t * (squares - z) + bottom_t * z);
+
+			//induction of point into planet space
+			vec3d planetPoint = (mid * (m_planet->radius() + (hm.getHeight(x/double(squares), z/double(squares)) * m_planet->scale())));
+			//transform to local space
+			vec3d localPoint = m_planetLocalMat * planetPoint;
+			int i = x + z * (squares + 1);
+			meshPoints[i] = localPoint;
+
+			meshNormals[i] = mid;
+			meshTangents[i] = mid_t;
+
+			meshWorldCoord[i] = planetPoint - trans;
+		});
 
 		auto get_index = [&](int x, int z) -> int {
 			// clamp to edge of heightmap
@@ -633,37 +644,36 @@ namespace ambition {
 			return x + z * (squares + 1);
 		};
 
-		for (int z = 0; z <= squares; z++) {
-			for (int x = 0; x <= squares; x++) {
-				//quick non-magic hack
-				vec3d cen = meshPoints[get_index(x, z)];
-				vec3d top = meshPoints[get_index(x, z-1)] - cen;
-				vec3d left = meshPoints[get_index(x-1, z)] - cen;
-				vec3d bottom = meshPoints[get_index(x, z+1)] - cen;
-				vec3d right = meshPoints[get_index(x+1, z)] - cen;
-				vec3d norm = vec3d::zero();
-				if (x > 0) {
-					if (z > 0) //topleft
-						norm += ~(top ^ left);
-					if (z < squares) //bottomleft
-						norm += ~(left ^ bottom);
-				}
-				if (x < squares) {
-					if (z > 0) //topright
-						norm += ~(right ^ top);
-					if (z < squares) //bottomright
-						norm += ~(bottom ^ right);
-				}
-				try {
-					vec3d bitang = meshTangents[get_index(x, z)] ^ meshNormals[get_index(x, z)];
-					meshNormals[get_index(x, z)] = (~norm); //TODO tangents
-					meshTangents[get_index(x, z)] = ~(meshNormals[get_index(x, z)] ^ bitang);
-				}
-				catch (nan_error &e) {
-					// just leave the normal like it was
-				}
+		// each point only writes its own normal and tangent
+		parallel_for_2d(0, squares + 1, 0, squares + 1, [&](int x, int z) {
+			//quick non-magic hack
+			vec3d cen = meshPoints[get_index(x, z)];
+			vec3d top = meshPoints[get_index(x, z-1)] - cen;
+			vec3d left = meshPoints[get_index(x-1, z)] - cen;
+			vec3d bottom = meshPoints[get_index(x, z+1)] - cen;
+			vec3d right = meshPoints[get_index(x+1, z)] - cen;
+			vec3d norm = vec3d::zero();
+			if (x > 0) {
+				if (z > 0) //topleft
+					norm += ~(top ^ left);
+				if (z < squares) //bottomleft
+					norm += ~(left ^ bottom);
 			}
-		}
+			if (x < squares) {
+				if (z > 0) //topright
+					norm += ~(right ^ top);
+				if (z < squares) //bottomright
+					norm += ~(bottom ^ right);
+			}
+			try {
+				vec3d bitang = meshTangents[get_index(x, z)] ^ meshNormals[get_index(x, z)];
+				meshNormals[get_index(x, z)] = (~norm); //TODO tangents
+				meshTangents[get_index(x, z)] = ~(meshNormals[get_index(x, z)] ^ bitang);
+			}
+			catch (nan_error &e) {
+				// just leave the normal like it was
+			}
+		});
 
 		m_geometry = new TerrainMesh(this, meshPoints, meshNormals, meshTangents, meshWorldCoord, squares + 1, m_planet);
 	}
@@ -672,11 +682,13 @@ namespace ambition {
 
 		auto lod_func = [=](vec3d camPos) -> vector<SceneNode *> {
 			vector<SceneNode *> ans;
-			if (m_geometry->getAABB().distance(camPos) < m_planet->radius() * m_uvw.z()) {
+			double dist = m_geometry->getAABB().distance(camPos);
+			if (dist < m_planet->radius() * m_uvw.z()) {
 				if (!m_children.empty()) {
 					ans.push_back(m_childrenNode);
 				} else {
-					procreate();
+					// roughly proportional to the chunk's size on screen
+					procreate(m_uvw.z() / max(dist, 1e-6));
 					ans.push_back(m_geoNode);
 				}
 			} else {
@@ -719,53 +731,33 @@ namespace ambition {
 	TerrainMesh::TerrainMesh(TerrainChunk *tc, const vector<vec3d>& points_, const vector<vec3d>& normals_,
 		const vector<vec3d>& tangents_, const vector<vec3d>& worldCoord_, int res, Planet *p_) : m_chunk(tc), m_res(res), m_vao(0) {
 
-		// dummy point at 0 index
-		m_points.push_back(0);
-		m_points.push_back(0);
-		m_points.push_back(0);
-
-		// dummy point at 0 index
-		m_normals.push_back(0);
-		m_normals.push_back(0);
-		m_normals.push_back(0);
-
-		// dummy point at 0 index
-		m_tangents.push_back(0);
-		m_tangents.push_back(0);
-		m_tangents.push_back(0);
-
-		// dummy point at 0 index
-		m_worldCoord.push_back(0);
-		m_worldCoord.push_back(0);
-		m_worldCoord.push_back(0);
-
 		double skirtStart = -1; //index of start of the skirt -1
 		double skirtEnd = res + 1; //index of end of the skirt -1
 
-		// generate actual points and find aabb
-		vec3d min = points_[0];
-		vec3d max = points_[0];
-		for (int i = skirtStart; i < skirtEnd; i++) {
+		// dummy point at 0 index, then (res + 2)^2 points including skirts and (dummy) corners
+		size_t vertexCount = 1 + size_t(res + 2) * size_t(res + 2);
+		m_points.assign(3 * vertexCount, 0);
+		m_normals.assign(3 * vertexCount, 0);
+		m_tangents.assign(3 * vertexCount, 0);
+		m_worldCoord.assign(3 * vertexCount, 0);
+
+		auto put = [](vector<float> &v, size_t vi, const vec3d &x) {
+			v[3 * vi] = x.x();
+			v[3 * vi + 1] = x.y();
+			v[3 * vi + 2] = x.z();
+		};
+
+		// generate actual points and find aabb, a row at a time
+		using bounds_t = pair<vec3d, vec3d>;
+		bounds_t bounds = parallel_reduce(int(skirtStart), int(skirtEnd), bounds_t(points_[0], points_[0]), [&](int i) {
+			vec3d min = points_[0];
+			vec3d max = points_[0];
 			for (int j = skirtStart; j < skirtEnd; j++) {
+				size_t vi = 1 + size_t(res + 2) * size_t(i + 1) + size_t(j + 1);
 				if (j == skirtStart || j == skirtEnd - 1 || i == skirtStart || i == skirtEnd - 1) { //point is either a skirt of corner
 					if ((j == skirtStart && (i == skirtStart || i == skirtEnd - 1))
 						|| (j == skirtEnd - 1 && (i == skirtStart || i == skirtEnd - 1))) { // dummy point at corner indexes, pointless but helps building ya know?
-						m_points.push_back(0);
-						m_points.push_back(0);
-						m_points.push_back(0);
-
-						m_normals.push_back(0);
-						m_normals.push_back(0);
-						m_normals.push_back(0);
-
-						m_tangents.push_back(0);
-						m_tangents.push_back(0);
-						m_tangents.push_back(0);
-
-						m_worldCoord.push_back(0);
-						m_worldCoord.push_back(0);
-						m_worldCoord.push_back(0);
-
+						// already zero
 					} else { //this point is a skirt so work out where it should go
 
 						//skirts need to be fixed, god help me TODO
@@ -778,19 +770,9 @@ namespace ambition {
 
 						min = vec3d::negative_extremes(min, sp);
 						max = vec3d::positive_extremes(max, sp);
-						m_points.push_back(sp.x());
-						m_points.push_back(sp.y());
-						m_points.push_back(sp.z());
-
-						vec3d n = normals_[modj + modi*res];
-						m_normals.push_back(n.x());
-						m_normals.push_back(n.y());
-						m_normals.push_back(n.z());
-
-						vec3d t = tangents_[modj + modi*res];
-						m_tangents.push_back(t.x());
-						m_tangents.push_back(t.y());
-						m_tangents.push_back(t.z());
+						put(m_points, vi, sp);
+						put(m_normals, vi, normals_[modj + modi*res]);
+						put(m_tangents, vi, tangents_[modj + modi*res]);
 
 						vec3d extension;
 						vec3d w = worldCoord_[modj + modi*res];
@@ -805,35 +787,24 @@ namespace ambition {
 						}
 						+extension = +diff;
 						//special handeling of the world texture pos of skirts
-						m_worldCoord.push_back(w.x() + extension.x());
-						m_worldCoord.push_back(w.y() + extension.y());
-						m_worldCoord.push_back(w.z() + extension.z());
+						put(m_worldCoord, vi, w + extension);
 					}
 				} else { //point is not a skirt or corner
 					vec3d p = points_[j + i*res];
 					min = vec3d::negative_extremes(min, p);
 					max = vec3d::positive_extremes(max, p);
-					m_points.push_back(p.x());
-					m_points.push_back(p.y());
-					m_points.push_back(p.z());
-
-					vec3d n = normals_[j + i*res];
-					m_normals.push_back(n.x());
-					m_normals.push_back(n.y());
-					m_normals.push_back(n.z());
-
-					vec3d t = tangents_[j + i*res];
-					m_tangents.push_back(t.x());
-					m_tangents.push_back(t.y());
-					m_tangents.push_back(t.z());
-
-					vec3d w = worldCoord_[j + i*res];
-					m_worldCoord.push_back(w.x());
-					m_worldCoord.push_back(w.y());
-					m_worldCoord.push_back(w.z());
+					put(m_points, vi, p);
+					put(m_normals, vi, normals_[j + i*res]);
+					put(m_tangents, vi, tangents_[j + i*res]);
+					put(m_worldCoord, vi, worldCoord_[j + i*res]);
 				}
 			}
-		}
+			return bounds_t(min, max);
+		}, [](const bounds_t &b0, const bounds_t &b1) {
+			return bounds_t(vec3d::negative_extremes(b0.first, b1.first), vec3d::positive_extremes(b0.second, b1.second));
+		});
+		vec3d min = bounds.first;
+		vec3d max = bounds.second;
 
 		m_aabb = aabb::fromMinMax(min, max);
 
@@ -841,7 +812,8 @@ namespace ambition {
 		// triangle vertex indices (m_indices)
 		// heightmap cell triangulation
 		// true -> link (+x,-z) diagonal
-		vector<bool> triangulation;
+		// (not vector<bool>, so cells can be written in parallel)
+		vector<unsigned char> triangulation((res - 1) * (res - 1));
 
 		//trianglation does not extend towards the skirts
 		auto get_triangulation = [&](int z, int x) -> bool {
@@ -887,24 +859,22 @@ namespace ambition {
 		};
 
 		// calculate triangulation
-		for (int z = 0; z < res - 1; z++) {
-			for (int x = 0; x < res - 1; x++) {
-				// curvature on (+x,-z) diagonal
-				float c0 = get_point(z + 2, x - 1).y() - get_point(z + 1, x).y() - get_point(z, x + 1).y() + get_point(z - 1, x + 2).y();
-				// curvature on (+x,+z) diagonal
-				float c1 = get_point(z - 1, x - 1).y() - get_point(z, x).y() - get_point(z + 1, x + 1).y() + get_point(z + 2, x + 2).y();
-				// local curvature on (+x,+z) diagonal using midpoint from (+x,-z) diagonal
-				float c1a = 2.0f * get_point(z, x).y() - get_point(z + 1, x).y() - get_point(z, x + 1).y() + 2.0f * get_point(z + 1, x + 1).y();
-				// local curvature on (+x,-z) diagonal using midpoint from (+x,+z) diagonal
-				float c0b = 2.0f * get_point(z + 1, x).y() - get_point(z, x).y() - get_point(z + 1, x + 1).y() + 2.0f * get_point(z, x + 1).y();
-
-				// calculate errors for each diagonal based on how well its midpoint matches the curvature
-				float err_a = math::abs(c0) + math::abs(c1a - c1);
-				float err_b = math::abs(c1) + math::abs(c0b - c0);
-
-				triangulation.push_back(err_a < err_b);
-			}
-		}
+		parallel_for_2d(0, res - 1, 0, res - 1, [&](int x, int z) {
+			// curvature on (+x,-z) diagonal
+			float c0 = get_point(z + 2, x - 1).y() - get_point(z + 1, x).y() - get_point(z, x + 1).y() + get_point(z - 1, x + 2).y();
+			// curvature on (+x,+z) diagonal
+			float c1 = get_point(z - 1, x - 1).y() - get_point(z, x).y() - get_point(z + 1, x + 1).y() + get_point(z + 2, x + 2).y();
+			// local curvature on (+x,+z) diagonal using midpoint from (+x,-z) diagonal
+			float c1a = 2.0f * get_point(z, x).y() - get_point(z + 1, x).y() - get_point(z, x + 1).y() + 2.0f * get_point(z + 1, x + 1).y();
+			// local curvature on (+x,-z) diagonal using midpoint from (+x,+z) diagonal
+			float c0b = 2.0f * get_point(z + 1, x).y() - get_point(z, x).y() - get_point(z + 1, x + 1).y() + 2.0f * get_point(z, x + 1).y();
+
+			// calculate errors for each diagonal based on how well its midpoint matches the curvature
+			float err_a = math::abs(c0) + math::abs(c1a - c1);
+			float err_b = math::abs(c1) + math::abs(c0b - c0);
+
+			triangulation[(res - 1) * z + x] = err_a < err_b;
+		});
 
 		// emit indices
 		for (int z = skirtStart; z < skirtEnd - 1; z++) {
@@ -14,6 +14,7 @@
 #include "Window.hpp"
 
 #include "Bound.hpp"
+#include "Concurrent.hpp"
 #include "GPUCache.hpp"
 #include "Initial3D.hpp"
 #include "Perlin.hpp"
@@ -147,10 +148,19 @@ namespace ambition {
 		double scale();
 		scenegraph::SceneNode * planetRoot();
 		TerrainGen * terrainGen();
+
+		// chunk generation requests, nearest / largest on screen first
+		priority_scheduler<TerrainChunk *> & scheduler();
+
+		// cancel chunk requests that weren't renewed this frame and start the best of the rest
+		// call once per frame, after drawing
+		void update();
 	private:
 		Planet(TerrainGen *);
 		TerrainGen * m_terrainGen;
 
+		priority_scheduler<TerrainChunk *> m_scheduler;
+
 		std::vector<TerrainChunk *> m_rootChunks;
 
 		scenegraph::SceneNode * m_planetRoot;
@@ -166,7 +176,7 @@ namespace ambition {
 
 		scenegraph::SceneNode * getSceneNode();
 
-		void procreate();
+		void procreate(double priority);
 		void checkChildren();
 		void checkSiblings();
 		bool isComatose();
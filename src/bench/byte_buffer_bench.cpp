@@ -0,0 +1,87 @@
+/*
+ * Compares byte_buffer's bulk array encode/decode against adding and reading one element at a time,
+ * for the kinds of arrays the terrain and vertex streams send.
+ *
+ * usage: byte_buffer_bench [elements] [repeats]
+ */
+
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <ambition/ByteBuffer.hpp>
+
+using namespace std;
+using namespace ambition;
+
+// returns throughput in GB/s of encoded data
+template <typename FuncT>
+double run(size_t bytes, unsigned repeats, FuncT func) {
+	// warm up
+	func();
+	auto time0 = chrono::steady_clock::now();
+	for (unsigned i = 0; i < repeats; i++) {
+		func();
+	}
+	auto time1 = chrono::steady_clock::now();
+	return double(bytes) * repeats / chrono::duration_cast<chrono::duration<double>>(time1 - time0).count() / 1e9;
+}
+
+template <typename T>
+void bench(const string &name, size_t count, unsigned repeats) {
+	vector<T> v(count);
+	for (size_t i = 0; i < count; i++) {
+		v[i] = T(i * 7 + 3);
+	}
+	vector<T> out(count);
+	size_t bytes = count * sizeof(T);
+	unsigned long long sink = 0;
+
+	double add_single = run(bytes, repeats, [&] {
+		byte_buffer bb;
+		for (const T &t : v) bb << t;
+		sink += bb.size();
+	});
+
+	double add_bulk = run(bytes, repeats, [&] {
+		byte_buffer bb;
+		bb.add_array(v.data(), v.size());
+		sink += bb.size();
+	});
+
+	byte_buffer encoded;
+	encoded.add_array(v.data(), v.size());
+
+	double get_single = run(bytes, repeats, [&] {
+		auto r = encoded.read();
+		for (size_t i = 0; i < count; i++) out[i] = r.get<T>();
+		sink += size_t(out[count - 1]);
+	});
+
+	double get_bulk = run(bytes, repeats, [&] {
+		auto r = encoded.read();
+		r.get_array(out.data(), count);
+		sink += size_t(out[count - 1]);
+	});
+
+	cout << setw(10) << name << fixed << setprecision(2)
+		<< setw(12) << add_single << setw(12) << add_bulk
+		<< setw(12) << get_single << setw(12) << get_bulk
+		<< "   (" << sink % 10 << ")" << endl;
+}
+
+int main(int argc, char **argv) {
+	size_t count = argc > 1 ? atoi(argv[1]) : 1 << 20;
+	unsigned repeats = argc > 2 ? atoi(argv[2]) : 20;
+
+	cout << "type        add/elem    add_array    get/elem   get_array   (GB/s)" << endl;
+	bench<float>("float", count, repeats);
+	bench<double>("double", count, repeats);
+	bench<uint16_t>("uint16_t", count, repeats);
+	bench<int32_t>("int32_t", count, repeats);
+	bench<uint64_t>("uint64_t", count, repeats);
+}
@@ -0,0 +1,90 @@
+/*
+ * Compression ratio and throughput at each deflate level, for a terrain-like height field
+ * and for a stream of small, similar messages with and without a preset dictionary.
+ *
+ * usage: compression_bench [tile size] [repeats]
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include <ambition/Compression.hpp>
+
+using namespace std;
+using namespace ambition;
+
+template <typename FuncT>
+double seconds(unsigned repeats, FuncT func) {
+	// warm up
+	func();
+	auto time0 = chrono::steady_clock::now();
+	for (unsigned i = 0; i < repeats; i++) {
+		func();
+	}
+	auto time1 = chrono::steady_clock::now();
+	return chrono::duration_cast<chrono::duration<double>>(time1 - time0).count() / repeats;
+}
+
+// heights and normals of a size x size tile, as the terrain stream sends them
+byte_buffer terrain_tile(size_t size) {
+	byte_buffer bb;
+	vector<int16_t> heights(size * size);
+	vector<float> normals(size * size * 3);
+	for (size_t y = 0; y < size; y++) {
+		for (size_t x = 0; x < size; x++) {
+			double h = 40 * sin(x * 0.05) * cos(y * 0.03) + 7 * sin(x * 0.31 + y * 0.17);
+			heights[y * size + x] = int16_t(h * 16);
+			normals[(y * size + x) * 3 + 0] = float(-cos(x * 0.05) * 0.2);
+			normals[(y * size + x) * 3 + 1] = 1.f;
+			normals[(y * size + x) * 3 + 2] = float(sin(y * 0.03) * 0.12);
+		}
+	}
+	bb.add_array(heights.data(), heights.size());
+	bb.add_array(normals.data(), normals.size());
+	return bb;
+}
+
+int main(int argc, char **argv) {
+	size_t tile = argc > 1 ? atoi(argv[1]) : 256;
+	unsigned repeats = argc > 2 ? atoi(argv[2]) : 10;
+
+	byte_buffer in = terrain_tile(tile);
+	cout << "terrain tile " << tile << "x" << tile << ", " << in.size() << " bytes" << endl;
+	cout << "level      ratio   compress MB/s   decompress MB/s" << endl;
+	for (int level = compression::level_none; level <= compression::level_best; level++) {
+		byte_buffer c;
+		double tc = seconds(repeats, [&] { c = compress(in.view(), level); });
+		double td = seconds(repeats, [&] { decompress(c.view()); });
+		cout << setw(5) << level << fixed << setprecision(2)
+			<< setw(11) << double(in.size()) / c.size()
+			<< setw(16) << in.size() / tc / 1e6
+			<< setw(18) << in.size() / td / 1e6 << endl;
+	}
+
+	string dictionary = "{\"type\":\"entity_update\",\"id\":,\"position\":[,,],\"velocity\":[0,0,0],\"state\":\"idle\"}";
+	byte_view dict(reinterpret_cast<const byte_t *>(dictionary.data()), dictionary.size());
+	vector<string> messages;
+	for (int i = 0; i < 2000; i++) {
+		messages.push_back("{\"type\":\"entity_update\",\"id\":" + to_string(i % 50) + ",\"position\":["
+			+ to_string(i * 3 % 97) + "," + to_string(i % 13) + ",4],\"velocity\":[0,0,0],\"state\":\"idle\"}");
+	}
+	cout << endl << "2000 small messages, level " << compression::level_default << endl;
+	cout << "mode                  bytes in   bytes out" << endl;
+	const char *names[] = { "per message", "stream", "stream + dictionary" };
+	for (int mode = 0; mode < 3; mode++) {
+		deflate_stream tx(compression::level_default, mode == 2 ? dict : byte_view());
+		size_t n_in = 0, n_out = 0;
+		for (const string &m : messages) {
+			byte_view v(reinterpret_cast<const byte_t *>(m.data()), m.size());
+			n_in += m.size();
+			n_out += mode == 0 ? compress(v).size() : tx.compress(v).size();
+		}
+		cout << setw(20) << left << names[mode] << right << setw(11) << n_in << setw(12) << n_out << endl;
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ * Compares mpsc_queue against blocking_queue for the AsyncExecutor use case:
+ * several producer threads posting tasks to one consumer thread.
+ *
+ * usage: concurrent_bench [max_producers] [tasks_per_producer]
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <ambition/Concurrent.hpp>
+
+using namespace std;
+using namespace ambition;
+
+using task_t = AsyncExecutor::task_t;
+
+// returns consumer throughput in tasks per second
+template <typename PushT, typename DrainT>
+double run(unsigned producers, unsigned per_producer, PushT push, DrainT drain) {
+	atomic<unsigned> ready(0);
+	atomic<bool> go(false);
+	unsigned long long sum = 0;
+	vector<thread> threads;
+	for (unsigned p = 0; p < producers; p++) {
+		threads.push_back(thread([&] {
+			ready++;
+			while (!go) this_thread::yield();
+			for (unsigned i = 0; i < per_producer; i++) {
+				push(task_t([&sum] { sum++; }));
+			}
+		}));
+	}
+	while (ready < producers) this_thread::yield();
+	auto time0 = chrono::steady_clock::now();
+	go = true;
+	unsigned long long total = (unsigned long long)(producers) * per_producer;
+	while (sum < total) {
+		drain();
+	}
+	auto time1 = chrono::steady_clock::now();
+	for (auto &t : threads) t.join();
+	return total / chrono::duration_cast<chrono::duration<double>>(time1 - time0).count();
+}
+
+int main(int argc, char **argv) {
+	unsigned max_producers = argc > 1 ? atoi(argv[1]) : max(2u, thread::hardware_concurrency());
+	unsigned per_producer = argc > 2 ? atoi(argv[2]) : 200000;
+
+	cout << "producers  blocking_queue  mpsc_overflow_queue  mpsc_queue   (Mtask/s)" << endl;
+
+	for (unsigned p = 1; p <= max_producers; p++) {
+		blocking_queue<task_t> bq;
+		double bq_rate = run(p, per_producer,
+			[&](const task_t &t) { bq.push(t); },
+			[&] {
+				// same as the old execute(): one pop under the lock per task
+				task_t t;
+				while (bq.pop(t)) t();
+			}
+		);
+
+		// what AsyncExecutor now uses for the main thread
+		mpsc_overflow_queue<task_t> oq(4096);
+		double oq_rate = run(p, per_producer,
+			[&](const task_t &t) { oq.push(t); },
+			[&] {
+				task_t t;
+				while (oq.pop(t)) t();
+			}
+		);
+
+		// the bare ring, big enough that it never fills
+		mpsc_queue<task_t> mq(size_t(p) * per_producer);
+		double mq_rate = run(p, per_producer,
+			[&](const task_t &t) { mq.try_push(t); },
+			[&] { mq.drain([](task_t &&t) { t(); }, 64); }
+		);
+
+		cout << setw(9) << p << "  "
+			<< setw(14) << fixed << setprecision(2) << bq_rate / 1e6 << "  "
+			<< setw(19) << oq_rate / 1e6 << "  "
+			<< setw(10) << mq_rate / 1e6 << endl;
+	}
+}
@@ -0,0 +1,139 @@
+/*
+ * Echo server load on each reactor backend: many clients each keep one message in flight, and the
+ * server's system calls per message and the round trip latency are measured. Giving the server
+ * more reactors shards its connections across that many threads, each with its own listener.
+ *
+ * usage: socket_bench [clients] [rounds] [message size] [client threads] [server reactors]
+ */
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <ambition/Concurrent.hpp>
+#include <ambition/ListenSocket.hpp>
+#include <ambition/Reactor.hpp>
+
+#ifdef _WIN32
+int main() {
+	std::cout << "socket_bench needs POSIX sockets" << std::endl;
+}
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace ambition;
+
+// every socket sends a message, then waits for each echo in turn, rounds times over
+void client(const vector<int> &socks, unsigned rounds, size_t size, latency_histogram &latency) {
+	vector<uint8_t> out(size, 0x5A), in(size);
+	vector<chrono::steady_clock::time_point> sent(socks.size());
+	for (unsigned r = 0; r < rounds; r++) {
+		for (size_t i = 0; i < socks.size(); i++) {
+			sent[i] = chrono::steady_clock::now();
+			if (send(socks[i], out.data(), size, 0) != ssize_t(size)) return;
+		}
+		for (size_t i = 0; i < socks.size(); i++) {
+			size_t got = 0;
+			while (got < size) {
+				ssize_t rx = recv(socks[i], in.data() + got, size - got, 0);
+				if (rx <= 0) return;
+				got += rx;
+			}
+			latency.record(chrono::steady_clock::now() - sent[i]);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	unsigned clients = argc > 1 ? atoi(argv[1]) : 500;
+	unsigned rounds = argc > 2 ? atoi(argv[2]) : 200;
+	size_t size = argc > 3 ? atoi(argv[3]) : 64;
+	unsigned threads = argc > 4 ? atoi(argv[4]) : 4;
+	unsigned reactors = argc > 5 ? atoi(argv[5]) : 1;
+
+	cout << clients << " clients, " << rounds << " rounds of " << size << " bytes, " << threads << " client threads, "
+		<< reactors << " server reactors" << endl;
+	cout << "backend    msgs/s   syscalls/msg   polls/msg   p50 us   p99 us" << endl;
+	const int backends[] = { Reactor::backend_select, Reactor::backend_epoll, Reactor::backend_io_uring };
+	for (int backend : backends) {
+		if (!Reactor::available(backend)) continue;
+		// select() can't watch descriptors past FD_SETSIZE
+		if (backend == Reactor::backend_select && clients * 2 + 32 * reactors > FD_SETSIZE) continue;
+		Reactor::set_default_backend(backend);
+
+		ListenSocket server(0, reactors);
+		mutex accepted_mutex;
+		vector<ClientSocket *> accepted;
+		server.on_accepted.attach([&](const SocketResult &sr) {
+			sr.client->on_recieved.attach([](const SocketResult &r) {
+				r.client->begin_send(byte_chain(r.data));
+				return false;
+			});
+			lock_guard<mutex> lock(accepted_mutex);
+			accepted.push_back(sr.client);
+			return false;
+		});
+
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(server.listen_port());
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		vector<vector<int>> socks(threads);
+		for (unsigned i = 0; i < clients; i++) {
+			int s = socket(AF_INET, SOCK_STREAM, 0);
+			int one = 1;
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			if (connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+				cout << "connect failed: " << strerror(errno) << endl;
+				return 1;
+			}
+			socks[i % threads].push_back(s);
+		}
+		for (;; this_thread::yield()) {
+			lock_guard<mutex> lock(accepted_mutex);
+			if (accepted.size() == clients) break;
+		}
+
+		latency_histogram latency;
+		Reactor::Stats before = server.reactor_stats();
+		auto time0 = chrono::steady_clock::now();
+		vector<thread> workers;
+		for (unsigned t = 0; t < threads; t++) {
+			workers.push_back(thread(client, cref(socks[t]), rounds, size, ref(latency)));
+		}
+		for (auto &w : workers) w.join();
+		double secs = chrono::duration_cast<chrono::duration<double>>(chrono::steady_clock::now() - time0).count();
+		Reactor::Stats after = server.reactor_stats();
+
+		uint64_t send_calls = 0;
+		{
+			lock_guard<mutex> lock(accepted_mutex);
+			for (ClientSocket *cs : accepted) send_calls += cs->send_stats().send_calls;
+		}
+		double messages = double(latency.count());
+		cout << setw(8) << left << Reactor::backend() << right << fixed
+			<< setw(10) << setprecision(0) << messages / secs
+			<< setw(15) << setprecision(2) << (after.syscalls - before.syscalls + send_calls) / messages
+			<< setw(12) << setprecision(3) << (after.polls - before.polls) / messages
+			<< setw(9) << setprecision(1) << latency.percentile(50).count() / 1e3
+			<< setw(9) << latency.percentile(99).count() / 1e3 << endl;
+
+		for (auto &v : socks) {
+			for (int s : v) close(s);
+		}
+	}
+}
+#endif
@@ -7,6 +7,7 @@
 #include <iomanip>
 #include <thread>
 #include <random>
+#include <sstream>
 
 // ambition includes should be done like this, using <>
 #include <ambition/Initial3D.hpp>
@@ -221,19 +222,34 @@ void draw_stars_points() {
 	glBindVertexArray(0);
 }
 
-void display(int w, int h) {
-	if (w == 0 || h == 0) return;
-	
+// per-frame state shared between the stages of the frame graph
+struct {
+	int w = 0, h = 0;
 	// the far plane
-	float zfar = 20000000.0f;
+	float zfar = 0;
+	mat4d proj_matrix;
+	mat4d view_matrix;
+	SceneRenderer sr;
+} frame;
+
+TaskGraph frame_graph;
+
+void display_camera() {
+	frame.zfar = 20000000.0f;
 	
 	cameraController->update();
-	cam->setPerspectiveProjection(math::pi() / 3, double(w) / h, 0.1, zfar);
+	cam->setPerspectiveProjection(math::pi() / 3, double(frame.w) / frame.h, 0.1, frame.zfar);
 	
-	mat4d proj_matrix = cam->getProjectionTransform();
+	frame.proj_matrix = cam->getProjectionTransform();
 	// TODO properly get planet -> view matrix
-	mat4d view_matrix = !cameraController->getTransform();
-	
+	frame.view_matrix = !cameraController->getTransform();
+}
+
+void display_background() {
+	const float zfar = frame.zfar;
+	const mat4d &proj_matrix = frame.proj_matrix;
+	const mat4d &view_matrix = frame.view_matrix;
+
 	//
 	// assemble scene buffer
 	//
@@ -278,12 +294,16 @@ void display(int w, int h) {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LEQUAL);
 	checkGL();
+}
 
+// runs on the worker pool, overlapping with the background
+void display_traverse() {
 	//traverse the scenegraph for geometry
-	SceneRenderer sr;
-	sr.traverse(scene);
-	draw_call_count = sr.getDrawQueue().getDrawCalls().size();
+	frame.sr.traverse(scene);
+	draw_call_count = frame.sr.getDrawQueue().getDrawCalls().size();
+}
 
+void display_geometry() {
 	// glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
@@ -295,7 +315,7 @@ void display(int w, int h) {
 	glClear(GL_STENCIL_BUFFER_BIT);
 	
 	if (true) {
-		sr.getDrawQueue().execute(shaderman);
+		frame.sr.getDrawQueue().execute(shaderman);
 	}
 
 	glDisable(GL_STENCIL_TEST);
@@ -307,6 +327,13 @@ void display(int w, int h) {
 	
 	glFinish();
 	checkGL();
+}
+
+void display_deferred() {
+	const int w = frame.w, h = frame.h;
+	const float zfar = frame.zfar;
+	const mat4d &proj_matrix = frame.proj_matrix;
+	const mat4d &view_matrix = frame.view_matrix;
 
 	// bind textures for deferred shading etc
 	enum { tu_z = 0, tu_normal, tu_diffuse, tu_l0, tu_stencil };
@@ -379,8 +406,25 @@ void display(int w, int h) {
 	glUseProgram(0);
 	glFinish();
 	checkGL();
+}
 
-	
+void display(int w, int h) {
+	if (w == 0 || h == 0) return;
+
+	frame.w = w;
+	frame.h = h;
+
+	if (frame_graph.size() == 0) {
+		// GL work has to stay on this thread; only the traversal goes to the pool.
+		// it runs as a fast task, which always has a worker free even while terrain generation fills the rest.
+		auto camera = frame_graph.add("camera", AsyncExecutor::main, display_camera);
+		auto background = frame_graph.add("background", AsyncExecutor::main, display_background, { camera });
+		auto traverse = frame_graph.add("traverse", AsyncExecutor::fast, display_traverse, { camera });
+		auto geometry = frame_graph.add("geometry", AsyncExecutor::main, display_geometry, { background, traverse });
+		frame_graph.add("deferred", AsyncExecutor::main, display_deferred, { geometry });
+	}
+
+	frame_graph.run();
 }
 
 template <typename ClockT>
@@ -418,14 +462,16 @@ int main(void) {
 
 	Window *window2 = createWindow().share(window).title("LALALALALALALALALA");
 
-	// give ownership of the second context to AsyncExecutor's 'fast' thread
-	AsyncExecutor::enqueueFast([=] {
+	// give ownership of the second context to AsyncExecutor's first worker thread.
+	// pool tasks can run on any worker, so GL work has to be sent to that thread explicitly.
+	std::thread::id gl_worker_id = AsyncExecutor::workerThreadID(0);
+	AsyncExecutor::enqueue(gl_worker_id, [=] {
 		window2->makeContextCurrent();
 		// window2->visible(true); // but not really
 	});
 
 	// test background GL
-	AsyncExecutor::enqueueFast([=] {
+	AsyncExecutor::enqueue(gl_worker_id, [=] {
 
 		// just check this works
 		assert(Window::currentContext() == window2);
@@ -523,19 +569,28 @@ int main(void) {
 	double lastFPSTime = glfwGetTime();
 	int fps = 0;
 
+	// main thread tasks get whatever is left of this after drawing, but always a little
+	const auto frame_budget = chrono::microseconds(16667);
+	const auto min_task_time = chrono::milliseconds(1);
+
 	do {
+		auto frame_start = chrono::steady_clock::now();
 		double now = glfwGetTime();
 		glfwPollEvents();
-		
-		AsyncExecutor::execute(chrono::milliseconds(2));
 
 		if (sun_moving) {
 			sun_ori = quatd::axisangle(vec3d::i(), sun_speed * (now - lastTime)) * sun_ori;
 		}
 
 		display(window->width(), window->height());
+
+		// chunks not asked for again while drawing this frame are no longer wanted
+		p->update();
 		
 		glFinish();
+
+		AsyncExecutor::executeUntil(max(frame_start + frame_budget, chrono::steady_clock::now() + min_task_time));
+
 		window->swapBuffers();
 		
 		if (now - lastFPSTime > 1) {
@@ -546,6 +601,13 @@ int main(void) {
 				GPUCacheManager::getMaxMemory() / 1024 / 1024,
 				100.0 * double(GPUCacheManager::getCurrentMemory()) / double(GPUCacheManager::getMaxMemory()));
 			window->title(fpsString);
+			// where the last frame's time went
+			ostringstream path;
+			for (auto node : frame_graph.criticalPath()) {
+				path << " " << frame_graph.name(node) << " " << fixed << setprecision(2) << frame_graph.timing(node).duration.count() << "ms";
+			}
+			log("Frame") % 3 << "Critical path (" << frame_graph.totalTime().count() << "ms):" << path.str();
+			AsyncExecutor::logStats(3);
 			fps = 0;
 			lastFPSTime = now;
 		}
@@ -0,0 +1,87 @@
+#include "gtest/gtest.h"
+#include "ambition/Compression.hpp"
+#include "ambition/Error.hpp"
+using namespace ambition;
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+	// repetitive but not trivially so, like a terrain tile
+	std::vector<byte_t> sample(size_t size, unsigned seed) {
+		std::vector<byte_t> v(size);
+		unsigned x = seed;
+		for (size_t i = 0; i < size; i++) {
+			x = x * 1103515245u + 12345u;
+			v[i] = byte_t((i / 16) % 32 + (i % 8 ? 0 : (x >> 16) & 3));
+		}
+		return v;
+	}
+
+	byte_view view_of(const std::vector<byte_t> &v) {
+		return byte_view(v.data(), v.size());
+	}
+
+	byte_view view_of(const std::string &s) {
+		return byte_view(reinterpret_cast<const byte_t *>(s.data()), s.size());
+	}
+}
+
+TEST(compression, MessageRoundTripEveryLevel) {
+	std::vector<byte_t> in = sample(200000, 1);
+	for (int level = compression::level_none; level <= compression::level_best; level++) {
+		byte_buffer c = compress(view_of(in), level);
+		if (level >= compression::level_fastest) {
+			EXPECT_LT(c.size(), in.size() / 3) << "level " << level;
+		}
+		byte_buffer d = decompress(c.view());
+		ASSERT_EQ(d.size(), in.size());
+		EXPECT_EQ(std::memcmp(d.data(), in.data(), in.size()), 0);
+	}
+	byte_buffer empty = compress(byte_view());
+	EXPECT_EQ(decompress(empty.view()).size(), 0u);
+}
+
+TEST(compression, CorruptDataThrows) {
+	std::vector<byte_t> in = sample(10000, 2);
+	byte_buffer c = compress(view_of(in));
+	EXPECT_THROW(decompress(c.view().slice(0, c.size() / 2)), network_error);
+	byte_buffer lying;
+	lying << varint<uint64_t>(in.size() + 1);
+	lying.add_array(c.data() + 2, c.size() - 2);
+	EXPECT_THROW(decompress(lying.view()), network_error);
+	byte_buffer huge;
+	huge << varint<uint64_t>(uint64_t(1) << 40) << uint32_t(0);
+	EXPECT_THROW(decompress(huge.view()), network_error);
+}
+
+TEST(compression, StreamKeepsWindowAcrossMessages) {
+	std::string dictionary = "{\"type\":\"chunk_update\",\"position\":[0,0,0],\"material\":\"";
+	compression_offer a, b;
+	a.max_level = compression::level_best;
+	a.dictionary_id = compression::dictionary_id(view_of(dictionary));
+	b.max_level = compression::level_fastest;
+	b.dictionary_id = a.dictionary_id;
+	compression_settings s = negotiate(a, b);
+	EXPECT_EQ(s.level, compression::level_fastest);
+	EXPECT_EQ(s.dictionary_id, a.dictionary_id);
+	b.dictionary_id = 0;
+	EXPECT_EQ(negotiate(a, b).dictionary_id, 0u);
+
+	deflate_stream tx(s.level, view_of(dictionary));
+	inflate_stream rx(view_of(dictionary));
+	deflate_stream tx_plain(s.level);
+	size_t plain_size = 0;
+	size_t dict_size = 0;
+	for (int i = 0; i < 20; i++) {
+		std::string msg = "{\"type\":\"chunk_update\",\"position\":[" + std::to_string(i) + ",0,0],\"material\":\"stone\"}";
+		byte_buffer c = tx.compress(view_of(msg));
+		dict_size += c.size();
+		plain_size += tx_plain.compress(view_of(msg)).size();
+		byte_buffer d = rx.decompress(c.view());
+		ASSERT_EQ(std::string(reinterpret_cast<const char *>(d.data()), d.size()), msg);
+	}
+	EXPECT_LT(dict_size, plain_size);
+	EXPECT_EQ(tx.bytes_out(), dict_size);
+}
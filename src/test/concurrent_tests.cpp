@@ -0,0 +1,748 @@
+#include "gtest/gtest.h"
+#include "ambition/Concurrent.hpp"
+using namespace ambition;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+	// AsyncExecutor is global; start it once for all tests in this file
+	struct executor_environment : public ::testing::Environment {
+		void SetUp() override {
+			Log::stdErr().mute(true);
+			AsyncExecutor::start(4);
+		}
+
+		void TearDown() override {
+			AsyncExecutor::stop();
+		}
+	};
+
+	::testing::Environment * const executor_env = ::testing::AddGlobalTestEnvironment(new executor_environment);
+
+	template <typename PredT>
+	bool wait_until(PredT pred, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+		auto time1 = std::chrono::steady_clock::now() + timeout;
+		while (!pred()) {
+			if (std::chrono::steady_clock::now() > time1) return false;
+			std::this_thread::yield();
+		}
+		return true;
+	}
+}
+
+TEST(InterruptManager, InterruptBeforeWait) {
+	blocking_queue<int> q;
+	std::atomic<bool> go(false), interrupted(false);
+	std::thread t([&] {
+		wait_until([&] { return bool(go); });
+		try {
+			q.pop();
+		} catch (interruption &) {
+			interrupted = true;
+		}
+	});
+	// scheduled before the thread has ever waited
+	InterruptManager::interrupt(t.get_id());
+	go = true;
+	t.join();
+	EXPECT_TRUE(interrupted);
+}
+
+TEST(InterruptManager, InterruptWakesOnlyThatThread) {
+	blocking_queue<int> q;
+	std::atomic<int> interrupted(0), popped(0);
+	auto body = [&] {
+		try {
+			q.pop();
+			popped++;
+		} catch (interruption &) {
+			interrupted++;
+		}
+	};
+	std::thread t1(body), t2(body);
+	std::thread::id id1 = t1.get_id();
+	InterruptManager::interrupt(id1);
+	t1.join();
+	EXPECT_EQ(interrupted, 1);
+	q.push(1);
+	t2.join();
+	EXPECT_EQ(popped, 1);
+	EXPECT_EQ(interrupted, 1);
+}
+
+TEST(InterruptManager, InterruptAllWaitersOnCondition) {
+	std::mutex m;
+	std::condition_variable cond;
+	int waiting = 0;
+	std::atomic<int> interrupted(0);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 3; i++) {
+		threads.push_back(std::thread([&] {
+			std::unique_lock<std::mutex> lock(m);
+			waiting++;
+			try {
+				while (true) InterruptManager::wait(cond, lock);
+			} catch (interruption &) {
+				interrupted++;
+			}
+		}));
+	}
+	// once we hold the mutex with all 3 registered, they must all be inside wait()
+	wait_until([&] { std::lock_guard<std::mutex> lock(m); return waiting == 3; });
+	{
+		std::lock_guard<std::mutex> lock(m);
+		InterruptManager::interrupt(cond);
+	}
+	for (auto &t : threads) t.join();
+	EXPECT_EQ(interrupted, 3);
+}
+
+TEST(Event, ObserverCanDetachItself) {
+	Event<int> e;
+	int once = 0, always = 0;
+	e.attach([&](const int &) { once++; return true; });
+	unsigned key = e.attach([&](const int &x) { always += x; return false; });
+	e.notify(1);
+	e.notify(2);
+	EXPECT_EQ(once, 1);
+	EXPECT_EQ(always, 3);
+	EXPECT_TRUE(e.detach(key));
+	EXPECT_FALSE(e.detach(key));
+	e.notify(4);
+	EXPECT_EQ(always, 3);
+}
+
+TEST(Event, AttachDuringConcurrentNotify) {
+	Event<int> e;
+	std::atomic<int> calls(0);
+	std::atomic<bool> stop(false);
+	e.attach([&](const int &) { calls++; return false; });
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 3; i++) {
+		threads.push_back(std::thread([&] {
+			while (!stop) e.notify(0);
+		}));
+	}
+	// observers come and go while other threads are notifying
+	for (int i = 0; i < 200; i++) {
+		unsigned key = e.attach([](const int &) { return false; });
+		e.detach(key);
+		e.attach([](const int &) { return true; });
+	}
+	wait_until([&] { return calls > 1000; });
+	stop = true;
+	for (auto &t : threads) t.join();
+	EXPECT_GT(calls, 1000);
+}
+
+TEST(Event, DeferredDispatch) {
+	std::atomic<int> total(0);
+	std::atomic<bool> on_worker(false);
+	Event<int> e(AsyncExecutor::dispatcher(AsyncExecutor::slow));
+	e.attach([&](const int &x) {
+		for (unsigned i = 0; i < AsyncExecutor::workerCount(); i++) {
+			if (AsyncExecutor::workerThreadID(i) == std::this_thread::get_id()) on_worker = true;
+		}
+		total += x;
+		return false;
+	});
+	for (int i = 1; i <= 10; i++) e.notify(i);
+	EXPECT_TRUE(wait_until([&] { return total == 55; }));
+	EXPECT_TRUE(on_worker);
+}
+
+TEST(Event, WaitWakesOnNotify) {
+	Event<int> e;
+	std::atomic<bool> waiting(false), fired(false);
+	std::thread t([&] {
+		waiting = true;
+		// wait() returns false on spurious wakeup
+		while (!e.wait());
+		fired = true;
+	});
+	wait_until([&] { return bool(waiting); });
+	// keep notifying until the waiter has actually started waiting and seen one
+	while (!wait_until([&] { return bool(fired); }, std::chrono::milliseconds(10))) {
+		e.notify(0);
+	}
+	t.join();
+	EXPECT_TRUE(fired);
+}
+
+TEST(work_deque, OwnerLifoThiefFifo) {
+	work_deque<int> d;
+	d.push(1);
+	d.push(2);
+	d.push(3);
+	int x = 0;
+	EXPECT_TRUE(d.pop(x));
+	EXPECT_EQ(x, 3);
+	EXPECT_TRUE(d.steal(x));
+	EXPECT_EQ(x, 1);
+	EXPECT_TRUE(d.pop(x));
+	EXPECT_EQ(x, 2);
+	EXPECT_FALSE(d.steal(x));
+}
+
+TEST(mpsc_queue, BoundedFifo) {
+	mpsc_queue<int> q(4);
+	EXPECT_EQ(q.capacity(), 4u);
+	EXPECT_TRUE(q.empty());
+	for (int i = 0; i < 4; i++) EXPECT_TRUE(q.try_push(i));
+	EXPECT_FALSE(q.try_push(4));
+	int x = -1;
+	EXPECT_TRUE(q.try_pop(x));
+	EXPECT_EQ(x, 0);
+	EXPECT_TRUE(q.try_push(4));
+	std::vector<int> out;
+	size_t drained = q.drain([&](int &&v) { out.push_back(v); }, 10);
+	EXPECT_EQ(drained, 4u);
+	EXPECT_EQ(out, std::vector<int>({ 1, 2, 3, 4 }));
+	EXPECT_TRUE(q.empty());
+}
+
+TEST(mpsc_overflow_queue, ManyProducersNoLoss) {
+	const int producers = 4, per_producer = 10000;
+	// deliberately tiny ring so the overflow path gets exercised
+	mpsc_overflow_queue<int> q(16);
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++) {
+		threads.push_back(std::thread([&, p] {
+			for (int i = 0; i < per_producer; i++) q.push(p * per_producer + i);
+		}));
+	}
+	std::vector<int> last(producers, -1);
+	int count = 0;
+	while (count < producers * per_producer) {
+		int v;
+		if (!q.pop(v)) {
+			std::this_thread::yield();
+			continue;
+		}
+		// each producer's items must come out in the order they went in
+		EXPECT_GT(v % per_producer, last[v / per_producer]);
+		last[v / per_producer] = v % per_producer;
+		count++;
+	}
+	for (auto &t : threads) t.join();
+	EXPECT_TRUE(q.empty());
+}
+
+TEST(AsyncExecutor, EnqueueMainBatches) {
+	std::atomic<int> done(0);
+	std::thread producer([&] {
+		for (int i = 0; i < 10000; i++) AsyncExecutor::enqueueMain([&] { done++; });
+	});
+	producer.join();
+	while (done < 10000) AsyncExecutor::execute(std::chrono::milliseconds(2));
+	EXPECT_EQ(done, 10000);
+}
+
+TEST(AsyncExecutor, MainTasksPackIntoBudget) {
+	std::vector<int> order;
+	AsyncExecutor::enqueueMain([&] { order.push_back(1); }, std::chrono::hours(1));
+	AsyncExecutor::enqueueMain([&] { order.push_back(2); });
+	AsyncExecutor::enqueueMain([&] { order.push_back(3); }, std::chrono::microseconds(1));
+	AsyncExecutor::execute(std::chrono::milliseconds(50));
+	// the task that can't fit is passed over, but only so many times
+	EXPECT_EQ(order, (std::vector<int> { 2, 3 }));
+	EXPECT_EQ(AsyncExecutor::mainQueueDepth(), 1);
+	for (int i = 0; i < 10 && order.size() < 3; i++) AsyncExecutor::execute(std::chrono::milliseconds(0));
+	EXPECT_EQ(order, (std::vector<int> { 2, 3, 1 }));
+	EXPECT_EQ(AsyncExecutor::mainQueueDepth(), 0);
+}
+
+TEST(AsyncExecutor, MainTaskOfUnknownCostRunsPastDeadline) {
+	int runs = 0;
+	AsyncExecutor::enqueueMain([&] { runs++; });
+	AsyncExecutor::executeUntil(std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+	EXPECT_EQ(runs, 1);
+	EXPECT_EQ(AsyncExecutor::mainQueueDepth(), 0);
+}
+
+TEST(AsyncExecutor, SlicedMainTasksResumeAndLearnCost) {
+	static int run = 0;
+	task_stats *ts = AsyncExecutor::stats("test.sliced" + std::to_string(run++));
+	int slices = 0;
+	AsyncExecutor::enqueueMainSliced(ts, [&] {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return ++slices < 10;
+	});
+	AsyncExecutor::execute(std::chrono::milliseconds(5));
+	EXPECT_GE(slices, 1);
+	EXPECT_LT(slices, 10);
+	EXPECT_GE(ts->estimate(), std::chrono::milliseconds(1));
+	while (slices < 10) AsyncExecutor::execute(std::chrono::milliseconds(5));
+	EXPECT_EQ(ts->completed, 1u);
+	EXPECT_EQ(ts->wait.count(), 1u);
+	EXPECT_EQ(ts->run.count(), 10u);
+	EXPECT_EQ(AsyncExecutor::mainQueueDepth(), 0);
+}
+
+TEST(AsyncExecutor, SlowTasksLeaveAWorkerFree) {
+	unsigned n = AsyncExecutor::workerCount();
+	unsigned limit = n > 1 ? n - 1 : 1;
+	std::mutex m;
+	std::set<std::thread::id> ids;
+	std::atomic<unsigned> arrived(0), left(0), running(0), peak(0);
+	for (unsigned i = 0; i < n; i++) {
+		AsyncExecutor::enqueueSlow([&] {
+			{
+				std::lock_guard<std::mutex> lock(m);
+				ids.insert(std::this_thread::get_id());
+				peak = std::max(unsigned(peak), ++running);
+			}
+			arrived++;
+			// hold this worker until as many slow tasks as allowed are running at once
+			wait_until([&] { return arrived >= limit; });
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			running--;
+			left++;
+		});
+	}
+	ASSERT_TRUE(wait_until([&] { return left == n; }));
+	std::lock_guard<std::mutex> lock(m);
+	EXPECT_GE(ids.size(), limit);
+	EXPECT_EQ(unsigned(peak), limit);
+}
+
+TEST(AsyncExecutor, FastTaskRunsWhileSlowTasksFillPool) {
+	unsigned n = AsyncExecutor::workerCount();
+	std::atomic<bool> release(false);
+	std::atomic<unsigned> started(0);
+	std::vector<task_future<void>> blockers;
+	for (unsigned i = 0; i < n; i++) {
+		blockers.push_back(AsyncExecutor::async(AsyncExecutor::slow, [&] {
+			started++;
+			wait_until([&] { return bool(release); });
+		}));
+	}
+	unsigned limit = AsyncExecutor::slowWorkerCount();
+	EXPECT_TRUE(wait_until([&] { return started == limit; }));
+	// the slow task left over stays queued, and the fast task gets the free worker
+	auto fast = AsyncExecutor::async(AsyncExecutor::fast, [] { return 42; });
+	bool ran = wait_until([&] { return fast.ready(); }, std::chrono::milliseconds(1000));
+	unsigned during = started;
+	release = true;
+	when_all(std::move(blockers)).wait();
+	EXPECT_TRUE(ran);
+	EXPECT_EQ(during, limit);
+	EXPECT_EQ(fast.get(), 42);
+}
+
+TEST(AsyncExecutor, NestedTasksAreStolen) {
+	std::atomic<unsigned> done(0);
+	AsyncExecutor::enqueueSlow([&] {
+		for (int i = 0; i < 100; i++) {
+			AsyncExecutor::enqueueSlow([&] { done++; });
+		}
+	});
+	EXPECT_TRUE(wait_until([&] { return done == 100; }));
+}
+
+TEST(AsyncExecutor, EnqueueToWorkerThread) {
+	std::thread::id tid = AsyncExecutor::workerThreadID(1);
+	std::atomic<unsigned> right(0), done(0);
+	for (int i = 0; i < 10; i++) {
+		AsyncExecutor::enqueue(tid, [&] {
+			if (std::this_thread::get_id() == tid) right++;
+			done++;
+		});
+	}
+	EXPECT_TRUE(wait_until([&] { return done == 10; }));
+	EXPECT_EQ(right, 10u);
+}
+
+TEST(task_future, ThenOnMovesResultBetweenStages) {
+	auto f = AsyncExecutor::async(AsyncExecutor::slow, [] {
+		return std::vector<int>({ 1, 2, 3 });
+	}).then_on(AsyncExecutor::fast, [](std::vector<int> v) {
+		v.push_back(4);
+		return v;
+	}).then_on(AsyncExecutor::slow, [](std::vector<int> v) {
+		return int(v.size());
+	});
+	EXPECT_EQ(f.get(), 4);
+}
+
+TEST(task_future, ThenOnMain) {
+	std::atomic<bool> on_main(false);
+	auto f = AsyncExecutor::async(AsyncExecutor::slow, [] { return 21; }).then_on(AsyncExecutor::main, [&](int x) {
+		on_main = std::this_thread::get_id() == AsyncExecutor::mainThreadID();
+		return x * 2;
+	});
+	while (!f.ready()) AsyncExecutor::execute(std::chrono::milliseconds(2));
+	EXPECT_TRUE(on_main);
+	EXPECT_EQ(f.get(), 42);
+}
+
+TEST(task_future, WhenAll) {
+	std::vector<task_future<int>> fs;
+	for (int i = 0; i < 20; i++) {
+		fs.push_back(AsyncExecutor::async(AsyncExecutor::slow, [i] { return i * i; }));
+	}
+	auto total = when_all(std::move(fs)).then_on(AsyncExecutor::fast, [](std::vector<int> v) {
+		int t = 0;
+		for (int i = 0; i < int(v.size()); i++) {
+			// results are in input order
+			EXPECT_EQ(v[i], i * i);
+			t += v[i];
+		}
+		return t;
+	});
+	EXPECT_EQ(total.get(), 2470);
+	EXPECT_TRUE(when_all(std::vector<task_future<void>>()).ready());
+}
+
+TEST(task_future, FailurePropagates) {
+	std::atomic<bool> ran(false);
+	auto f = AsyncExecutor::async(AsyncExecutor::slow, []() -> int {
+		throw std::runtime_error("nope");
+	}).then_on(AsyncExecutor::slow, [&](int) {
+		ran = true;
+	});
+	EXPECT_THROW(f.get(), std::runtime_error);
+	EXPECT_FALSE(ran);
+}
+
+TEST(task_future, CancelSkipsPendingStages) {
+	std::atomic<bool> release(false), ran(false);
+	// occupy every worker so the next task can't start
+	std::vector<task_future<void>> blockers;
+	for (unsigned i = 0; i < AsyncExecutor::workerCount(); i++) {
+		blockers.push_back(AsyncExecutor::async(AsyncExecutor::fast, [&] {
+			wait_until([&] { return bool(release); });
+		}));
+	}
+	auto first = AsyncExecutor::async(AsyncExecutor::slow, [&] { ran = true; return 1; });
+	auto second = first.then_on(AsyncExecutor::slow, [&](int x) { ran = true; return x; });
+	// cancelling the end of the chain cancels the stages before it too
+	EXPECT_TRUE(second.cancel());
+	EXPECT_TRUE(first.cancelled());
+	release = true;
+	when_all(std::move(blockers)).wait();
+	EXPECT_THROW(second.get(), task_cancelled);
+	EXPECT_FALSE(ran);
+}
+
+TEST(priority_scheduler, DedupesAndRunsBestFirst) {
+	priority_scheduler<int> s(AsyncExecutor::slow, 1);
+	std::atomic<bool> release(false);
+	std::atomic<int> done(0);
+	std::mutex order_mutex;
+	std::vector<int> order;
+	auto task = [&](int key) -> AsyncExecutor::task_t {
+		return [&, key] {
+			if (key == 0) wait_until([&] { return bool(release); });
+			{
+				std::lock_guard<std::mutex> lock(order_mutex);
+				order.push_back(key);
+			}
+			done++;
+		};
+	};
+	// key 0 holds the only slot while the rest queue up
+	EXPECT_TRUE(s.request(0, 0, task(0)));
+	s.update();
+	EXPECT_TRUE(s.request(1, 1, task(1)));
+	EXPECT_TRUE(s.request(2, 2, task(2)));
+	EXPECT_TRUE(s.request(3, 3, task(3)));
+	EXPECT_FALSE(s.request(0, 5, task(0)));
+	EXPECT_FALSE(s.request(2, 2, task(2)));
+	// priorities change before anything starts
+	EXPECT_TRUE(s.refresh(1, 10));
+	EXPECT_EQ(s.queued(), 3u);
+	s.update();
+	release = true;
+	EXPECT_TRUE(wait_until([&] { return done == 4; }));
+	std::vector<int> expected = { 0, 1, 3, 2 };
+	EXPECT_EQ(order, expected);
+	EXPECT_TRUE(wait_until([&] { return s.running() == 0; }));
+}
+
+TEST(priority_scheduler, CancelsStaleRequests) {
+	priority_scheduler<int> s(AsyncExecutor::slow, 1);
+	std::atomic<bool> release(false), ran(false);
+	std::atomic<int> done(0);
+	int cancelled = 0;
+	s.request(0, 0, [&] { wait_until([&] { return bool(release); }); done++; });
+	s.update();
+	s.request(1, 1, [&] { ran = true; }, [&] { cancelled++; });
+	s.request(2, 2, [&] { done++; }, [&] { cancelled++; });
+	s.update();
+	// only 2 is still wanted this frame
+	s.refresh(2, 2);
+	s.update();
+	EXPECT_EQ(cancelled, 1);
+	EXPECT_EQ(s.cancelledCount(), 1u);
+	release = true;
+	EXPECT_TRUE(wait_until([&] { return done == 2; }));
+	EXPECT_FALSE(ran);
+	EXPECT_TRUE(wait_until([&] { return s.running() == 0; }));
+}
+
+TEST(priority_scheduler, DestructorWaitsForRunningRequests) {
+	std::atomic<bool> started(false), finished(false), ran(false);
+	{
+		priority_scheduler<int> s(AsyncExecutor::slow, 1);
+		s.request(0, 1, [&] {
+			started = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			finished = true;
+		});
+		s.request(1, 0, [&] { ran = true; });
+		s.update();
+		EXPECT_TRUE(wait_until([&] { return bool(started); }));
+	}
+	EXPECT_TRUE(finished);
+	// still queued when the scheduler went, so dropped
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_FALSE(ran);
+}
+
+TEST(TaskGraph, DiamondRunsInDependencyOrder) {
+	TaskGraph g;
+	std::mutex m;
+	std::vector<std::string> order;
+	auto record = [&](const std::string &s) -> TaskGraph::task_t {
+		return [&, s] {
+			std::lock_guard<std::mutex> lock(m);
+			order.push_back(s);
+		};
+	};
+	std::thread::id main_ran_on;
+	auto a = g.add("a", AsyncExecutor::slow, record("a"));
+	auto b = g.add("b", AsyncExecutor::fast, record("b"), { a });
+	auto c = g.add("c", AsyncExecutor::main, [&] { main_ran_on = std::this_thread::get_id(); record("c")(); }, { a });
+	g.add("d", AsyncExecutor::slow, record("d"), { b, c });
+	for (int i = 0; i < 20; i++) {
+		order.clear();
+		g.run();
+		ASSERT_EQ(order.size(), 4u);
+		EXPECT_EQ(order.front(), "a");
+		EXPECT_EQ(order.back(), "d");
+		EXPECT_EQ(main_ran_on, std::this_thread::get_id());
+	}
+	// timings are relative to the start of the run
+	EXPECT_LE(g.timing(a).start.count(), g.timing(b).start.count());
+	EXPECT_LE(g.timing(b).start.count(), g.totalTime().count());
+}
+
+TEST(TaskGraph, CriticalPathFollowsSlowestChain) {
+	TaskGraph g;
+	auto sleep = [](int ms) -> TaskGraph::task_t {
+		return [ms] { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); };
+	};
+	auto a = g.add("a", AsyncExecutor::main, sleep(1));
+	auto fast1 = g.add("fast", AsyncExecutor::slow, sleep(1), { a });
+	auto slow1 = g.add("slow", AsyncExecutor::slow, sleep(30), { a });
+	auto end = g.add("end", AsyncExecutor::main, sleep(1), { fast1, slow1 });
+	g.run();
+	std::vector<TaskGraph::node_t> expected = { a, slow1, end };
+	EXPECT_EQ(g.criticalPath(), expected);
+	EXPECT_GE(g.totalTime().count(), 30);
+}
+
+TEST(TaskGraph, FailureSkipsDependentsAndRethrows) {
+	TaskGraph g;
+	std::atomic<bool> ran(false);
+	auto a = g.add("a", AsyncExecutor::slow, [] { throw std::runtime_error("nope"); });
+	g.add("b", AsyncExecutor::main, [&] { ran = true; }, { a });
+	EXPECT_THROW(g.run(), std::runtime_error);
+	EXPECT_FALSE(ran);
+	// and it can run again afterwards
+	EXPECT_THROW(g.run(), std::runtime_error);
+}
+
+TEST(parallel_for, VisitsEveryIndexOnce) {
+	std::vector<std::atomic<int>> hits(1000);
+	for (auto &h : hits) h = 0;
+	for (int grain : { 0, 1, 7, 1000, 5000 }) {
+		parallel_for(0, 1000, [&](int i) { hits[i]++; }, grain);
+	}
+	for (auto &h : hits) EXPECT_EQ(h, 5);
+	// empty range does nothing
+	parallel_for(5, 5, [&](int) { FAIL(); });
+}
+
+TEST(parallel_for, TilesCover2dRange) {
+	const int w = 37, h = 23;
+	std::vector<std::atomic<int>> hits(w * h);
+	for (auto &x : hits) x = 0;
+	parallel_for_2d(0, w, 0, h, [&](int x, int y) { hits[x + y * w]++; }, 8, 5);
+	parallel_for_2d(0, w, 0, h, [&](int x, int y) { hits[x + y * w]++; });
+	for (auto &x : hits) EXPECT_EQ(x, 2);
+}
+
+TEST(parallel_for, RethrowsAndCallerHelps) {
+	auto thrower = [](int i) { if (i == 42) throw std::runtime_error("nope"); };
+	EXPECT_THROW(parallel_for(0, 100, thrower, 1), std::runtime_error);
+	// nested inside a pool task, with every other worker busy, the caller still finishes the loop.
+	// the blockers fill every slow slot, so the loop itself runs on the worker kept for fast tasks.
+	std::atomic<bool> release(false);
+	std::vector<task_future<void>> blockers;
+	for (unsigned i = 0; i < AsyncExecutor::slowWorkerCount(); i++) {
+		blockers.push_back(AsyncExecutor::async(AsyncExecutor::slow, [&] { wait_until([&] { return bool(release); }); }));
+	}
+	auto sum = AsyncExecutor::async(AsyncExecutor::fast, [] {
+		std::atomic<int> s(0);
+		parallel_for(0, 100, [&](int i) { s += i; }, 1);
+		return int(s);
+	});
+	EXPECT_EQ(sum.get(), 4950);
+	release = true;
+	when_all(std::move(blockers)).wait();
+}
+
+TEST(parallel_reduce, CombinesInOrder) {
+	long long sum = parallel_reduce(0, 10000, 0LL, [](int i) { return (long long)(i); }, [](long long a, long long b) { return a + b; });
+	EXPECT_EQ(sum, 49995000LL);
+	// string concatenation is associative but not commutative
+	std::string s = parallel_reduce(0, 26, std::string(), [](int i) { return std::string(1, char('a' + i)); },
+		[](const std::string &a, const std::string &b) { return a + b; }, 3);
+	EXPECT_EQ(s, "abcdefghijklmnopqrstuvwxyz");
+	int empty = parallel_reduce(3, 3, 7, [](int i) { return i; }, [](int a, int b) { return a + b; });
+	EXPECT_EQ(empty, 7);
+	// one chunk per index, each writing its partial from its own thread
+	bool all = parallel_reduce(0, 1000, true, [](int i) { return i >= 0; }, [](bool a, bool b) { return a && b; }, 1);
+	EXPECT_TRUE(all);
+}
+
+TEST(latency_histogram, PercentilesWithinPrecision) {
+	latency_histogram h;
+	EXPECT_EQ(h.percentile(50).count(), 0);
+	for (long long v = 1; v <= 100000; v++) {
+		h.record(std::chrono::nanoseconds(v));
+	}
+	EXPECT_EQ(h.count(), 100000u);
+	EXPECT_EQ(h.max().count(), 100000);
+	EXPECT_EQ(h.mean().count(), 50000);
+	for (double p : { 1.0, 50.0, 90.0, 99.0, 99.9 }) {
+		double expected = p * 1000;
+		double actual = double(h.percentile(p).count());
+		EXPECT_NEAR(actual, expected, expected * 0.07) << "p" << p;
+	}
+	// small values are exact
+	latency_histogram h2;
+	h2.record(std::chrono::nanoseconds(3));
+	h2.record(std::chrono::nanoseconds(-5));
+	EXPECT_EQ(h2.percentile(100).count(), 3);
+	EXPECT_EQ(h2.percentile(1).count(), 0);
+}
+
+TEST(timer_wheel, FiresOnDueTickAcrossLevels) {
+	auto epoch = std::chrono::steady_clock::now();
+	timer_wheel tw(epoch);
+	std::chrono::steady_clock::time_point when;
+	EXPECT_FALSE(tw.nextEvent(when));
+	// spread over every level, including past the top one
+	std::vector<unsigned long long> due;
+	std::vector<timer_wheel::handle_t> handles;
+	unsigned long long d = 1;
+	for (int i = 0; i < 2000; i++) {
+		d = d * 6364136223846793005ull + 1442695040888963407ull;
+		unsigned long long ms = (d >> 33) % (1ull << (i % 34));
+		due.push_back(std::max(1ull, ms));
+		handles.push_back(tw.add(epoch + std::chrono::milliseconds(ms), std::chrono::milliseconds(0), nullptr));
+	}
+	for (size_t i = 0; i < handles.size(); i += 3) {
+		EXPECT_TRUE(tw.cancel(handles[i]));
+		EXPECT_FALSE(tw.cancel(handles[i]));
+	}
+	std::vector<int> fired_count(handles.size(), 0);
+	std::vector<timer_wheel::handle_t> fired;
+	unsigned long long now = 0;
+	while (tw.size() > 0) {
+		ASSERT_TRUE(tw.nextEvent(when));
+		// jump to the next event, sometimes past it
+		unsigned long long next = tw.toTick(when) + (now % 7 == 0 ? 1000 : 0);
+		EXPECT_GT(next, now);
+		tw.advance(epoch + std::chrono::milliseconds(next), fired);
+		for (auto &h : fired) {
+			size_t i = std::find(handles.begin(), handles.end(), h) - handles.begin();
+			ASSERT_LT(i, handles.size());
+			EXPECT_GT(due[i], now);
+			EXPECT_LE(due[i], next);
+			fired_count[i]++;
+		}
+		fired.clear();
+		now = next;
+	}
+	for (size_t i = 0; i < handles.size(); i++) {
+		EXPECT_EQ(fired_count[i], i % 3 ? 1 : 0);
+	}
+}
+
+TEST(timer_wheel, PeriodicSkipsMissedPeriods) {
+	auto epoch = std::chrono::steady_clock::now();
+	timer_wheel tw(epoch);
+	auto h = tw.add(epoch + std::chrono::milliseconds(10), std::chrono::milliseconds(10), nullptr);
+	std::vector<timer_wheel::handle_t> fired;
+	tw.advance(epoch + std::chrono::milliseconds(10), fired);
+	EXPECT_EQ(fired.size(), 1u);
+	EXPECT_EQ(h->due, 20u);
+	fired.clear();
+	tw.advance(epoch + std::chrono::milliseconds(55), fired);
+	EXPECT_EQ(fired.size(), 1u);
+	EXPECT_EQ(h->due, 60u);
+	EXPECT_EQ(tw.size(), 1u);
+	EXPECT_TRUE(tw.cancel(h));
+	EXPECT_EQ(tw.size(), 0u);
+}
+
+TEST(AsyncExecutor, ScheduleAfterAndEvery) {
+	std::mutex m;
+	std::vector<int> order;
+	auto time0 = std::chrono::steady_clock::now();
+	for (int ms : { 30, 10, 20 }) {
+		AsyncExecutor::scheduleAfter(std::chrono::milliseconds(ms), AsyncExecutor::fast, [&, ms] {
+			EXPECT_GE(std::chrono::steady_clock::now() - time0, std::chrono::milliseconds(ms));
+			std::lock_guard<std::mutex> lock(m);
+			order.push_back(ms);
+		});
+	}
+	std::atomic<int> ticks(0);
+	auto every = AsyncExecutor::scheduleEvery(std::chrono::milliseconds(2), AsyncExecutor::slow, [&] { ticks++; });
+	EXPECT_TRUE(wait_until([&] {
+		std::lock_guard<std::mutex> lock(m);
+		return order.size() == 3 && ticks >= 5;
+	}));
+	EXPECT_EQ(order, (std::vector<int> { 10, 20, 30 }));
+	EXPECT_TRUE(AsyncExecutor::cancel(every));
+	EXPECT_FALSE(AsyncExecutor::cancel(every));
+	// let anything already started finish
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	int stopped_at = ticks;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	EXPECT_EQ(ticks, stopped_at);
+	EXPECT_EQ(AsyncExecutor::timerCount(), 0u);
+}
+
+TEST(AsyncExecutor, TaggedTasksRecordStats) {
+	// stats live forever, so use a fresh tag each run (for --gtest_repeat)
+	static int run = 0;
+	std::string tag = "test.tagged" + std::to_string(run++);
+	task_stats *ts = AsyncExecutor::stats(tag);
+	EXPECT_EQ(ts, AsyncExecutor::stats(tag));
+	for (int i = 0; i < 10; i++) {
+		AsyncExecutor::enqueueSlow(AsyncExecutor::tagged(ts, [] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}));
+	}
+	AsyncExecutor::enqueueFast(AsyncExecutor::tagged(tag, [] { throw std::runtime_error("nope"); }));
+	EXPECT_TRUE(wait_until([&] { return ts->completed == 10 && ts->failed == 1; }));
+	EXPECT_EQ(ts->submitted, 11u);
+	EXPECT_EQ(ts->inFlight(), 0);
+	EXPECT_EQ(ts->run.count(), 11u);
+	EXPECT_GE(ts->run.max(), std::chrono::milliseconds(1));
+	std::string json = AsyncExecutor::statsJSON();
+	EXPECT_NE(json.find("\"" + tag + "\":{\"submitted\":11,\"completed\":10,\"failed\":1"), std::string::npos) << json;
+	EXPECT_NE(json.find("\"queues\":{\"pool\":"), std::string::npos);
+}
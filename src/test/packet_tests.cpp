@@ -1,8 +1,22 @@
 #include "gtest/gtest.h"
 #include "ambition/ByteBuffer.hpp"
+#include "ambition/Packet.hpp"
+#include "ambition/ClientSocket.hpp"
+#include "ambition/Framing.hpp"
 using namespace ambition;
 
+#include <array>
+#include <cstring>
 #include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 const int test_size = 30;
 
@@ -60,3 +74,454 @@ const int test_size = 30;
 // 	EXPECT_EQ(p.size(), test_size);
 // }
 
+
+TEST(byte_buffer, ReaderOverView) {
+	byte_buffer bb;
+	bb << uint16_t(0x1234) << std::string("hello") << uint32_t(7);
+	byte_t raw[64];
+	bb.dump(raw);
+	// read from memory the buffer doesn't own
+	byte_buffer::reader r(byte_view(raw, bb.size()));
+	EXPECT_EQ(r.get<uint16_t>(), 0x1234);
+	byte_view str = r.get_view(7);
+	EXPECT_EQ(str.data(), raw + 2);
+	EXPECT_EQ(byte_buffer::reader(str).get<std::string>(), "hello");
+	EXPECT_EQ(r.rest().size(), 4u);
+	EXPECT_EQ(r.get<uint32_t>(), 7u);
+	EXPECT_THROW(r.get_view(1), std::range_error);
+}
+
+TEST(byte_buffer, SlicesShareStorage) {
+	byte_buffer bb;
+	bb << uint32_t(1) << uint32_t(2);
+	// too small to be worth sharing without copying
+	EXPECT_EQ(byte_buffer::reader(bb.release()).get<uint32_t>(), 1u);
+	EXPECT_EQ(bb.size(), 0u);
+	bb << uint32_t(1) << uint32_t(2);
+	std::vector<uint32_t> more(100, 3);
+	bb.add_array(more.data(), more.size());
+	const byte_t *p = bb.data();
+	byte_slice whole = bb.release();
+	EXPECT_EQ(bb.size(), 0u);
+	EXPECT_EQ(whole.data(), p);
+	byte_slice second = whole.slice(4);
+	whole = byte_slice();
+	// the storage lives on in the slice
+	EXPECT_EQ(second.data(), p + 4);
+	EXPECT_EQ(byte_buffer::reader(second).get<uint32_t>(), 2u);
+	EXPECT_EQ(second.slice(402, 100).size(), 2u);
+	EXPECT_THROW(second.slice(405), std::range_error);
+}
+
+TEST(byte_buffer, SlabCommitsConsecutiveSlices) {
+	byte_slab slab(16, 8);
+	std::memcpy(slab.space(), "abcdef", 6);
+	byte_slice a = slab.commit(6);
+	std::memcpy(slab.space(), "ghij", 4);
+	byte_slice b = slab.commit(4);
+	EXPECT_EQ(b.data(), a.data() + 6);
+	// not enough room left for min_space, so the next write goes to a new block
+	slab.space();
+	EXPECT_EQ(slab.capacity(), 16u);
+	EXPECT_EQ(std::string(reinterpret_cast<const char *>(a.data()), 6), "abcdef");
+	EXPECT_EQ(std::string(reinterpret_cast<const char *>(b.data()), 4), "ghij");
+}
+
+TEST(byte_buffer, BulkArraysMatchPerElement) {
+	std::vector<float> f;
+	std::vector<int16_t> s;
+	std::vector<uint64_t> u;
+	for (int i = 0; i < 100; i++) {
+		f.push_back(i * -1.25f);
+		s.push_back(int16_t(i * 331 - 9000));
+		u.push_back(0x0102030405060708ull * i);
+	}
+	byte_buffer bulk, single;
+	bulk << f << s << u;
+	single << uint16_t(f.size());
+	for (float x : f) single << x;
+	single << uint16_t(s.size());
+	for (int16_t x : s) single << x;
+	single << uint16_t(u.size());
+	for (uint64_t x : u) single << x;
+	ASSERT_EQ(bulk.size(), single.size());
+	EXPECT_EQ(std::memcmp(bulk.data(), single.data(), bulk.size()), 0);
+	// big-endian on the wire
+	EXPECT_EQ(bulk.data()[2 + 4 * 100 + 2], byte_t(uint16_t(-9000) >> 8));
+	std::vector<float> f2;
+	std::vector<int16_t> s2;
+	std::vector<uint64_t> u2;
+	auto r = bulk.read();
+	r >> f2 >> s2 >> u2;
+	EXPECT_EQ(f2, f);
+	EXPECT_EQ(s2, s);
+	EXPECT_EQ(u2, u);
+	double d[3];
+	EXPECT_THROW(byte_buffer::reader(bulk.view().slice(0, 20)).get_array(d, 3), std::range_error);
+}
+
+TEST(byte_buffer, SteadyStateSerializeDoesNotAllocate) {
+	PacketImpl<PacketID::c2s_init> packet(7);
+	std::vector<float> payload(300, 1.5f);
+	auto build = [&] {
+		byte_buffer small = packet.serialize();
+		byte_buffer big;
+		big << payload;
+		return small.size() + big.size();
+	};
+	// the first big buffer has to come from the heap
+	EXPECT_EQ(build(), 4u + 2u + 1200u);
+	byte_pool::counters before = byte_pool::stats();
+	for (int i = 0; i < 100; i++) {
+		build();
+	}
+	byte_pool::counters after = byte_pool::stats();
+	EXPECT_EQ(after.heap_allocs, before.heap_allocs);
+	EXPECT_EQ(after.heap_frees, before.heap_frees);
+	EXPECT_EQ(after.pool_hits, before.pool_hits + 100);
+	packet_arena arena;
+	packet_ptr p = Packet::deserialize(packet.serialize(), arena);
+	EXPECT_EQ(static_cast<PacketImpl<PacketID::c2s_init> *>(p.get())->client_version(), 7);
+}
+
+TEST(byte_buffer, VarintsAndZigzag) {
+	byte_buffer bb;
+	bb << varint<uint32_t>(0) << varint<uint32_t>(127) << varint<uint32_t>(128) << varint<uint64_t>(~0ull);
+	bb << zigzag<int32_t>(-1) << zigzag<int32_t>(63) << zigzag<int64_t>(std::numeric_limits<int64_t>::min());
+	// 1 + 1 + 2 + 10, then 1 + 1 + 10
+	EXPECT_EQ(bb.size(), 26u);
+	auto r = bb.read();
+	EXPECT_EQ(uint32_t(r.get<varint<uint32_t>>()), 0u);
+	EXPECT_EQ(uint32_t(r.get<varint<uint32_t>>()), 127u);
+	EXPECT_EQ(uint32_t(r.get<varint<uint32_t>>()), 128u);
+	EXPECT_EQ(uint64_t(r.get<varint<uint64_t>>()), ~0ull);
+	EXPECT_EQ(int32_t(r.get<zigzag<int32_t>>()), -1);
+	EXPECT_EQ(int32_t(r.get<zigzag<int32_t>>()), 63);
+	EXPECT_EQ(int64_t(r.get<zigzag<int64_t>>()), std::numeric_limits<int64_t>::min());
+	// more continuation bytes than a uint16_t can hold
+	byte_buffer bad;
+	bad << varint<uint32_t>(1u << 30);
+	EXPECT_THROW(bad.read().get<varint<uint16_t>>(), std::range_error);
+	// the right number of bytes, but a value too big for the type
+	byte_buffer wide;
+	wide << varint<uint32_t>(0xFFFF) << varint<uint32_t>(0x10000);
+	auto w = wide.read();
+	EXPECT_EQ(uint16_t(w.get<varint<uint16_t>>()), 0xFFFF);
+	EXPECT_THROW(w.get<varint<uint16_t>>(), std::range_error);
+	// a 10th byte with bits above bit 63
+	byte_buffer over;
+	for (int i = 0; i < 9; i++) over << uint8_t(0xFF);
+	over << uint8_t(0x02);
+	EXPECT_THROW(over.read().get<varint<uint64_t>>(), std::range_error);
+	byte_buffer s;
+	s << varsize<std::string>("hi");
+	EXPECT_EQ(s.size(), 3u);
+	EXPECT_EQ(std::string(s.read().get<varsize<std::string>>()), "hi");
+	// lengths no buffer could hold, including ones that are negative as a ptrdiff_t
+	const uint64_t huge[] = { 1ull << 63, ~0ull };
+	for (uint64_t len : huge) {
+		byte_buffer lie;
+		lie << varint<uint64_t>(len) << uint32_t(0) << uint32_t(0);
+		EXPECT_THROW(lie.read().get<varsize<std::string>>(), std::range_error) << len;
+	}
+	// the length counts elements, not bytes: 8 bytes hold 2 uint32_ts, not 4
+	byte_buffer four;
+	four << varint<uint64_t>(4) << uint32_t(1) << uint32_t(2);
+	EXPECT_THROW(four.read().get<varsize<std::vector<uint32_t>>>(), std::range_error);
+}
+
+TEST(byte_buffer, PackedFieldsUseExactBits) {
+	using update_t = packed<bits<12>, quantized<-512, 512, 16>, quantized<-512, 512, 16>, bool, zigzag<int16_t>>;
+	byte_buffer bb;
+	bb << update_t(4000, 100.3f, -600.0f, true, int16_t(-3)) << uint8_t(0xAB);
+	// 12 + 16 + 16 + 1 + 8 bits, padded to 7 bytes
+	EXPECT_EQ(bb.size(), 8u);
+	auto r = bb.read();
+	update_t u = r.get<update_t>();
+	EXPECT_EQ(uint32_t(std::get<0>(u.fields)), 4000u);
+	EXPECT_NEAR(float(std::get<1>(u.fields)), 100.3f, 1024.0 / 65535);
+	EXPECT_EQ(float(std::get<2>(u.fields)), -512.0f);
+	EXPECT_TRUE(std::get<3>(u.fields));
+	EXPECT_EQ(int16_t(std::get<4>(u.fields)), -3);
+	EXPECT_EQ(r.get<uint8_t>(), 0xAB);
+	// the same fields at full width take 4 + 4 + 4 + 1 + 2 bytes
+	byte_buffer full;
+	full << std::make_tuple(uint32_t(4000), 100.3f, -512.0f, true, int16_t(-3));
+	EXPECT_EQ(full.size(), 15u);
+}
+
+namespace {
+	struct transform_update {
+		uint32_t id = 0;
+		std::array<float, 3> position;
+		std::array<int16_t, 4> rotation;
+		bool teleported = false;
+
+		std::tuple<uint32_t &, std::array<float, 3> &, std::array<int16_t, 4> &, bool &> wire() {
+			return std::tie(id, position, rotation, teleported);
+		}
+
+		std::tuple<const uint32_t &, const std::array<float, 3> &, const std::array<int16_t, 4> &, const bool &> wire() const {
+			return std::tie(id, position, rotation, teleported);
+		}
+	};
+
+	struct named_thing {
+		uint16_t id = 0;
+		std::string name;
+
+		std::tuple<uint16_t &, std::string &> wire() {
+			return std::tie(id, name);
+		}
+
+		std::tuple<const uint16_t &, const std::string &> wire() const {
+			return std::tie(id, name);
+		}
+	};
+}
+
+static_assert(wire_size<transform_update>::fixed && wire_size<transform_update>::value == 4 + 12 + 8 + 1, "wire size");
+static_assert(wire_size<std::array<std::tuple<uint8_t, double>, 3>>::value == 27, "wire size");
+static_assert(!wire_size<named_thing>::fixed && !wire_size<std::tuple<int, std::string>>::fixed, "not fixed");
+
+TEST(byte_buffer, FixedLayoutMatchesFieldByField) {
+	transform_update t;
+	t.id = 0xDEADBEEF;
+	t.position = {{ 1.5f, -2.25f, 1e6f }};
+	t.rotation = {{ -1, 2, -32768, 32767 }};
+	t.teleported = true;
+	byte_buffer fast;
+	fast << t;
+	byte_buffer slow;
+	slow << t.id;
+	for (float f : t.position) slow << f;
+	for (int16_t r : t.rotation) slow << r;
+	slow << t.teleported;
+	const size_t expected = wire_size<transform_update>::value;
+	ASSERT_EQ(fast.size(), expected);
+	ASSERT_EQ(fast.size(), slow.size());
+	EXPECT_EQ(std::memcmp(fast.data(), slow.data(), fast.size()), 0);
+	transform_update u = fast.read().get<transform_update>();
+	EXPECT_EQ(u.id, t.id);
+	EXPECT_EQ(u.position, t.position);
+	EXPECT_EQ(u.rotation, t.rotation);
+	EXPECT_TRUE(u.teleported);
+	EXPECT_THROW(byte_buffer::reader(fast.view().slice(1)).get<transform_update>(), std::range_error);
+	named_thing n;
+	n.id = 5;
+	n.name = "sphere";
+	byte_buffer nb;
+	nb << n;
+	named_thing m = nb.read().get<named_thing>();
+	EXPECT_EQ(m.id, 5);
+	EXPECT_EQ(m.name, "sphere");
+}
+
+TEST(byte_chain, ConsumeSplitsSegments) {
+	byte_buffer head;
+	head << uint32_t(7) << uint32_t(8);
+	std::vector<byte_t> body(1000);
+	for (size_t i = 0; i < body.size(); i++) body[i] = byte_t(i);
+	byte_chain bc;
+	bc << std::move(head) << byte_slice::copy(byte_view(body.data(), body.size())) << byte_buffer();
+	EXPECT_EQ(bc.segment_count(), 2u);
+	EXPECT_EQ(bc.size(), 1008u);
+	bc.consume(6);
+	EXPECT_EQ(bc.segment_count(), 2u);
+	EXPECT_EQ(bc.size(), 1002u);
+	bc.consume(4);
+	EXPECT_EQ(bc.segment_count(), 1u);
+	byte_buffer flat = bc.flatten();
+	ASSERT_EQ(flat.size(), 998u);
+	EXPECT_EQ(std::memcmp(flat.data(), body.data() + 2, 998), 0);
+	bc.consume(5000);
+	EXPECT_TRUE(bc.empty());
+	EXPECT_EQ(bc.segment_count(), 0u);
+}
+
+#ifndef _WIN32
+TEST(byte_chain, SendsSegmentsWithoutFlattening) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	// larger than the socket buffer, and more segments than go in one call
+	const size_t body_size = 4 << 20;
+	auto body = std::make_shared<std::vector<byte_t>>(body_size);
+	for (size_t i = 0; i < body_size; i++) (*body)[i] = byte_t(i * 31 + 1);
+	byte_slice body_slice(std::shared_ptr<const byte_t>(body, body->data()), byte_view(body->data(), body_size));
+	byte_chain bc;
+	byte_buffer head;
+	head << uint16_t(1) << uint32_t(body_size);
+	bc << std::move(head);
+	// a few small segments from the middle of the body, then the whole body
+	for (size_t i = 0; i < 100; i++) bc << body_slice.slice(i * 10, 10);
+	bc << body_slice;
+	EXPECT_EQ((bc.end() - 1)->data(), body->data());
+	std::vector<byte_t> received;
+	std::thread reader([&] {
+		byte_t chunk[65536];
+		ssize_t rx;
+		while ((rx = recv(fds[1], chunk, sizeof(chunk), 0)) > 0) received.insert(received.end(), chunk, chunk + rx);
+	});
+	{
+		ClientSocket cs(fds[0]);
+		cs.begin_send(bc);
+	}
+	shutdown(fds[0], SHUT_WR);
+	reader.join();
+	close(fds[0]);
+	close(fds[1]);
+	byte_buffer flat = bc.flatten();
+	ASSERT_EQ(received.size(), 6 + 1000 + body_size);
+	EXPECT_EQ(std::memcmp(received.data(), flat.data(), flat.size()), 0);
+}
+#endif
+
+namespace {
+	struct counting_visitor : public PacketVisitor {
+		int packets = 0;
+		unsigned version_sum = 0;
+
+		void visit(const Packet &) override {
+			packets++;
+		}
+
+		void visit(const PacketImpl<PacketID::c2s_init> &p) override {
+			packets++;
+			version_sum += p.client_version();
+		}
+	};
+}
+
+TEST(Packet, ArenaRecyclesAndDispatchesByTable) {
+	packet_arena arena;
+	counting_visitor v;
+	std::vector<byte_buffer> wire;
+	for (uint16_t i = 0; i < 10; i++) {
+		wire.push_back(PacketImpl<PacketID::c2s_init>(i).serialize());
+	}
+	for (int round = 0; round < 100; round++) {
+		for (const byte_buffer &bb : wire) {
+			Packet::dispatch(bb.view(), arena, v);
+		}
+	}
+	EXPECT_EQ(v.packets, 1000);
+	EXPECT_EQ(v.version_sum, 4500u);
+	// every packet reused the one slot
+	EXPECT_EQ(arena.blocks(), 1u);
+	{
+		std::vector<packet_ptr> held;
+		for (int i = 0; i < 2000; i++) {
+			held.push_back(Packet::deserialize(wire[0], arena));
+		}
+	}
+	size_t blocks = arena.blocks();
+	EXPECT_GT(blocks, 1u);
+	for (int i = 0; i < 2000; i++) {
+		Packet::deserialize(wire[0], arena);
+	}
+	EXPECT_EQ(arena.blocks(), blocks);
+	byte_buffer unknown;
+	unknown << uint16_t(PacketID::last) << uint16_t(1);
+	EXPECT_THROW(Packet::deserialize(unknown, arena), network_error);
+	void *big = arena.allocate(4096);
+	arena.deallocate(big);
+}
+
+namespace {
+	void ignore_frame(const byte_slice &) { }
+}
+
+TEST(frame_reader, ReassemblesSplitAndMergedFrames) {
+	const frame_prefix prefixes[] = { frame_prefix::varint, frame_prefix::fixed32 };
+	for (frame_prefix prefix : prefixes) {
+		// sizes either side of the one-byte varint limit, and one bigger than a read
+		std::vector<std::string> sent;
+		byte_buffer stream;
+		for (int i = 0; i < 200; i++) {
+			size_t size = i % 50 == 0 ? 5000 : (i * 37) % 300;
+			std::string msg(size, char('a' + i % 26));
+			sent.push_back(msg);
+			write_frame(stream, byte_view(reinterpret_cast<const byte_t *>(msg.data()), msg.size()), prefix);
+		}
+		byte_slice all = stream.release();
+		// split the stream at varying points, as recv might
+		frame_reader fr(prefix);
+		std::vector<std::string> received;
+		size_t copied = 0;
+		size_t pos = 0;
+		for (size_t step = 1; pos < all.size(); step = step * 7 % 1500 + 1) {
+			byte_slice chunk = all.slice(pos, step);
+			pos += chunk.size();
+			fr.feed(chunk, [&](const byte_slice &frame) {
+				if (frame.data() < chunk.data() || frame.data() >= chunk.data() + chunk.size()) copied++;
+				received.push_back(std::string(reinterpret_cast<const char *>(frame.data()), frame.size()));
+			});
+		}
+		EXPECT_EQ(fr.pending(), 0u);
+		ASSERT_EQ(received.size(), sent.size());
+		EXPECT_TRUE(received == sent);
+		// most frames arrived whole and were not copied
+		EXPECT_LT(copied, sent.size() / 2);
+		// all at once: every frame in one read
+		frame_reader whole(prefix);
+		EXPECT_EQ(whole.feed(all, ignore_frame), sent.size());
+	}
+}
+
+TEST(frame_reader, RejectsOversizedFrames) {
+	frame_reader fr(frame_prefix::varint, 100);
+	byte_buffer bb;
+	bb << varint<uint32_t>(101);
+	byte_slice s = bb.release();
+	EXPECT_THROW(fr.feed(s, ignore_frame), network_error);
+	frame_reader bad(frame_prefix::varint);
+	byte_buffer junk;
+	for (int i = 0; i < 11; i++) junk << uint8_t(0xFF);
+	EXPECT_THROW(bad.feed(junk.release(), ignore_frame), network_error);
+	// 2^64, which would wrap to an empty frame
+	frame_reader wrap(frame_prefix::varint);
+	byte_buffer big;
+	for (int i = 0; i < 9; i++) big << uint8_t(0x80);
+	big << uint8_t(0x02);
+	EXPECT_THROW(wrap.feed(big.release(), ignore_frame), network_error);
+}
+
+#ifndef _WIN32
+TEST(frame_reader, ClientSocketRaisesOnFrame) {
+	int fds[2];
+	ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+	{
+		ClientSocket cs(fds[0]);
+		cs.set_framing(frame_prefix::fixed32);
+		int raw = 0;
+		std::vector<size_t> frames;
+		cs.on_recieved.attach([&](const SocketResult &) {
+			raw++;
+			return false;
+		});
+		cs.on_frame.attach([&](const SocketResult &sr) {
+			EXPECT_EQ(sr.client, &cs);
+			frames.push_back(sr.data.size());
+			return false;
+		});
+		byte_buffer batch;
+		std::string a(10, 'a'), b(3, 'b');
+		write_frame(batch, byte_view(reinterpret_cast<const byte_t *>(a.data()), a.size()), frame_prefix::fixed32);
+		write_frame(batch, byte_view(reinterpret_cast<const byte_t *>(b.data()), b.size()), frame_prefix::fixed32);
+		byte_slice all = batch.release();
+		SocketResult sr;
+		sr.success = true;
+		sr.client = &cs;
+		sr.data = all.slice(0, 16);
+		cs.deliver(sr);
+		sr.data = all.slice(16);
+		cs.deliver(sr);
+		EXPECT_EQ(raw, 2);
+		ASSERT_EQ(frames.size(), 2u);
+		EXPECT_EQ(frames[0], 10u);
+		EXPECT_EQ(frames[1], 3u);
+	}
+	close(fds[0]);
+	close(fds[1]);
+}
+#endif
@@ -0,0 +1,486 @@
+#include "gtest/gtest.h"
+#include "ambition/Reactor.hpp"
+#include "ambition/ListenSocket.hpp"
+#include "ambition/ClientSocket.hpp"
+using namespace ambition;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+	// as many descriptors as we are allowed, leaving some spare
+	size_t fd_budget() {
+		if (std::string(Reactor::backend()) == "select") return FD_SETSIZE - 64;
+		rlimit rl;
+		getrlimit(RLIMIT_NOFILE, &rl);
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+		return rl.rlim_cur > 256 ? size_t(rl.rlim_cur) - 256 : 0;
+	}
+
+	size_t thread_count() {
+		size_t n = 0;
+		DIR *d = opendir("/proc/self/task");
+		if (!d) return 0;
+		while (dirent *e = readdir(d)) {
+			if (e->d_name[0] != '.') n++;
+		}
+		closedir(d);
+		return n;
+	}
+
+	template <typename PredT>
+	bool wait_for(PredT pred, std::chrono::milliseconds timeout = std::chrono::milliseconds(10000)) {
+		auto until = std::chrono::steady_clock::now() + timeout;
+		while (!pred()) {
+			if (std::chrono::steady_clock::now() > until) return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	// a blocking socket connected to port on this host, or -1
+	int connect_to(uint16_t port) {
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int s = socket(AF_INET, SOCK_STREAM, 0);
+		if (s < 0) return -1;
+		if (connect(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+			close(s);
+			return -1;
+		}
+		return s;
+	}
+}
+
+TEST(Reactor, IdleSocketsAreNeverVisited) {
+	const size_t pairs = std::min<size_t>(20000, fd_budget() / 2);
+	ASSERT_GT(pairs, 100u);
+	Reactor reactor;
+	std::vector<int> fds(pairs * 2);
+	std::vector<unsigned> calls(pairs, 0);
+	for (size_t i = 0; i < pairs; i++) {
+		ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]), 0);
+		Reactor::set_nonblocking(fds[i * 2]);
+		int fd = fds[i * 2];
+		reactor.add(fd, Reactor::ev_read, [&calls, i, fd](unsigned ev) {
+			EXPECT_TRUE(ev & Reactor::ev_read);
+			calls[i]++;
+			char buf[256];
+			while (read(fd, buf, sizeof(buf)) > 0);
+		});
+	}
+	EXPECT_EQ(reactor.size(), pairs);
+	// one busy connection among many idle ones
+	const size_t busy = pairs / 2;
+	const int messages = 2000;
+	size_t ran = 0;
+	auto time0 = std::chrono::steady_clock::now();
+	for (int m = 0; m < messages; m++) {
+		ASSERT_EQ(write(fds[busy * 2 + 1], "x", 1), 1);
+		ran += reactor.poll(1000);
+	}
+	auto per_event = (std::chrono::steady_clock::now() - time0) / messages;
+	EXPECT_EQ(ran, size_t(messages));
+	EXPECT_EQ(calls[busy], unsigned(messages));
+	EXPECT_EQ(std::count(calls.begin(), calls.end(), 0u), std::ptrdiff_t(pairs - 1));
+	if (std::string(Reactor::backend()) == "epoll") {
+		// nowhere near enough time to look at every socket
+		EXPECT_LT(per_event, std::chrono::microseconds(pairs / 10));
+	}
+	for (size_t i = 0; i < pairs; i++) {
+		reactor.remove(fds[i * 2]);
+		close(fds[i * 2]);
+		close(fds[i * 2 + 1]);
+	}
+	EXPECT_EQ(reactor.size(), 0u);
+	EXPECT_EQ(reactor.poll(0), 0u);
+}
+
+TEST(Reactor, StopWakesRun) {
+	Reactor reactor;
+	std::thread t([&] { reactor.run(); });
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	reactor.stop();
+	t.join();
+}
+
+TEST(ListenSocket, ServesManyConnectionsOnOneThread) {
+	const size_t clients = std::min<size_t>(4000, fd_budget() / 2);
+	std::atomic<size_t> accepted { 0 }, received { 0 }, closed { 0 };
+	ListenSocket server(0);
+	server.on_accepted.attach([&](const SocketResult &sr) {
+		accepted++;
+		sr.client->on_recieved.attach([&](const SocketResult &r) {
+			received += r.data.size();
+			return false;
+		});
+		sr.client->on_closed.attach([&](const SocketResult &) {
+			closed++;
+			return false;
+		});
+		return false;
+	});
+	std::vector<int> socks;
+	for (size_t i = 0; i < clients; i++) {
+		int s = connect_to(server.listen_port());
+		ASSERT_GE(s, 0);
+		socks.push_back(s);
+	}
+	EXPECT_TRUE(wait_for([&] { return accepted.load() == clients; }));
+	// a burst of small messages on every connection
+	for (int round = 0; round < 10; round++) {
+		for (int s : socks) {
+			ASSERT_EQ(send(s, "0123456789", 10, 0), 10);
+		}
+	}
+	EXPECT_TRUE(wait_for([&] { return received.load() == clients * 100; }));
+	for (int s : socks) close(s);
+	EXPECT_TRUE(wait_for([&] { return closed.load() == clients; }));
+}
+
+TEST(ListenSocket, ThrowsIfThePortIsTaken) {
+	ListenSocket first(0);
+	try {
+		ListenSocket second(first.listen_port());
+		ADD_FAILURE() << "bound a port already listened on";
+	} catch (const network_error &ne) {
+		EXPECT_EQ(ne.type, error::neterr_listen_failure);
+		EXPECT_EQ(ne.error_no, EADDRINUSE);
+	}
+}
+
+TEST(ListenSocket, ShardsConnectionsAcrossReactors) {
+	const size_t clients = std::min<size_t>(400, fd_budget() / 2);
+	std::mutex threads_mutex;
+	std::set<std::thread::id> threads;
+	std::atomic<size_t> accepted { 0 }, received { 0 }, moved { 0 };
+	ListenSocket server(0, 4);
+	ASSERT_EQ(server.reactors(), 4u);
+	ASSERT_NE(server.listen_port(), 0);
+	server.on_accepted.attach([&](const SocketResult &sr) {
+		std::thread::id home = std::this_thread::get_id();
+		{
+			std::lock_guard<std::mutex> lock(threads_mutex);
+			threads.insert(home);
+		}
+		// every event for the connection runs on the thread that accepted it
+		sr.client->on_recieved.attach([&, home](const SocketResult &r) {
+			if (std::this_thread::get_id() != home) moved++;
+			received += r.data.size();
+			return false;
+		});
+		accepted++;
+		return false;
+	});
+	std::vector<int> socks;
+	for (size_t i = 0; i < clients; i++) {
+		int s = connect_to(server.listen_port());
+		ASSERT_GE(s, 0);
+		socks.push_back(s);
+	}
+	EXPECT_TRUE(wait_for([&] { return accepted.load() == clients; }));
+	for (int round = 0; round < 10; round++) {
+		for (int s : socks) {
+			ASSERT_EQ(send(s, "0123456789", 10, 0), 10);
+		}
+	}
+	EXPECT_TRUE(wait_for([&] { return received.load() == clients * 100; }));
+	EXPECT_EQ(moved.load(), 0u);
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		// the kernel hashes connections to listeners, so with this many all four get some
+		EXPECT_EQ(threads.size(), 4u);
+	}
+	for (int s : socks) close(s);
+}
+
+TEST(ClientSocket, ConnectionsShareReactorThreads) {
+	const size_t clients = std::min<size_t>(2000, fd_budget() / 2);
+	ListenSocket server(0);
+	server.on_accepted.attach([](const SocketResult &sr) {
+		// echo
+		sr.client->on_recieved.attach([](const SocketResult &r) {
+			r.client->begin_send(byte_buffer(r.data.view()));
+			return false;
+		});
+		return false;
+	});
+	ReactorPool::start(2);
+	size_t threads_before = thread_count();
+	std::atomic<size_t> connected { 0 }, echoed { 0 };
+	std::vector<std::unique_ptr<ClientSocket>> socks;
+	for (size_t i = 0; i < clients; i++) {
+		socks.emplace_back(new ClientSocket());
+		ClientSocket *cs = socks.back().get();
+		cs->on_connected.attach([&, cs](const SocketResult &sr) {
+			EXPECT_TRUE(sr.success);
+			EXPECT_EQ(sr.client, cs);
+			connected++;
+			return false;
+		});
+		cs->on_recieved.attach([&](const SocketResult &sr) {
+			echoed += sr.data.size();
+			return false;
+		});
+		cs->begin_connect("127.0.0.1", server.listen_port(), 0);
+	}
+	EXPECT_TRUE(wait_for([&] { return connected.load() == clients; }));
+	for (auto &cs : socks) {
+		byte_buffer hello;
+		hello << uint32_t(0x12345678);
+		cs->begin_send(hello);
+	}
+	EXPECT_TRUE(wait_for([&] { return echoed.load() == clients * 4; }));
+	// however many connections there are, no more threads than the pool's
+	EXPECT_EQ(thread_count(), threads_before);
+	socks.clear();
+	ReactorPool::stop();
+}
+
+TEST(ClientSocket, RefusedConnectsAreReportedAndCanBeDestroyedAnyTime) {
+	// a port nobody is listening on: bound, so nothing else gets it, but never listened to
+	int holder = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_GE(holder, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ASSERT_EQ(bind(holder, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)), 0);
+	socklen_t len = sizeof(addr);
+	ASSERT_EQ(getsockname(holder, reinterpret_cast<sockaddr *>(&addr), &len), 0);
+
+	const size_t clients = 200;
+	std::atomic<size_t> refused { 0 }, succeeded { 0 };
+	std::vector<std::unique_ptr<ClientSocket>> socks;
+	for (size_t i = 0; i < clients; i++) {
+		socks.emplace_back(new ClientSocket());
+		socks.back()->on_connected.attach([&](const SocketResult &sr) {
+			if (sr.success) succeeded++;
+			else refused++;
+			return false;
+		});
+		socks.back()->begin_connect("127.0.0.1", ntohs(addr.sin_port), 0);
+		// every other one goes while its connect may still be finishing on the reactor thread
+		if (i % 2) socks.back().reset();
+	}
+	EXPECT_TRUE(wait_for([&] { return refused.load() >= clients / 2; }));
+	EXPECT_EQ(succeeded.load(), 0u);
+	socks.clear();
+	ReactorPool::stop();
+	close(holder);
+}
+
+TEST(ClientSocket, QueuesSendsToASlowReader) {
+	std::atomic<ClientSocket *> server_side { nullptr };
+	std::atomic<size_t> sent { 0 };
+	std::atomic<int> writable { 0 };
+	std::atomic<bool> closed { false };
+	SendStats final_stats;
+	ListenSocket server(0);
+	server.on_accepted.attach([&](const SocketResult &sr) {
+		sr.client->set_watermarks(64 * 1024, 512 * 1024);
+		sr.client->on_sent.attach([&](const SocketResult &r) {
+			sent += r.n_bytes;
+			return false;
+		});
+		sr.client->on_writable.attach([&](const SocketResult &) {
+			writable++;
+			return false;
+		});
+		// the server deletes the socket once it closes, so take the totals on its thread
+		sr.client->on_closed.attach([&](const SocketResult &r) {
+			final_stats = r.client->send_stats();
+			closed = true;
+			return false;
+		});
+		server_side = sr.client;
+		return false;
+	});
+	int s = connect_to(server.listen_port());
+	ASSERT_GE(s, 0);
+	ASSERT_TRUE(wait_for([&] { return server_side.load() != nullptr; }));
+	ClientSocket *cs = server_side;
+
+	// nothing is reading, so the socket buffers fill and the rest has to queue
+	const size_t chunk = 64 * 1024;
+	size_t total = 0;
+	bool accepted = true;
+	for (uint32_t i = 0; accepted && i < 1024; i++) {
+		byte_buffer bb;
+		for (size_t j = 0; j < chunk / 4; j++) bb << uint32_t(i * chunk / 4 + j);
+		accepted = cs->begin_send(bb);
+		total += chunk;
+	}
+	EXPECT_FALSE(accepted);
+	SendStats stats = cs->send_stats();
+	EXPECT_GT(stats.queued_bytes, 512u * 1024);
+	EXPECT_GT(stats.stalls, 0u);
+	EXPECT_GT(stats.bytes_sent_direct, 0u);
+	EXPECT_EQ(writable.load(), 0);
+
+	// drain it; everything arrives once, in order
+	std::vector<uint8_t> got;
+	got.reserve(total);
+	char buf[65536];
+	while (got.size() < total) {
+		ssize_t rx = recv(s, buf, sizeof(buf), 0);
+		ASSERT_GT(rx, 0);
+		got.insert(got.end(), buf, buf + rx);
+	}
+	byte_buffer::reader r(byte_view(got.data(), got.size()));
+	bool in_order = true;
+	for (size_t j = 0; j < total / 4; j++) in_order = in_order && r.get<uint32_t>() == j;
+	EXPECT_TRUE(in_order);
+	EXPECT_TRUE(wait_for([&] { return writable.load() == 1 && sent.load() == total - stats.bytes_sent_direct; }));
+	close(s);
+	ASSERT_TRUE(wait_for([&] { return closed.load(); }));
+	EXPECT_EQ(final_stats.queued_bytes, 0u);
+	EXPECT_EQ(final_stats.bytes_sent, total);
+	EXPECT_GE(final_stats.peak_queued_bytes, 512u * 1024);
+}
+
+TEST(ListenSocket, SurvivesAPeerThatResets) {
+	const size_t clients = 20;
+	std::atomic<size_t> failed { 0 };
+	ListenSocket server(0);
+	server.on_accepted.attach([&](const SocketResult &sr) {
+		sr.client->on_recieved.attach([&](const SocketResult &r) {
+			// by now the reset has arrived, so the replies can't go anywhere
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			// replies that can't be sent, but don't throw
+			for (int i = 0; i < 3; i++) r.client->begin_send(byte_chain(r.data));
+			return false;
+		});
+		sr.client->on_closed.attach([&](const SocketResult &r) {
+			if (!r.success) failed++;
+			return false;
+		});
+		return false;
+	});
+	for (size_t i = 0; i < clients; i++) {
+		int s = connect_to(server.listen_port());
+		ASSERT_GE(s, 0);
+		ASSERT_EQ(send(s, "hello", 5, 0), 5);
+		// closing with a zero linger time sends a reset rather than a fin
+		linger lg;
+		lg.l_onoff = 1;
+		lg.l_linger = 0;
+		ASSERT_EQ(setsockopt(s, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)), 0);
+		close(s);
+	}
+	EXPECT_TRUE(wait_for([&] { return failed.load() == clients; }));
+}
+
+TEST(ListenSocket, DropsAPeerSendingAnOversizedFrame) {
+	std::atomic<int> frames { 0 }, closed { 0 };
+	std::atomic<bool> clean { true };
+	ListenSocket server(0);
+	server.on_accepted.attach([&](const SocketResult &sr) {
+		sr.client->set_framing(frame_prefix::varint, 1024);
+		sr.client->on_frame.attach([&](const SocketResult &) {
+			frames++;
+			return false;
+		});
+		sr.client->on_closed.attach([&](const SocketResult &r) {
+			clean = r.success;
+			closed++;
+			return false;
+		});
+		return false;
+	});
+	int s = connect_to(server.listen_port());
+	ASSERT_GE(s, 0);
+	// one small frame, then a length of 2^28 - 1
+	const uint8_t bytes[] = { 0x02, 'o', 'k', 0xFF, 0xFF, 0xFF, 0x7F };
+	ASSERT_EQ(send(s, bytes, sizeof(bytes), 0), ssize_t(sizeof(bytes)));
+	EXPECT_TRUE(wait_for([&] { return closed.load() == 1; }));
+	EXPECT_FALSE(clean.load());
+	EXPECT_EQ(frames.load(), 1);
+	// and the peer sees the connection go
+	char buf[16];
+	EXPECT_LE(recv(s, buf, sizeof(buf), 0), 0);
+	close(s);
+}
+
+TEST(ListenSocket, EchoesOnEveryBackend) {
+	const int backends[] = { Reactor::backend_select, Reactor::backend_epoll, Reactor::backend_io_uring };
+	for (int backend : backends) {
+		if (!Reactor::available(backend)) continue;
+		Reactor::set_default_backend(backend);
+		ListenSocket server(0);
+		server.on_accepted.attach([](const SocketResult &sr) {
+			// replies from the reactor thread, which io_uring batches
+			sr.client->on_recieved.attach([](const SocketResult &r) {
+				r.client->begin_send(byte_chain(r.data));
+				return false;
+			});
+			return false;
+		});
+		ReactorPool::start(2);
+		const size_t clients = 100;
+		std::atomic<size_t> connected { 0 };
+		std::vector<std::unique_ptr<ClientSocket>> socks;
+		std::vector<std::unique_ptr<std::atomic<uint64_t>>> sums;
+		for (size_t i = 0; i < clients; i++) {
+			socks.emplace_back(new ClientSocket());
+			sums.emplace_back(new std::atomic<uint64_t>(0));
+			std::atomic<uint64_t> *sum = sums.back().get();
+			socks.back()->on_connected.attach([&](const SocketResult &sr) {
+				EXPECT_TRUE(sr.success);
+				connected++;
+				return false;
+			});
+			socks.back()->on_recieved.attach([sum](const SocketResult &sr) {
+				for (size_t j = 0; j < sr.data.size(); j++) *sum += sr.data.data()[j];
+				return false;
+			});
+			socks.back()->begin_connect("127.0.0.1", server.listen_port(), 0);
+		}
+		ASSERT_TRUE(wait_for([&] { return connected.load() == clients; })) << Reactor::backend();
+		// small messages, and a few too big for one receive buffer
+		std::vector<uint64_t> expected(clients, 0);
+		for (int round = 0; round < 20; round++) {
+			for (size_t i = 0; i < clients; i++) {
+				byte_buffer bb;
+				size_t n = (i % 10 == 0 && round % 5 == 0) ? 100000 : 1 + (i * 7 + round) % 200;
+				for (size_t j = 0; j < n; j++) {
+					uint8_t b = uint8_t(i + j * 13 + round);
+					bb << b;
+					expected[i] += b;
+				}
+				socks[i]->begin_send(bb);
+			}
+		}
+		EXPECT_TRUE(wait_for([&] {
+			for (size_t i = 0; i < clients; i++) {
+				if (sums[i]->load() != expected[i]) return false;
+			}
+			return true;
+		})) << Reactor::backend();
+		socks.clear();
+		ReactorPool::stop();
+	}
+	Reactor::set_default_backend(Reactor::backend_default);
+}
+#endif